@@ -31,13 +31,13 @@ Surface NIBR::fsAseg2CSFSurf(Image<int>& asegImg, float meanFaceArea)
 
 
     Surface csfSurf;
+    std::vector<Surface> csfParts; // Merged together at the end
     std::vector<int>  csfLabels;
     std::vector<int> sideLabels;
     int i = 0;
 
     for (auto l : labels) {
         Surface surf = label2surface(asegImg,l,((meanFaceArea==0) ? 0.25 : meanFaceArea));
-        csfSurf      = surfMerge(csfSurf,surf);
 
         for (int n = 0; n < surf.nv; n++) {
             csfLabels.push_back(l);
@@ -52,8 +52,13 @@ Surface NIBR::fsAseg2CSFSurf(Image<int>& asegImg, float meanFaceArea)
 
         i++;
         disp(MSG_DETAIL, "Generated CSF surface, label: %d - nv: %d", l, surf.nv);
+        csfParts.push_back(std::move(surf));
     }
 
+    std::vector<const Surface*> parts;
+    for (const auto& s : csfParts) parts.push_back(&s);
+    csfSurf = surfMerge(parts);
+
     auto makeAndAddField = [&](std::string fieldName,const std::vector<int> fData) {
 
         SurfaceField f;
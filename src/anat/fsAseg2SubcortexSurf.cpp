@@ -44,6 +44,7 @@ Surface NIBR::fsAseg2SubcortexSurf(Image<int>& asegImg, float meanFaceArea, bool
         RIGHT_VDC};
 
     Surface subCortex;
+    std::vector<Surface> subCortexParts; // Merged together at the end
     std::vector<int> subCortexLabels;
     std::vector<int> sideLabels;
     int labelNum = 1;
@@ -52,8 +53,6 @@ Surface NIBR::fsAseg2SubcortexSurf(Image<int>& asegImg, float meanFaceArea, bool
 
         Surface surf = label2surface(asegImg,l,((meanFaceArea==0) ? 0.25 : meanFaceArea));
 
-        subCortex = surfMerge(subCortex,surf);
-
         for (int n = 0; n < surf.nv; n++) {
             subCortexLabels.push_back(l);
             if (l == BRAINSTEM) {
@@ -65,6 +64,8 @@ Surface NIBR::fsAseg2SubcortexSurf(Image<int>& asegImg, float meanFaceArea, bool
 
         labelNum++;
 
+        subCortexParts.push_back(std::move(surf));
+
         return true;
 
     };
@@ -84,6 +85,10 @@ Surface NIBR::fsAseg2SubcortexSurf(Image<int>& asegImg, float meanFaceArea, bool
     }
 
 
+    std::vector<const Surface*> parts;
+    for (const auto& s : subCortexParts) parts.push_back(&s);
+    subCortex = surfMerge(parts);
+
     auto makeAndAddField = [&](std::string fieldName,const std::vector<int> fData) {
 
         SurfaceField f;
@@ -22,6 +22,7 @@ Surface NIBR::fslFirst2SubcortexSurf(std::string fslFirstFolder, float meanFaceA
     std::vector<std::string> label = {"Accu","Amyg","Caud","Hipp","Pall","Puta","Thal"};
 
     Surface subCortex;
+    std::vector<Surface> subCortexParts; // Merged together at the end
     std::vector<int> subCortexLabels;
     std::vector<int> sideLabels;
     int labelNum = 1;
@@ -45,8 +46,6 @@ Surface NIBR::fslFirst2SubcortexSurf(std::string fslFirstFolder, float meanFaceA
 
         surf.convertFSLsurface2RASmm(tempImg);
 
-        subCortex = surfMerge(subCortex,surf);
-
         for (int n = 0; n < surf.nv; n++) {
             subCortexLabels.push_back(labelNum);
             if (fprefix == "first-BrStem_first.vtk") {
@@ -58,6 +57,8 @@ Surface NIBR::fslFirst2SubcortexSurf(std::string fslFirstFolder, float meanFaceA
 
         labelNum++;
 
+        subCortexParts.push_back(std::move(surf));
+
         return true;
 
     };
@@ -78,6 +79,10 @@ Surface NIBR::fslFirst2SubcortexSurf(std::string fslFirstFolder, float meanFaceA
         }
     }
 
+    std::vector<const Surface*> parts;
+    for (const auto& s : subCortexParts) parts.push_back(&s);
+    subCortex = surfMerge(parts);
+
     auto makeAndAddField = [&](std::string fieldName,const std::vector<int> fData) {
 
         SurfaceField f;
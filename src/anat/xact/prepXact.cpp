@@ -225,26 +225,35 @@ std::vector<Surface> NIBR::prepXact(
         finalize(XactLabel::BG);
     }
 
-    // Create combined surface
-    std::vector<int> combinedLabelField;
+    // Create combined surface, all parts are merged together in a single pass
+    std::vector<int>            combinedLabelField;
+    std::vector<const Surface*> combinedParts{&out[XactLabel::COMBINED]};
+    std::vector<size_t>         labeledParts;
 
     for (size_t i = 1; i < out.size(); i++) {
 
         if ( (out[i].nv > 0) && ((opt & optMap[i]) || (opt & XACT_PREP_OPT_COMBINED))){
-            
-            std::vector<int> labelField(out[i].nv,labels[i]);
 
             if (opt & XACT_PREP_OPT_COMBINED) {
-                out[XactLabel::COMBINED] = surfMerge(out[XactLabel::COMBINED],out[i]);
-                combinedLabelField.insert(combinedLabelField.end(),labelField.begin(),labelField.end());
+                combinedParts.push_back(&out[i]);
+                combinedLabelField.insert(combinedLabelField.end(),out[i].nv,labels[i]);
             }
 
-            out[i].fields.push_back(out[i].makeVertField("xact",labelField));
+            labeledParts.push_back(i);
 
         }
 
     }
 
+    if (opt & XACT_PREP_OPT_COMBINED) {
+        out[XactLabel::COMBINED] = surfMerge(combinedParts);
+    }
+
+    for (auto i : labeledParts) {
+        std::vector<int> labelField(out[i].nv,labels[i]);
+        out[i].fields.push_back(out[i].makeVertField("xact",labelField));
+    }
+
 
     if (opt & XACT_PREP_OPT_COMBINED) {
         disp(MSG_INFO,"Finalizing the combined surface");
@@ -0,0 +1,198 @@
+#include "gzipWriter.h"
+#include "config.h"
+#include "multithreader.h"
+#include "zlib.h"
+#include <algorithm>
+#include <cstring>
+
+#define GZIP_BLOCK_SIZE         (256*1024)
+#define GZIP_DICTIONARY_SIZE    (32*1024)
+#define GZIP_BLOCKS_PER_THREAD  4
+
+using namespace NIBR;
+
+int& NIBR::GZIPCOMPRESSIONLEVEL() {
+    static int level = 6;
+    return level;
+}
+
+int& NIBR::GZIPTHREADCOUNT() {
+    static int nThreads = 0;
+    return nThreads;
+}
+
+NIBR::GzipWriter::GzipWriter() {
+    fp       = NULL;
+    level    = 6;
+    nThreads = 1;
+    ok       = false;
+    crc      = 0;
+    totalIn  = 0;
+}
+
+NIBR::GzipWriter::~GzipWriter() {
+    if (fp!=NULL) close();
+}
+
+bool NIBR::GzipWriter::open(const std::string& filePath, int _level, int _nThreads) {
+
+    if (fp!=NULL) close();
+
+    fp = fopen(filePath.c_str(), "wb");
+    if (fp==NULL) {
+        disp(MSG_ERROR, "Cannot open file for writing: %s", filePath.c_str());
+        return false;
+    }
+
+    level    = std::clamp(_level, 0, 9);
+    nThreads = (_nThreads > 0) ? _nThreads : NIBR::MT::MAXNUMBEROFTHREADS();
+    crc      = crc32(0L, Z_NULL, 0);
+    totalIn  = 0;
+    pending.clear();
+    dictionary.clear();
+
+    // Gzip header: magic, deflate, no flags, no time, no extra flags, unknown OS
+    const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255};
+    ok = (fwrite(header, 1, 10, fp) == 10);
+
+    return ok;
+}
+
+bool NIBR::GzipWriter::write(const void* buf, std::size_t len) {
+
+    if ((fp==NULL) || !ok) return false;
+
+    const std::size_t batchSize = std::size_t(GZIP_BLOCK_SIZE) * GZIP_BLOCKS_PER_THREAD * nThreads;
+    const unsigned char* inp    = (const unsigned char*)buf;
+
+    // Input is taken in pieces, so large writes are not copied all at once
+    while (len > 0) {
+        std::size_t n = std::min(len, batchSize - std::min(batchSize, pending.size()));
+        if (n == 0) n = len;
+        pending.insert(pending.end(), inp, inp + n);
+        inp += n;
+        len -= n;
+        if (pending.size() >= batchSize) {
+            if (!compressPending(false)) return false;
+        }
+    }
+
+    return ok;
+}
+
+// Compresses the full blocks in pending, or all of it if isLast. Non-final blocks end with a sync flush,
+// so that they are byte aligned and can be concatenated into a single deflate stream.
+bool NIBR::GzipWriter::compressPending(bool isLast) {
+
+    std::size_t blockCnt = pending.size() / GZIP_BLOCK_SIZE;
+    if (isLast && ((blockCnt == 0) || (pending.size() % GZIP_BLOCK_SIZE != 0))) blockCnt++;
+    if (blockCnt == 0) return true;
+
+    std::vector<std::vector<unsigned char>> out(blockCnt);
+    std::vector<uint32_t>                   blockCrc(blockCnt);
+    std::vector<uint8_t>                    blockOk(blockCnt,0);
+
+    auto blockBeg = [&](std::size_t b)->std::size_t {return b*GZIP_BLOCK_SIZE;};
+    auto blockLen = [&](std::size_t b)->std::size_t {return std::min(std::size_t(GZIP_BLOCK_SIZE), pending.size() - blockBeg(b));};
+
+    NIBR::MT::MTRUN(blockCnt, nThreads, [&](const NIBR::MT::TASK& task)->void {
+
+        const std::size_t    b   = task.no;
+        const std::size_t    len = blockLen(b);
+        unsigned char*       inp = pending.data() + blockBeg(b);
+
+        blockCrc[b] = crc32(crc32(0L, Z_NULL, 0), inp, uInt(len));
+
+        z_stream strm;
+        std::memset(&strm, 0, sizeof(strm));
+
+        // Raw deflate, the gzip wrapper is written by this class
+        if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return;
+
+        if (b > 0) {
+            std::size_t dictLen = std::min(std::size_t(GZIP_DICTIONARY_SIZE), blockBeg(b));
+            deflateSetDictionary(&strm, inp - dictLen, uInt(dictLen));
+        } else if (!dictionary.empty()) {
+            deflateSetDictionary(&strm, dictionary.data(), uInt(dictionary.size()));
+        }
+
+        out[b].resize(deflateBound(&strm, uLong(len)) + 64);
+
+        strm.next_in   = inp;
+        strm.avail_in  = uInt(len);
+        strm.next_out  = out[b].data();
+        strm.avail_out = uInt(out[b].size());
+
+        const int flush = (isLast && (b == blockCnt-1)) ? Z_FINISH : Z_SYNC_FLUSH;
+        const int ret   = deflate(&strm, flush);
+
+        if ( (strm.avail_in == 0) && ((flush == Z_FINISH) ? (ret == Z_STREAM_END) : (ret == Z_OK)) ) {
+            out[b].resize(strm.total_out);
+            blockOk[b] = 1;
+        }
+
+        deflateEnd(&strm);
+
+    });
+
+    std::size_t consumed = 0;
+
+    for (std::size_t b = 0; b < blockCnt; b++) {
+
+        if (!blockOk[b]) {
+            disp(MSG_ERROR, "Gzip compression failed");
+            ok = false;
+            return false;
+        }
+
+        if (fwrite(out[b].data(), 1, out[b].size(), fp) != out[b].size()) {
+            disp(MSG_ERROR, "Failed to write compressed data");
+            ok = false;
+            return false;
+        }
+
+        crc       = crc32_combine(crc, blockCrc[b], blockLen(b));
+        totalIn  += blockLen(b);
+        consumed += blockLen(b);
+    }
+
+    // Keep the end of the compressed input as the dictionary of the next block
+    std::size_t dictLen = std::min(std::size_t(GZIP_DICTIONARY_SIZE), consumed);
+    if (dictLen < GZIP_DICTIONARY_SIZE) {
+        dictionary.insert(dictionary.end(), pending.begin() + (consumed - dictLen), pending.begin() + consumed);
+        if (dictionary.size() > GZIP_DICTIONARY_SIZE)
+            dictionary.erase(dictionary.begin(), dictionary.end() - GZIP_DICTIONARY_SIZE);
+    } else {
+        dictionary.assign(pending.begin() + (consumed - dictLen), pending.begin() + consumed);
+    }
+
+    pending.erase(pending.begin(), pending.begin() + consumed);
+
+    return true;
+}
+
+bool NIBR::GzipWriter::close() {
+
+    if (fp==NULL) return false;
+
+    if (ok) compressPending(true);
+
+    if (ok) {
+        // Gzip trailer: CRC32 and input size modulo 2^32, both little endian
+        unsigned char trailer[8];
+        for (int i = 0; i < 4; i++) {
+            trailer[i]   = (unsigned char)((crc     >> (8*i)) & 0xff);
+            trailer[i+4] = (unsigned char)((totalIn >> (8*i)) & 0xff);
+        }
+        ok = (fwrite(trailer, 1, 8, fp) == 8);
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+    fp = NULL;
+
+    pending.clear();
+    pending.shrink_to_fit();
+    dictionary.clear();
+
+    return ok;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "base/nibr.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace NIBR 
+{
+
+    // Default compression level (0-9) and number of threads of GzipWriter.
+    // A thread count of 0 or less means MT::MAXNUMBEROFTHREADS().
+    int& GZIPCOMPRESSIONLEVEL();
+    int& GZIPTHREADCOUNT();
+
+    // Writes a standard, single member gzip file, which can be read by any gzip reader.
+    // Input is split into blocks which are deflated in parallel, as done by pigz. Each block
+    // is primed with the last 32 KB of the preceding input, so the compression ratio stays
+    // close to that of single threaded gzip.
+    class GzipWriter {
+
+    public:
+        GzipWriter();
+        ~GzipWriter();
+
+        bool open(const std::string& filePath, int level = GZIPCOMPRESSIONLEVEL(), int nThreads = GZIPTHREADCOUNT());
+        bool write(const void* buf, std::size_t len);
+        bool close();
+
+    private:
+        bool compressPending(bool isLast);
+
+        FILE*                      fp;
+        int                        level;
+        int                        nThreads;
+        bool                       ok;
+        uint32_t                   crc;
+        uint64_t                   totalIn;
+        std::vector<unsigned char> pending;     // Input that is not compressed yet
+        std::vector<unsigned char> dictionary;  // Last 32 KB of the compressed input
+    };
+
+}
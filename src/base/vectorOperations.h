@@ -2,6 +2,7 @@
 
 #include "base/nibr.h"
 #include "base/verbose.h"
+#include "base/multithreader.h"
 #include <algorithm>
 #include <vector>
 #include <cmath>
@@ -146,6 +147,94 @@ namespace NIBR
     }
 
 
+    // Gathers the elements of all buffers in "out", grouped by key, using a parallel LSD radix sort with 11-bit digits.
+    // key(element) must return a value in [0, keyCount). The sort is stable, i.e., the buffer order and the order within each buffer are preserved.
+    // The output is in CSR form: elements with key k are out[offsets[k]] ... out[offsets[k+1]-1].
+    // Buffers are emptied.
+    template<typename T, typename KeyFn>
+    void parallelGroupByKey(std::vector<std::vector<T>>& buffers, std::size_t keyCount, KeyFn key, std::vector<std::size_t>& offsets, std::vector<T>& out) {
+
+        // Concatenate buffers
+        std::vector<std::size_t> bufBeg(buffers.size()+1,0);
+        for (std::size_t b = 0; b < buffers.size(); b++) {
+            bufBeg[b+1] = bufBeg[b] + buffers[b].size();
+        }
+        const std::size_t N = bufBeg.back();
+
+        std::vector<T> tmp(N);
+        NIBR::MT::MTRUN(buffers.size(), [&](const NIBR::MT::TASK& task)->void {
+            std::move(buffers[task.no].begin(), buffers[task.no].end(), tmp.begin()+bufBeg[task.no]);
+            std::vector<T>().swap(buffers[task.no]);
+        });
+
+        constexpr int         RADIXBITS = 11;
+        constexpr std::size_t RADIX     = std::size_t(1) << RADIXBITS;
+
+        int passCount = 0;
+        while ( (keyCount > 1) && (passCount*RADIXBITS < 64) && (((keyCount-1) >> (passCount*RADIXBITS)) > 0) ) passCount++;
+
+        const std::size_t chunkCount = std::max<std::size_t>(1, std::min<std::size_t>(NIBR::MT::MAXNUMBEROFTHREADS(), N));
+        const std::size_t chunkSize  = (N + chunkCount - 1) / chunkCount;
+
+        std::vector<std::size_t> hist(chunkCount*RADIX);
+        out.resize(N);
+
+        for (int pass = 0; pass < passCount; pass++) {
+
+            const int shift = pass*RADIXBITS;
+
+            std::fill(hist.begin(), hist.end(), 0);
+
+            NIBR::MT::MTRUN(chunkCount, [&](const NIBR::MT::TASK& task)->void {
+                std::size_t  beg = task.no*chunkSize;
+                std::size_t  end = std::min(N, beg+chunkSize);
+                std::size_t* h   = &hist[task.no*RADIX];
+                for (std::size_t i = beg; i < end; i++) {
+                    h[(std::size_t(key(tmp[i])) >> shift) & (RADIX-1)]++;
+                }
+            });
+
+            // Exclusive prefix sum in digit-major, chunk-minor order keeps the sort stable
+            std::size_t sum = 0;
+            for (std::size_t d = 0; d < RADIX; d++) {
+                for (std::size_t c = 0; c < chunkCount; c++) {
+                    std::size_t cnt    = hist[c*RADIX+d];
+                    hist[c*RADIX+d]    = sum;
+                    sum               += cnt;
+                }
+            }
+
+            NIBR::MT::MTRUN(chunkCount, [&](const NIBR::MT::TASK& task)->void {
+                std::size_t  beg = task.no*chunkSize;
+                std::size_t  end = std::min(N, beg+chunkSize);
+                std::size_t* h   = &hist[task.no*RADIX];
+                for (std::size_t i = beg; i < end; i++) {
+                    out[h[(std::size_t(key(tmp[i])) >> shift) & (RADIX-1)]++] = std::move(tmp[i]);
+                }
+            });
+
+            tmp.swap(out);
+
+        }
+
+        out.swap(tmp);
+        std::vector<T>().swap(tmp);
+
+        // offsets[k] is the first index with key >= k
+        offsets.assign(keyCount+1, N);
+        NIBR::MT::MTRUN(chunkCount, [&](const NIBR::MT::TASK& task)->void {
+            std::size_t beg = task.no*chunkSize;
+            std::size_t end = std::min(N, beg+chunkSize);
+            for (std::size_t i = beg; i < end; i++) {
+                std::size_t k    = key(out[i]);
+                std::size_t prev = (i == 0) ? 0 : std::size_t(key(out[i-1]))+1;
+                for (std::size_t j = prev; j <= k; j++) {
+                    offsets[j] = i;
+                }
+            }
+        });
+
+    }
 
 
     template <typename T>
@@ -134,8 +134,8 @@ bool NIBR::FOD_Image::read() {
     
     // We will find and only process those voxels which have non-zero values
     disp(MSG_DETAIL,"Counting non-zero voxels");
-    std::vector<std::vector<int64_t>> nnzVoxelSubs = getNonZero3DVoxelSubs(this);
-    disp(MSG_DETAIL,"Number of non-zero voxels: %d", nnzVoxelSubs.size());
+    std::vector<int64_t> nnzVoxels = getNonZero3DVoxelIndices(this);
+    disp(MSG_DETAIL,"Number of non-zero voxels: %d", nnzVoxels.size());
     
     // We will make a new data array and load the data there
     int64_t nnt;
@@ -145,53 +145,64 @@ bool NIBR::FOD_Image::read() {
     } else {
         nnt = sh->getCoeffCount();
     }
-    
-    std::vector<std::vector<float>> Ylm;
 
-    if (isspheresliced) {
-        SH_basis(Ylm,sphereCoords,shOrder,hasNoOddCoeffs);
-    }
-
-    float* ddata = new float[nnt*voxCnt];
+    float* ddata = new float[nnt*voxCnt]();
     int    shNum = sh->getCoeffCount();
 
-    auto loadingTask = [&](const NIBR::MT::TASK& task)->void {
-        
-        // Get voxel subscripts
-        std::vector<int64_t> sub = nnzVoxelSubs[task.no];
+    std::vector<int64_t> inpOffsets(nnzVoxels.size());
+    std::vector<int64_t> outOffsets(nnzVoxels.size());
+    NIBR::MT::MTRUN(nnzVoxels.size(), [&](const NIBR::MT::TASK& task)->void {
+        int64_t i,j,k;
+        ind2sub(nnzVoxels[task.no],i,j,k);
+        inpOffsets[task.no] = sub2ind(i,j,k,0);
+        outOffsets[task.no] = nnzVoxels[task.no]*nnt;
+    });
 
-        // Get voxel values
-        float *FOD = new float[shNum];
-        
-        if (isspheresliced==false) {
-            for (int t=0; t<shNum; t++)
-                FOD[t] = data[sub2ind(sub[0],sub[1],sub[2],t)];
-        } else {
-            for (int n=0; n<shNum; n++) {
-                FOD[n] = 0.0f;
+    if ((isspheresliced==false) && (discretizationFlag==false)) {
+
+        auto loadingTask = [&](const NIBR::MT::TASK& task)->void {
+            for (int64_t t=0; t<nnt; t++)
+                ddata[outOffsets[task.no] + t] = data[inpOffsets[task.no] + t*s2i[3]];
+        };
+        NIBR::MT::MTRUN(nnzVoxels.size(),NIBR::MT::MAXNUMBEROFTHREADS(),"Loading FOD",loadingTask);
+
+    } else {
+
+        // Expansion of sphere-sliced values and synthesis with the unclamped basis are both linear, so they are combined into
+        // a single matrix that is applied to all voxels together. Negative amplitudes of the discretized FOD are then set to 0 as in sh->toSF.
+        Eigen::MatrixXf M = Eigen::MatrixXf::Identity(shNum,shNum);
+
+        if (isspheresliced) {
+            std::vector<std::vector<float>> Ylm;
+            SH_basis(Ylm,sphereCoords,shOrder,hasNoOddCoeffs);
+            M.resize(shNum,imgDims[3]);
+            for (int n=0; n<shNum; n++)
                 for (int64_t t=0; t<imgDims[3]; t++)
-                    FOD[n] += Ylm[t][n]*data[sub2ind(sub[0],sub[1],sub[2],t)];
-            }
-        }    
-        
-        if (discretizationFlag==true) {
-            for (int64_t t=0; t<nnt; t++) {
-                float dir[3] = {discVolSphCoords[t][0],discVolSphCoords[t][1],discVolSphCoords[t][2]};
-                ddata[t + sub[0]*nnt + sub[1]*nnt*imgDims[0] + sub[2]*nnt*imgDims[0]*imgDims[1]] = sh->toSF(FOD,dir);
-            }
-        } else {
-            for (int64_t t=0; t<nnt; t++) {
-                ddata[t + sub[0]*nnt + sub[1]*nnt*imgDims[0] + sub[2]*nnt*imgDims[0]*imgDims[1]] = FOD[t];
-            }
+                    M(n,t) = Ylm[t][n];
         }
- 
-        delete[] FOD;
-        
-    };
-    NIBR::MT::MTRUN(nnzVoxelSubs.size(),NIBR::MT::MAXNUMBEROFTHREADS(),"Loading FOD",loadingTask);
+
+        if (discretizationFlag) {
+            Eigen::MatrixXf D(nnt,shNum);
+            NIBR::MT::MTRUN(nnt, [&](const NIBR::MT::TASK& task)->void {
+                std::vector<float> B(shNum);
+                float dir[3] = {discVolSphCoords[task.no][0],discVolSphCoords[task.no][1],discVolSphCoords[task.no][2]};
+                sh->basis(B.data(),dir);
+                for (int n=0; n<shNum; n++)
+                    D(task.no,n) = B[n];
+            });
+            M = (D*M).eval();
+        }
+
+        disp(MSG_DETAIL,"Loading FOD");
+        if (discretizationFlag)
+            applyClampedMatrixAlongVolumes(M, NULL, data, inpOffsets, s2i[3], ddata, outOffsets, 1);
+        else
+            applyMatrixAlongVolumes(M, data, inpOffsets, s2i[3], ddata, outOffsets, 1);
+
+    }
     
     
-    delete[] data;
+    deallocData();
     
     data            = ddata;
     imgDims[3]      = nnt;
@@ -0,0 +1,27 @@
+#include "tractogramConn_batchIndexer.h"
+
+using namespace NIBR;
+
+void NIBR::SCbatchIndexer::run() {
+
+    if (imageIndexers.empty() && surfaceIndexers.empty()) {
+        disp(MSG_WARN,"No connectivity indexer is added.");
+        return;
+    }
+
+    disp(MSG_DETAIL,"Preparing %d image and %d surface indexers", int(imageIndexers.size()), int(surfaceIndexers.size()));
+
+    for (auto indexer : imageIndexers)   indexer->prepare();
+    for (auto indexer : surfaceIndexers) indexer->prepare();
+
+    tractogram->reset();
+
+    // Each streamline is read once and passed to all indexers
+    NIBR::MT::MTRUN(tractogram->numberOfStreamlines, "Computing connectomes", 
+        [&]()->void {
+            auto [success,streamline,streamlineId] = tractogram->getNextStreamline();
+            for (auto indexer : imageIndexers)   indexer->processStreamline(streamline,streamlineId);
+            for (auto indexer : surfaceIndexers) indexer->processStreamline(streamline,streamlineId);
+        } );
+
+}
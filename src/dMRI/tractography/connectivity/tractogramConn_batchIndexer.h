@@ -0,0 +1,33 @@
+#pragma once
+
+#include "base/nibr.h"
+#include "dMRI/tractography/io/tractogramReader.h"
+#include "dMRI/tractography/connectivity/tractogramConn_imageIndexer.h"
+#include "dMRI/tractography/connectivity/tractogramConn_surfaceIndexer.h"
+
+namespace NIBR 
+{
+
+    // Computes the connectomes of many image and surface indexers with a single pass over the tractogram.
+    // Indexers are configured as usual, e.g., with setEndType, setEndLength and addBackgroundLabel, before they are added.
+    // After run(), connectomes are written using writeConn of each indexer.
+    class SCbatchIndexer {
+
+    public:    
+        SCbatchIndexer(NIBR::TractogramReader* _tractogram) : tractogram(_tractogram) {}
+        ~SCbatchIndexer() {}
+
+        void addIndexer(NIBR::SCimageIndexer*   indexer) { imageIndexers.push_back(indexer);   }
+        void addIndexer(NIBR::SCsurfaceIndexer* indexer) { surfaceIndexers.push_back(indexer); }
+        
+        void run();
+
+    private:
+
+        NIBR::TractogramReader*               tractogram;
+        std::vector<NIBR::SCimageIndexer*>    imageIndexers;
+        std::vector<NIBR::SCsurfaceIndexer*>  surfaceIndexers;
+
+    };
+
+}
@@ -1,5 +1,6 @@
 #include "tractogramConn_imageIndexer.h"
 #include <fstream>
+#include <algorithm>
 
 using namespace NIBR;
 
@@ -56,6 +57,8 @@ NIBR::SCimageIndexer::SCimageIndexer(NIBR::TractogramReader* _tractogram, NIBR::
     endLengthThresh = 0;
     endType         = LAST_NONE_BG_LABEL;
 
+    isPrepared      = false;
+
 }
 
 NIBR::SCimageIndexer::~SCimageIndexer() { 
@@ -65,6 +68,21 @@ NIBR::SCimageIndexer::~SCimageIndexer() {
 
 void NIBR::SCimageIndexer::run() {
 
+    prepare();
+
+    tractogram->reset();
+
+    NIBR::MT::MTRUN(tractogram[0].numberOfStreamlines, "Computing connectome", 
+        [&]()->void {
+            auto [success,streamline,streamlineId] = tractogram->getNextStreamline();
+            processStreamline(streamline,streamlineId);
+        } );
+}
+
+void NIBR::SCimageIndexer::prepare() {
+
+    if (isPrepared) return;
+
     // If no bgLabel is added, add the default bgVal in the set
     if (bgLabels.empty())
         bgLabels.insert(0);
@@ -89,9 +107,9 @@ void NIBR::SCimageIndexer::run() {
 
         } else {
 
-            for (size_t i=0; i<original_labels.size(); i++)
-                if (original_labels[i] == val)
-                    img->data[task.no] = labels[i+1];
+            // original_labels are sorted since they are fetched from an std::set
+            auto it = std::lower_bound(original_labels.begin(), original_labels.end(), val);
+            img->data[task.no] = labels[std::distance(original_labels.begin(), it)+1];
 
         }
     };
@@ -101,13 +119,7 @@ void NIBR::SCimageIndexer::run() {
     labelCnt = original_labels.size();
     conn.resize(labelCnt, std::vector<std::set<size_t>>(labelCnt));
 
-    tractogram->reset();
-
-    NIBR::MT::MTRUN(tractogram[0].numberOfStreamlines, "Computing connectome", 
-        [&]()->void {
-            auto [success,streamline,streamlineId] = tractogram->getNextStreamline();
-            processStreamline(streamline,streamlineId);
-        } );
+    isPrepared = true;
 }
 
 
@@ -128,8 +140,6 @@ bool NIBR::SCimageIndexer::processStreamline(const Streamline& streamline, std::
     std::vector<NIBR::Segment> end1;
     std::vector<NIBR::Segment> end2;
 
-    std::mutex modifier;
-
     auto insert2Conn = [&]()->void {
         
         int frLabel, toLabel;
@@ -5,6 +5,7 @@
 #include "dMRI/tractography/io/tractogramReader.h"
 #include "image/image.h"
 #include <set>
+#include <mutex>
 
 namespace NIBR 
 {
@@ -25,6 +26,11 @@ namespace NIBR
         
 
         void run();
+
+        // prepare() relabels the image and allocates the connectome. It is called by run().
+        // After prepare(), processStreamline() can be called from multiple threads, e.g., by SCbatchIndexer.
+        void prepare();
+        bool processStreamline(const Streamline& streamline, std::size_t streamlineId);
         
         void setEndLength(float el)     { endLengthThresh = el; }
         void setEndType(SCEndType et)   { endType = et;         }
@@ -34,7 +40,6 @@ namespace NIBR
 
     private:
 
-        bool processStreamline(const Streamline& streamline, std::size_t streamlineId);
         bool isBg(int val);
 
         NIBR::TractogramReader* tractogram;
@@ -50,6 +55,8 @@ namespace NIBR
         std::vector<int> labels;                         // modified labels for faster vector access
         std::vector<std::vector<std::set<size_t>>> conn; // indices of streamlines
         size_t labelCnt;
+        bool   isPrepared;
+        std::mutex modifier;
 
     };
 
@@ -1,5 +1,6 @@
 #include "tractogramConn_surfaceIndexer.h"
 #include <fstream>
+#include <algorithm>
 
 using namespace NIBR;
 
@@ -56,6 +57,8 @@ NIBR::SCsurfaceIndexer::SCsurfaceIndexer(NIBR::TractogramReader* _tractogram, NI
     // Set default parameters
     endLengthThresh = 0;
 
+    isPrepared = false;
+
 }
 
 NIBR::SCsurfaceIndexer::~SCsurfaceIndexer() { 
@@ -65,6 +68,21 @@ NIBR::SCsurfaceIndexer::~SCsurfaceIndexer() {
 
 void NIBR::SCsurfaceIndexer::run() {
 
+    prepare();
+
+    tractogram->reset();
+
+    NIBR::MT::MTRUN(tractogram[0].numberOfStreamlines, "Computing connectome", 
+        [&]()->void {
+            auto [success,streamline,streamlineId] = tractogram->getNextStreamline();
+            processStreamline(streamline,streamlineId);
+        } );
+}
+
+void NIBR::SCsurfaceIndexer::prepare() {
+
+    if (isPrepared) return;
+
     // If no bgLabel is added, add the default bgVal in the set
     if (bgLabels.empty())
         bgLabels.insert(0);
@@ -98,19 +116,62 @@ void NIBR::SCsurfaceIndexer::run() {
         }
     }
 
+    // Convert face labels
+    for (auto& l : faceLabels) {
+        if (isBg(l)) {
+            l = bgVal;
+        } else {
+            auto it = std::lower_bound(original_labels.begin(), original_labels.end(), l);
+            l = labels[std::distance(original_labels.begin(), it)+1];
+        }
+    }
+
     // Create connectivity matrix
     labelCnt = original_labels.size();
     conn.resize(labelCnt, std::vector<std::set<size_t>>(labelCnt));
 
-    // Create tractogram to surface map
-    tractogram2surfaceMapper(tractogram, surf, tract2surfMap, true);
+    // Index surface for streamline tracing
+    surf->calcCentersOfFaces();
+    mask = indexSurfaceBoundary(surf,&img,&surfaceGrid,false);
 
-    // Compute connectome
-    NIBR::MT::MTRUN(tractogram[0].numberOfStreamlines, "Computing connectome", [&](const NIBR::MT::TASK& task)->void{processStreamline(task.no,task.threadId);} );
+    isPrepared = true;
 }
 
 
-bool NIBR::SCsurfaceIndexer::processStreamline(int, uint16_t) {
-    
+bool NIBR::SCsurfaceIndexer::processStreamline(const Streamline& streamline, std::size_t streamlineId) {
+
+    if (streamline.size()<2) 
+        return true;
+
+    std::vector<streamline2faceCrossing> crossings;
+    streamline2surfaceCrossings(streamline, streamlineId, surf, &img, mask, &surfaceGrid, crossings);
+
+    // Ignore crossings with background labels
+    crossings.erase(std::remove_if(crossings.begin(), crossings.end(), [&](const streamline2faceCrossing& c){return faceLabels[c.face]==bgVal;}), crossings.end());
+
+    if (crossings.empty())
+        return true;
+
+    auto [end1,end2] = std::minmax_element(crossings.begin(), crossings.end(), [](const streamline2faceCrossing& c1, const streamline2faceCrossing& c2){return c1.arcLength < c2.arcLength;});
+
+    if (endLengthThresh > 0) {
+
+        double totalLength = 0;
+        for (std::size_t i=0; i<streamline.size()-1; i++)
+            totalLength += dist(streamline[i].data(),streamline[i+1].data());
+
+        if ( (end1->arcLength > endLengthThresh) || ((totalLength - end2->arcLength) > endLengthThresh) )
+            return true;
+
+    }
+
+    int frLabel = faceLabels[end1->face];
+    int toLabel = faceLabels[end2->face];
+
+    if (frLabel > toLabel) std::swap(frLabel,toLabel);
+
+    std::lock_guard lock(modifier);
+    conn[frLabel-1][toLabel-1].insert(streamlineId);
+
     return true;
 }
@@ -7,11 +7,14 @@
 #include "image/image.h"
 #include "surface/surface.h"
 #include <set>
+#include <mutex>
 
 namespace NIBR 
 {
 
     // Structural connectivity surface indexer
+    // The label of each streamline end is the label of the first face crossed when walking from that end.
+    // If endLength is set (>0), crossings further than endLength from the streamline end are ignored.
     class SCsurfaceIndexer {
 
     public:    
@@ -19,6 +22,11 @@ namespace NIBR
         ~SCsurfaceIndexer();
         
         void run();
+
+        // prepare() relabels the faces, indexes the surface and allocates the connectome. It is called by run().
+        // After prepare(), processStreamline() can be called from multiple threads, e.g., by SCbatchIndexer.
+        void prepare();
+        bool processStreamline(const Streamline& streamline, std::size_t streamlineId);
         
         void setEndLength(float el)     { endLengthThresh = el; }
         void addBackgroundLabel(int bg) { bgLabels.insert(bg);  }
@@ -27,7 +35,6 @@ namespace NIBR
 
     private:
 
-        bool processStreamline(int _streamlineId, uint16_t _threadNo);
         bool isBg(int val);
 
         NIBR::TractogramReader*   tractogram;
@@ -35,7 +42,10 @@ namespace NIBR
         NIBR::SurfaceField*       surfLabels;
         std::vector<int>    faceLabels;                 // This is used to check the label. If input label is VERTEX then we create labels on FACEs.
 
-        std::vector<std::vector<NIBR::streamline2faceMap>> tract2surfMap;
+        // Surface indexing used for tracing streamlines
+        NIBR::Image<int>                                        img;
+        NIBR::BitMask                                           mask;
+        std::vector<std::vector<std::vector<std::vector<int>>>> surfaceGrid;
 
         float               endLengthThresh;
 
@@ -46,6 +56,8 @@ namespace NIBR
         std::vector<int> labels;                         // modified labels for faster vector access
         std::vector<std::vector<std::set<size_t>>> conn; // indices of streamlines
         size_t labelCnt;
+        bool   isPrepared;
+        std::mutex modifier;
 
     };
 
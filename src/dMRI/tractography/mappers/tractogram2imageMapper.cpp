@@ -4,6 +4,8 @@
 #include <set>
 #include <cfenv>
 
+#define MAPPER_BATCH_SIZE 100000
+
 using namespace NIBR;
 
 template<typename T>
@@ -29,15 +31,8 @@ NIBR::Tractogram2ImageMapper<T>::Tractogram2ImageMapper(NIBR::TractogramReader*
 template<typename T>
 NIBR::Tractogram2ImageMapper<T>::Tractogram2ImageMapper::~Tractogram2ImageMapper() {
 
-    if ((maskFromImage) && (mask!=NULL)) {
-        for (int i = 0; i < img->imgDims[0]; i++) {
-            for (int j = 0; j < img->imgDims[1]; j++) {
-                delete[] mask[i][j];
-            }
-            delete[] mask[i];
-        }
-        delete[] mask;
-    }
+    if ((maskFromImage) && (mask!=NULL))
+        delete mask;
 
     if (weightFile!=NULL) {
         for (int t = 0; t < NIBR::MT::MAXNUMBEROFTHREADS(); t++) {
@@ -78,23 +73,9 @@ bool NIBR::Tractogram2ImageMapper<T>::setMask(NIBR::Image<int>* maskImg) {
 
     maskImg->read();
     
-    mask = new bool**[static_cast<uint32_t>(maskImg->imgDims[0])];
-    for (int i = 0; i < maskImg->imgDims[0]; i++) {
-        mask[i] = new bool*[static_cast<uint32_t>(maskImg->imgDims[1])];
-        for (int j = 0; j < maskImg->imgDims[1]; j++) {
-            mask[i][j] = new bool[static_cast<uint32_t>(maskImg->imgDims[2])];
-            for (int k = 0; k < maskImg->imgDims[2]; k++) {
-                if ((*maskImg)(i,j,k)>0) {
-                    mask[i][j][k] = true;
-                    if (!useMutexGrid) {
-                        mutexMap.try_emplace(static_cast<uint32_t>(maskImg->sub2ind(i, j, k)));
-                    }
-                } else {
-                    mask[i][j][k] = false;
-                }                
-            }
-        }
-    }
+    BitMask* imgMask = new BitMask();
+    imgMask->fromImage(*maskImg, [](int val)->bool {return val>0;});
+    setMask(imgMask);
 
     maskFromImage = true;
 
@@ -128,23 +109,9 @@ bool NIBR::Tractogram2ImageMapper<T>::setMask(NIBR::Image<int>* maskImg, int sel
 
     maskImg->read();
 
-    mask = new bool**[static_cast<uint32_t>(maskImg->imgDims[0])];
-    for (int i = 0; i < maskImg->imgDims[0]; i++) {
-        mask[i] = new bool*[static_cast<uint32_t>(maskImg->imgDims[1])];
-        for (int j = 0; j < maskImg->imgDims[1]; j++) {
-            mask[i][j] = new bool[static_cast<uint32_t>(maskImg->imgDims[2])];
-            for (int k = 0; k < maskImg->imgDims[2]; k++) {
-                if ((*maskImg)(i,j,k)==selectedLabel) {
-                    mask[i][j][k] = true;
-                    if (!useMutexGrid) {
-                        mutexMap.try_emplace(static_cast<uint32_t>(maskImg->sub2ind(i, j, k)));
-                    }
-                } else {
-                    mask[i][j][k] = false;
-                }
-            }
-        }
-    }
+    BitMask* imgMask = new BitMask();
+    imgMask->fromLabel(*maskImg, selectedLabel);
+    setMask(imgMask);
 
     maskFromImage = true;
 
@@ -154,20 +121,14 @@ bool NIBR::Tractogram2ImageMapper<T>::setMask(NIBR::Image<int>* maskImg, int sel
 
 
 template<typename T>
-void NIBR::Tractogram2ImageMapper<T>::setMask(bool*** _mask) {
+void NIBR::Tractogram2ImageMapper<T>::setMask(NIBR::BitMask* _mask) {
 
     mask = _mask;
 
     if (!useMutexGrid) {
-        for (int i = 0; i < img->imgDims[0]; i++) {
-            for (int j = 0; j < img->imgDims[1]; j++) {
-                for (int k = 0; k < img->imgDims[2]; k++) {
-                    if (mask[i][j][k]) {
-                        mutexMap.try_emplace(static_cast<uint32_t>(img->sub2ind(i, j, k)));
-                    }
-                }
-            }
-        }
+        mask->forEach([&](int64_t i, int64_t j, int64_t k)->void {
+            mutexMap.try_emplace(static_cast<uint32_t>(img->sub2ind(i, j, k)));
+        });
     }
 
     // NIBR::disp(MSG_DETAIL,"mutexMap size: %d", mutexMap.size());
@@ -205,33 +166,14 @@ void NIBR::Tractogram2ImageMapper<T>::run(
         std::function<void(Tractogram2ImageMapper<T>* tim)> outputCompiler_f
         ) 
 {
-    // NIBR::disp(MSG_DETAIL,"Starting complete run");
-
-    if (useMutexGrid) {
+    if (useMutexGrid && (mutexGrid==NULL)) {
         mutexGrid = new std::mutex[img->voxCnt];
     }
 
-    tractogram->reset();
-
-    NIBR::disp(MSG_DEBUG,"Calling fetchAndProcess");
-
-    auto fetchAndProcess = [&](const NIBR::MT::TASK& task)->void {
-        StreamlineBatch kernel(std::get<1>(smoothing)+1);
-        
-        auto [success,streamline,streamlineId] = tractogram->getNextStreamline();
-
-        NIBR::disp(MSG_DEBUG,"Read %d",streamlineId);
-
-        kernel[0] = std::move(streamline);
-
-        processStreamline(kernel,streamlineId,task.threadId, processor_f);
-    };
-
     // Process the tractogram and fill
-    NIBR::MT::MTRUN(tractogram->numberOfStreamlines, "Tractogram to image mapping", fetchAndProcess);
+    processRange(processor_f, 0, tractogram->numberOfStreamlines, "Tractogram to image mapping");
 
     // Compile output
-    // NIBR::disp(MSG_DETAIL,"Compiling output all");
     outputCompiler_f(this);
 
 }
@@ -244,46 +186,137 @@ void NIBR::Tractogram2ImageMapper<T>::run(
         int endInd
         ) 
 {
-    if (!tractogram->isPreloaded()) {
-        NIBR::disp(MSG_DETAIL,"This function requires preloaded tractograms");
+    if ((beginInd<0) || (endInd<beginInd) || (std::size_t(endInd)>=tractogram->numberOfStreamlines)) {
+        NIBR::disp(MSG_ERROR,"Invalid streamline range [%d, %d] for a tractogram with %d streamlines", beginInd, endInd, int(tractogram->numberOfStreamlines));
+        return;
     }
 
-    // NIBR::disp(MSG_DETAIL,"Starting partial run");
-
-    if (useMutexGrid) {
+    if (useMutexGrid && (mutexGrid==NULL)) {
         mutexGrid = new std::mutex[img->voxCnt];
     }
 
+    // Process the tractogram and fill
+    processRange(processor_f, beginInd, std::size_t(endInd)+1, "Tractogram part to image mapping");
+
+    // Compile output
+    outputCompiler_f(this);
+    
+}
+
+// Maps streamlines in [beginInd, endInd). Preloaded tractograms are accessed directly.
+// Otherwise the reader is consumed in bounded batches, while its producer thread prefetches
+// the following streamlines from disk, so memory use does not grow with the tractogram size.
+template<typename T>
+void NIBR::Tractogram2ImageMapper<T>::processRange(
+        std::function<void(Tractogram2ImageMapper<T>* tim, int* _gridPos, NIBR::Segment& _seg)> processor_f,
+        std::size_t beginInd,
+        std::size_t endInd,
+        std::string message
+        )
+{
+    if (endInd<=beginInd) return;
+
+    const std::size_t N = endInd - beginInd;
+
+    if (std::get<1>(smoothing)>1) {
+        const std::size_t threadCount = NIBR::MT::MAXNUMBEROFTHREADS();
+        smoothingFrames.resize(threadCount);
+        smoothingScale_N.resize(threadCount);
+        smoothingScale_B.resize(threadCount);
+        smoothingBuffer.resize(threadCount);
+    }
+
+    if (tractogram->isPreloaded()) {
+
+        NIBR::MT::MTRUN(N, message, [&](const NIBR::MT::TASK& task)->void {
+            processStreamline(tractogram->getStreamline(task.no+beginInd),task.no+beginInd,task.threadId,processor_f);
+        });
+
+        return;
+    }
+
     tractogram->reset();
 
-    // Process the tractogram and fill
-    NIBR::MT::MTRUN(endInd-beginInd+1, "Tractogram part to image mapping", [&](const NIBR::MT::TASK& task)->void {
+    // Skip the streamlines before beginInd
+    std::size_t skipped = 0;
+    while (skipped < beginInd) {
+        StreamlineBatch skip = tractogram->getNextStreamlineBatch(std::min(std::size_t(MAPPER_BATCH_SIZE), beginInd-skipped));
+        if (skip.empty()) break;
+        skipped += skip.size();
+    }
 
-            StreamlineBatch kernel(std::get<1>(smoothing)+1);
+    if (skipped < beginInd) {
+        NIBR::disp(MSG_ERROR,"Could not reach streamline %d", int(beginInd));
+        return;
+    }
 
-            // NIBR::disp(MSG_DETAIL,"Reading streamline %d", int(task.no+beginInd));
-            kernel[0] = tractogram->getStreamline(task.no+beginInd);
+    // Stream the requested range batch by batch
+    std::size_t processed = 0;
+    while (processed < N) {
 
-            // NIBR::disp(MSG_DETAIL,"Processing streamline %d", int(task.no+beginInd));
-            processStreamline(kernel,task.no+beginInd,task.threadId, processor_f);
+        StreamlineBatch batch = tractogram->getNextStreamlineBatch(std::min(std::size_t(MAPPER_BATCH_SIZE), N-processed));
+        if (batch.empty()) {
+            NIBR::disp(MSG_WARN,"Tractogram ended after %d streamlines", int(beginInd+processed));
+            break;
+        }
+
+        const std::size_t offset = beginInd + processed;
 
+        NIBR::MT::SET_DISP_RANGE(processed, N);
+        NIBR::MT::MTRUN(batch.size(), message, [&](const NIBR::MT::TASK& task)->void {
+            processStreamline(batch[task.no],task.no+offset,task.threadId,processor_f);
         });
 
-    // Compile output
-    // NIBR::disp(MSG_DETAIL,"Compiling output part");
-    outputCompiler_f(this);
-    
+        processed += batch.size();
+    }
+
 }
 
 template<typename T1>
-bool NIBR::Tractogram2ImageMapper<T1>::processStreamline(StreamlineBatch& kernel, int streamlineId, uint16_t threadNo, std::function<void(Tractogram2ImageMapper<T1>* tim, int* gridPos, NIBR::Segment& seg)> f) {
+bool NIBR::Tractogram2ImageMapper<T1>::processStreamline(const Streamline& streamline, int streamlineId, uint16_t threadNo, std::function<void(Tractogram2ImageMapper<T1>* tim, int* gridPos, NIBR::Segment& seg)> f) {
 
     // If streamline is empty, exit.
-    NIBR::disp(MSG_DEBUG,"Starting processing");
+    if (streamline.empty()) return true;
+
+    const int par = std::get<1>(smoothing);
+
+    if (par<=1) return traceStreamline(streamline, streamlineId, threadNo, f);
 
-    int len = kernel[0].size();
+    // Apply anisotropic smoothing.
+    // Parallel streamlines are generated one at a time from the parallel transport frame into
+    // reusable per-thread buffers, instead of allocating a new batch for each input streamline.
+    // Random offsets are drawn in the same order as getParallelStreamlines(streamline,sigma,N,threadId).
+    if (streamline.size()<2) return true;
 
-    NIBR::disp(MSG_DEBUG,"Len: %d",len);
+    const float sigma = std::get<0>(smoothing);
+
+    std::vector<float>& scale_N = smoothingScale_N[threadNo];
+    std::vector<float>& scale_B = smoothingScale_B[threadNo];
+    scale_N.resize(par);
+    scale_B.resize(par);
+    for (int n = 0; n < par; n++) {
+        scale_N[n] = NIBR::MT::RNDM()[threadNo]->normal_m0_s1() * sigma;
+        scale_B[n] = NIBR::MT::RNDM()[threadNo]->normal_m0_s1() * sigma;
+    }
+
+    computeParallelTransportFrames(streamline, smoothingFrames[threadNo], threadNo);
+
+    // The first streamline of the kernel is the input itself
+    traceStreamline(streamline, streamlineId, threadNo, f);
+
+    Streamline& parallel = smoothingBuffer[threadNo];
+    for (int n = 0; n < par; n++) {
+        makeParallelStreamline(streamline, smoothingFrames[threadNo], scale_N[n], scale_B[n], parallel);
+        traceStreamline(parallel, streamlineId, threadNo, f);
+    }
+
+    return true;
+}
+
+template<typename T1>
+bool NIBR::Tractogram2ImageMapper<T1>::traceStreamline(const Streamline& streamline, int streamlineId, uint16_t threadNo, std::function<void(Tractogram2ImageMapper<T1>* tim, int* gridPos, NIBR::Segment& seg)> f) {
+
+    int len = streamline.size();
 
     if (len==0) return true;
     
@@ -291,208 +324,195 @@ bool NIBR::Tractogram2ImageMapper<T1>::processStreamline(StreamlineBatch& kernel
 
     int32_t A[3], B[3];
 
-    // Apply anisotropic smoothing
-    if (std::get<1>(smoothing)>1) {
-        const Streamline tmp = kernel[0];
-        kernel = getParallelStreamlines(tmp, std::get<0>(smoothing), std::get<1>(smoothing), threadNo);
-    }
+    NIBR::Segment seg;
+    seg.streamlineNo = streamlineId;
+    // NIBR::disp(MSG_DETAIL,"seg.streamlineNo: %d",seg.streamlineNo);
 
-    for (const auto& streamline : kernel) {
-    
-        NIBR::Segment seg;
-        seg.streamlineNo = streamlineId;
-        // NIBR::disp(MSG_DETAIL,"seg.streamlineNo: %d",seg.streamlineNo);
+    float segWeight = 0.0f;
 
-        if (weightType!=NO_WEIGHT) {
+    if (weightType!=NO_WEIGHT) {
 
-            // NIBR::disp(MSG_DETAIL,"Making segment data.");
-            seg.data = new float;
+        seg.data = &segWeight;
 
-            if (weights.empty()) {
-                if (weightType==STREAMLINE_WEIGHT) {
-                    fseek(weightFile[threadNo], sizeof(float)*streamlineId, SEEK_SET);
-                    // NIBR::disp(MSG_DETAIL,"Reading weight.");
-                    std::fread((float*)seg.data, sizeof(float), 1, weightFile[threadNo]);
-                    // NIBR::disp(MSG_DETAIL,"Weight: %.2f", *(float*)seg.data);
-                } else {
-                    const auto& cumLen = tractogram->getNumberOfPoints();
-                    fseek(weightFile[threadNo], sizeof(float)*cumLen[streamlineId], SEEK_SET);
-                }
+        if (weights.empty()) {
+            if (weightType==STREAMLINE_WEIGHT) {
+                fseek(weightFile[threadNo], sizeof(float)*streamlineId, SEEK_SET);
+                // NIBR::disp(MSG_DETAIL,"Reading weight.");
+                std::fread((float*)seg.data, sizeof(float), 1, weightFile[threadNo]);
+                // NIBR::disp(MSG_DETAIL,"Weight: %.2f", *(float*)seg.data);
             } else {
-                if (weightType==STREAMLINE_WEIGHT) {
-                    *((float*)(seg.data)) = weights[streamlineId];
-                }
+                const auto& cumLen = tractogram->getNumberOfPoints();
+                fseek(weightFile[threadNo], sizeof(float)*cumLen[streamlineId], SEEK_SET);
             }
-
-        }
-        
-        // End of segment in real and its corner in image space
-        img->to_ijk(streamline[0].data(),p0);
-        A[0]  = std::round(p0[0]);
-        A[1]  = std::round(p0[1]);
-        A[2]  = std::round(p0[2]);
-        
-        // If streamline has 1 point and no segment
-        if (len==1) {
-
-            if ( img->isInside(A) && ((mask==NULL) || mask[A[0]][A[1]][A[2]]) ) {
-
-                seg.p[0]   = streamline[0][0];
-                seg.p[1]   = streamline[0][1];
-                seg.p[2]   = streamline[0][2];
-                seg.dir[0] = 1.0f;
-                seg.dir[1] = 0.0f;
-                seg.dir[2] = 0.0f;
-                seg.length = 0.0f;
-                
-                f(this, A, seg);
-                
+        } else {
+            if (weightType==STREAMLINE_WEIGHT) {
+                *((float*)(seg.data)) = weights[streamlineId];
             }
+        }
+
+    }
+    
+    // End of segment in real and its corner in image space
+    img->to_ijk(streamline[0].data(),p0);
+    A[0]  = std::round(p0[0]);
+    A[1]  = std::round(p0[1]);
+    A[2]  = std::round(p0[2]);
+    
+    // If streamline has 1 point and no segment
+    if (len==1) {
+
+        if ( img->isInside(A) && ((mask==NULL) || (*mask)(A)) ) {
+
+            seg.p[0]   = streamline[0][0];
+            seg.p[1]   = streamline[0][1];
+            seg.p[2]   = streamline[0][2];
+            seg.dir[0] = 1.0f;
+            seg.dir[1] = 0.0f;
+            seg.dir[2] = 0.0f;
+            seg.length = 0.0f;
+            
+            f(this, A, seg);
             
-            continue;
         }
         
-        std::set<size_t> voxelInds;
-        std::pair<std::set<size_t>::iterator,bool> voxelChecker;
+        return true;
+    }
+    
+    std::set<size_t> voxelInds;
+    std::pair<std::set<size_t>::iterator,bool> voxelChecker;
 
-        auto sub2ind = [&] () -> size_t {return A[0] + A[1]*img->imgDims[1] + A[2]*img->imgDims[1]*img->imgDims[2];};
-        
-        auto runFun = [&]() {
+    auto sub2ind = [&] () -> size_t {return A[0] + A[1]*img->imgDims[1] + A[2]*img->imgDims[1]*img->imgDims[2];};
+    
+    auto runFun = [&]() {
 
-            if ( img->isInside(A) && ((mask==NULL) || mask[A[0]][A[1]][A[2]]) ) {
+        if ( img->isInside(A) && ((mask==NULL) || (*mask)(A)) ) {
 
-                // NIBR::disp(MSG_DETAIL,"seg.p:      [%.2f, %.2f, %.2f]",  seg.p[0],  seg.p[1],  seg.p[2]);
-                // NIBR::disp(MSG_DETAIL,"seg.dir:    [%.2f, %.2f, %.2f]",seg.dir[0],seg.dir[1],seg.dir[2]);
-                // NIBR::disp(MSG_DETAIL,"seg.length: %.2f",seg.length);
+            // NIBR::disp(MSG_DETAIL,"seg.p:      [%.2f, %.2f, %.2f]",  seg.p[0],  seg.p[1],  seg.p[2]);
+            // NIBR::disp(MSG_DETAIL,"seg.dir:    [%.2f, %.2f, %.2f]",seg.dir[0],seg.dir[1],seg.dir[2]);
+            // NIBR::disp(MSG_DETAIL,"seg.length: %.2f",seg.length);
 
-                if (mapOnce) {
-                    voxelChecker = voxelInds.insert(sub2ind());
-                    if (voxelChecker.second) {
-                        f(this, A, seg);
-                    }
-                } else {
+            if (mapOnce) {
+                voxelChecker = voxelInds.insert(sub2ind());
+                if (voxelChecker.second) {
                     f(this, A, seg);
                 }
-                
+            } else {
+                f(this, A, seg);
             }
+            
+        }
 
-        };        
-        
-        // If streamline has many points and segments
-        for (int i=0; i<len-1; i++) {
-
-            // Read if the segment weight is given
-            if (weightType==SEGMENT_WEIGHT) {
-                if (weights.empty()) {
-                    std::fread((float*)seg.data, sizeof(float), 1, weightFile[threadNo]);
-                } else {
-                    const auto& cumLen = tractogram->getNumberOfPoints();
-                    *((float*)(seg.data)) = weights[cumLen[streamlineId]+i];
-                }
+    };        
+    
+    // If streamline has many points and segments
+    for (int i=0; i<len-1; i++) {
+
+        // Read if the segment weight is given
+        if (weightType==SEGMENT_WEIGHT) {
+            if (weights.empty()) {
+                std::fread((float*)seg.data, sizeof(float), 1, weightFile[threadNo]);
+            } else {
+                const auto& cumLen = tractogram->getNumberOfPoints();
+                *((float*)(seg.data)) = weights[cumLen[streamlineId]+i];
             }
+        }
 
-            // End of segment in real and its corner in image space
-            img->to_ijk(streamline[i+1].data(),p1);
-            for (int m=0;m<3;m++) {
-                seg.p[m]   = streamline[i][m];
-                seg.dir[m] = streamline[i+1][m] - streamline[i][m];
-                B[m]       = std::round(p1[m]);
-            }    
-            
-            // Find segment length and direction in real space
-            lengthR = norm(seg.dir);
-            for (int m=0;m<3;m++)
-                seg.dir[m] /= lengthR;
-            
-            
-            // Segment does not leave the voxel, add this segment and continue with the next one
-            if ( (A[0]==B[0]) && (A[1]==B[1]) && (A[2]==B[2]) ) {
+        // End of segment in real and its corner in image space
+        img->to_ijk(streamline[i+1].data(),p1);
+        for (int m=0;m<3;m++) {
+            seg.p[m]   = streamline[i][m];
+            seg.dir[m] = streamline[i+1][m] - streamline[i][m];
+            B[m]       = std::round(p1[m]);
+        }    
+        
+        // Find segment length and direction in real space
+        lengthR = norm(seg.dir);
+        for (int m=0;m<3;m++)
+            seg.dir[m] /= lengthR;
+        
+        
+        // Segment does not leave the voxel, add this segment and continue with the next one
+        if ( (A[0]==B[0]) && (A[1]==B[1]) && (A[2]==B[2]) ) {
 
-                seg.length = lengthR;
-                runFun();
-                
-                for (int m=0;m<3;m++) {
-                    p0[m] = p1[m];
-                }
-                
-                continue;
-                
+            seg.length = lengthR;
+            runFun();
+            
+            for (int m=0;m<3;m++) {
+                p0[m] = p1[m];
             }
             
-            // Find length and direction of segment in image space
-            for (int m=0;m<3;m++)
-                dir[m] = p1[m] - p0[m];
-            length = norm(dir);
-            for (int m=0;m<3;m++)
-                dir[m] /= length;
+            continue;
             
+        }
+        
+        // Find length and direction of segment in image space
+        for (int m=0;m<3;m++)
+            dir[m] = p1[m] - p0[m];
+        length = norm(dir);
+        for (int m=0;m<3;m++)
+            dir[m] /= length;
+        
+        
+        // Grid lengthScale
+        lengthScale = std::sqrt(dir[0]*img->pixDims[0]*dir[0]*img->pixDims[0]+dir[1]*img->pixDims[1]*dir[1]*img->pixDims[1]+dir[2]*img->pixDims[2]*dir[2]*img->pixDims[2]);
+
+        auto pushSegment = [&](float pushAmount)->bool {
+
+            // Update segment length and run the function
+            seg.length = pushAmount*lengthScale;
+            runFun();
+
+            length    -= pushAmount;               // Update remaining length in image space
+            lengthR   -= pushAmount*lengthScale;   // Update remaining length in real space
             
-            // Grid lengthScale
-            lengthScale = std::sqrt(dir[0]*img->pixDims[0]*dir[0]*img->pixDims[0]+dir[1]*img->pixDims[1]*dir[1]*img->pixDims[1]+dir[2]*img->pixDims[2]*dir[2]*img->pixDims[2]);
+            for (int m=0;m<3;m++) {     
+                p0[m]    += pushAmount*dir[m];               // Move the initial point of the segment in image space
+                A[m]      = std::round(p0[m]);               // Update the current voxel
+                seg.p[m] += seg.length*seg.dir[m];           // Move the initial point of the segment in real space
+            }
 
-            auto pushSegment = [&](float pushAmount)->bool {
+            if ( (A[0]==B[0]) && (A[1]==B[1]) && (A[2]==B[2]) ) {
 
                 // Update segment length and run the function
-                seg.length = pushAmount*lengthScale;
+                seg.length = lengthR;
                 runFun();
-
-                length    -= pushAmount;               // Update remaining length in image space
-                lengthR   -= pushAmount*lengthScale;   // Update remaining length in real space
                 
-                for (int m=0;m<3;m++) {     
-                    p0[m]    += pushAmount*dir[m];               // Move the initial point of the segment in image space
-                    A[m]      = std::round(p0[m]);               // Update the current voxel
-                    seg.p[m] += seg.length*seg.dir[m];           // Move the initial point of the segment in real space
-                }
-
-                if ( (A[0]==B[0]) && (A[1]==B[1]) && (A[2]==B[2]) ) {
-
-                    // Update segment length and run the function
-                    seg.length = lengthR;
-                    runFun();
-                    
-                    return true;
-                }
+                return true;
+            }
 
-                return false;
+            return false;
 
-            };
+        };
 
-            
-            t = 0.0;
-
-            while (length > 0.0) {
-            
-                if (rayTraceVoxel(A,p0,dir,t)) {
-                    // i.e. if true, there is intersection, and the part until t is inside the current voxel
-                    // Therefore, if the intersection happened, then t*dir[m] will still be inside the current voxel
+        
+        t = 0.0;
 
-                    // Cut t at length
-                    t = std::min(t,length);
+        while (length > 0.0) {
+        
+            if (rayTraceVoxel(A,p0,dir,t)) {
+                // i.e. if true, there is intersection, and the part until t is inside the current voxel
+                // Therefore, if the intersection happened, then t*dir[m] will still be inside the current voxel
 
-                    if(pushSegment(t))
-                        break;
+                // Cut t at length
+                t = std::min(t,length);
 
-                }
-                
-                // Push the segment by EPS4 or by length. This does not introduce any errors. 
-                // It is only manually moving the point instead of the ray-tracer since ray-tracing stops exactly at the voxel edge
-                if (pushSegment(std::min(EPS4,length)))
+                if(pushSegment(t))
                     break;
-                            
-            }
 
-            for (int m=0;m<3;m++) {
-                p0[m]    = p1[m];
-                A[m]     = B[m];
             }
             
+            // Push the segment by EPS4 or by length. This does not introduce any errors. 
+            // It is only manually moving the point instead of the ray-tracer since ray-tracing stops exactly at the voxel edge
+            if (pushSegment(std::min(EPS4,length)))
+                break;
+                        
+        }
 
+        for (int m=0;m<3;m++) {
+            p0[m]    = p1[m];
+            A[m]     = B[m];
         }
         
-        if (weightType!=NO_WEIGHT) {
-            delete (float*)(seg.data);
-        }        
 
     }
     
@@ -4,6 +4,7 @@
 #include "math/core.h"
 #include "dMRI/tractography/io/tractogramReader.h"
 #include "image/image.h"
+#include "image/image_bitmask.h"
 #include <atomic>
 #include <map>
 #include <mutex>
@@ -42,14 +43,14 @@ namespace NIBR
         void setMapOnce(bool val) {mapOnce=val;}
         bool setMask(NIBR::Image<int>* maskImg);
         bool setMask(NIBR::Image<int>* maskImg, int selectedLabel);
-        void setMask(bool*** _mask);
+        void setMask(NIBR::BitMask* _mask);                      // mask is not copied and must have the dimensions of img
         void anisotropicSmoothing(std::tuple<float,int> _smoothing) {smoothing = _smoothing;}
         void setWeights(std::string _weightFile, WEIGHTTYPE _weightType);
         void setWeights(std::vector<float> _weights, WEIGHTTYPE _weightType);
         void setData(void* _data) {data = _data;}
         void optimizeForSmallMask(bool val) {useMutexGrid = !val;}
 
-        bool***                                 mask;
+        NIBR::BitMask*                          mask;
         std::vector<void*>                      grid;          // Grid holds a void* for each img->voxCnt
 
         bool                                    useMutexGrid;
@@ -68,8 +69,22 @@ namespace NIBR
 
     private:
 
+        void processRange(
+            std::function<void(Tractogram2ImageMapper<T>* tim, int* _gridPos, NIBR::Segment& _seg)> processor_f,
+            std::size_t beginInd,
+            std::size_t endInd,
+            std::string message
+        );
+
         bool processStreamline(
-            StreamlineBatch& kernel, 
+            const Streamline& streamline, 
+            int streamlineId, 
+            uint16_t threadNo, 
+            std::function<void(Tractogram2ImageMapper<T>* tim, int* _gridPos, NIBR::Segment& _seg)> f
+        );
+
+        bool traceStreamline(
+            const Streamline& streamline, 
             int streamlineId, 
             uint16_t threadNo, 
             std::function<void(Tractogram2ImageMapper<T>* tim, int* _gridPos, NIBR::Segment& _seg)> f
@@ -80,6 +95,12 @@ namespace NIBR
         bool                    mapOnce;
         std::tuple<float,int>   smoothing;
 
+        // Per-thread buffers reused for anisotropic smoothing
+        std::vector<std::vector<float>> smoothingFrames;
+        std::vector<std::vector<float>> smoothingScale_N;
+        std::vector<std::vector<float>> smoothingScale_B;
+        std::vector<Streamline>         smoothingBuffer;
+
         std::vector<float>      weights;
         FILE**                  weightFile;
         WEIGHTTYPE              weightType;
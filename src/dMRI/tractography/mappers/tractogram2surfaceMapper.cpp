@@ -1,173 +1,198 @@
 #include "dMRI/tractography/mappers/tractogram2surfaceMapper.h"
 #include "math/gaussian.h"
 #include "surface/surface_operators.h"
+#include "base/vectorOperations.h"
 
 using namespace NIBR;
 
-// mapping contains streamline2faceMaps for each face of the input surface
-// if mapOnce is true, then a face will not have two instances from the same streamline
-void NIBR::tractogram2surfaceMapper(NIBR::TractogramReader* tractogram, NIBR::Surface* surf, std::vector<std::vector<NIBR::streamline2faceMap>>& mapping, bool mapOnce)
+// Appends all crossings of a streamline with the faces listed in surfaceGrid
+void NIBR::streamline2surfaceCrossings(const Streamline& streamline, int streamlineId, NIBR::Surface* surf, NIBR::Image<int>* img, const NIBR::BitMask& mask, std::vector<std::vector<std::vector<std::vector<int>>>>* surfaceGrid, std::vector<streamline2faceCrossing>& crossings)
 {
 
-    surf->calcCentersOfFaces();
+    int len = streamline.size();
 
-    std::vector<std::vector<std::vector<std::vector<int>>>> surfaceGrid;
+    // If streamline does not have a segment, then exit
+    if (len<2) return;
 
-    // Index surface and create mask
-    NIBR::Image<int> img;
-    bool*** mask = indexSurfaceBoundary(surf,&img,&surfaceGrid,false);
+    double p0[3], p1[3], dir[3], t, length;
+    float  beg[3], end[3];
+    double arcLength = 0;
 
-    // Map tractogram on surface
-    std::vector<std::vector<std::vector<streamline2faceMap>>> map2surf(NIBR::MT::MAXNUMBEROFTHREADS());
-    for (int t = 0; t < NIBR::MT::MAXNUMBEROFTHREADS(); t++) {
-        map2surf[t].resize(surf->nf);
-    }
+    int32_t A[3], B[3];
 
-    tractogram->reset();
+    NIBR::LineSegment seg;
+    seg.id  = streamlineId;
+    seg.beg = &beg[0];
+    seg.end = &end[0];
 
-    auto doMapping = [&](const NIBR::MT::TASK& task)->void {        
+    auto addToMap=[&]()->void{
+        for (auto f : (*surfaceGrid)[A[0]][A[1]][A[2]]) {
 
-        auto [success,streamline,streamlineId] = tractogram->getNextStreamline();
+            double pointOfIntersection[3];
+            double distanceToIntersection;
+            float angle = findSegmentTriangleIntersection(surf, f, seg.beg, seg.end, &pointOfIntersection[0], &distanceToIntersection);
+            
+            if (angle>0) {
+                streamline2faceCrossing tmp;
+                tmp.face       = f;
+                tmp.arcLength  = arcLength + distanceToIntersection;
+                tmp.map.index  = seg.id;
+                tmp.map.dir[0] = seg.dir[0];
+                tmp.map.dir[1] = seg.dir[1];
+                tmp.map.dir[2] = seg.dir[2];
+                tmp.map.p[0]   = pointOfIntersection[0];
+                tmp.map.p[1]   = pointOfIntersection[1];
+                tmp.map.p[2]   = pointOfIntersection[2];
+                tmp.map.angle  = angle;
+                crossings.push_back(tmp);
+            }
 
-        int len = streamline.size();
+        }
+    };
 
-        // If streamline does not have a segment, then exit
-        if (len<2) return;
-    
-        double p0[3], p1[3], dir[3], t, length;
+    // Beginning of segment in real and image space
+    img->to_ijk(streamline[0].data(),p0);
+    A[0]  = std::round(p0[0]);
+    A[1]  = std::round(p0[1]);
+    A[2]  = std::round(p0[2]);
+
+    // If streamline has many points and segments
+    for (int i=0; i<len-1; i++) {
+
+        // End of segment in real and image space
+        img->to_ijk(streamline[i+1].data(),p1);
+        for (int m=0;m<3;m++) {
+            beg[m]     = streamline[i][m];
+            end[m]     = streamline[i+1][m];
+            seg.dir[m] = streamline[i+1][m] - streamline[i][m];
+            B[m]       = std::round(p1[m]);
+        }
         
-        int32_t A[3], B[3];
+        // Find segment length and direction in real space
+        seg.len = norm(seg.dir);
+        vec3scale(seg.dir,1.0/seg.len);
         
-        NIBR::LineSegment seg;
-        seg.id = streamlineId;
-
-        auto addToMap=[&]()->void{
-            for (auto f : surfaceGrid[A[0]][A[1]][A[2]]) {
-
-                double pointOfIntersection[3];
-                double distanceToIntersection;
-                float angle = findSegmentTriangleIntersection(surf, f, seg.beg, seg.end, &pointOfIntersection[0], &distanceToIntersection);
-                
-                if (angle>0) {
-                    streamline2faceMap tmp;
-                    tmp.index  = seg.id;
-                    tmp.dir[0] = seg.dir[0];
-                    tmp.dir[1] = seg.dir[1];
-                    tmp.dir[2] = seg.dir[2];
-                    tmp.p[0]   = pointOfIntersection[0];
-                    tmp.p[1]   = pointOfIntersection[1];
-                    tmp.p[2]   = pointOfIntersection[2];
-                    tmp.angle  = angle;
-                    map2surf[task.threadId][f].push_back(tmp);
-                }
+        // Add the first voxel in the map if it is within the mask
+        if ( img->isInside(A) && mask(A) ) {
+            addToMap();
+        }
 
+        // Segment does not leave the voxel, add this segment and continue with the next one
+        if ( (A[0]==B[0]) && (A[1]==B[1]) && (A[2]==B[2]) ) {
+            for (int m=0;m<3;m++) {
+                p0[m] = p1[m];
             }
-        };
+            arcLength += seg.len;
+            continue;
+        }
+        
+        // Find length and direction of segment in grid space
+        vec3sub(dir,p1,p0);
+        length = norm(dir);
+        vec3scale(dir,1.0/length);
 
-        // Beginning of segment in real and image space
-        img.to_ijk(streamline[0].data(),p0);
-        A[0]  = std::round(p0[0]);
-        A[1]  = std::round(p0[1]);
-        A[2]  = std::round(p0[2]);
+        while (length>0.0) {
 
-        // If streamline has many points and segments
-        for (int i=0; i<len-1; i++) {
+            if (rayTraceVoxel(A,p0,dir,t)) {
+                t += EPS4;
+            } else {
+                t  = EPS4; // otherwise t is NAN
+            }
 
-            // End of segment in real and image space
-            img.to_ijk(streamline[i+1].data(),p1);
-            seg.beg = streamline[i].data();
-            seg.end = streamline[i+1].data();
             for (int m=0;m<3;m++) {
-                seg.dir[m] = streamline[i+1][m] - streamline[i][m];
-                B[m]       = std::round(p1[m]);
+                p0[m] += t*dir[m];
+                A[m]   = std::round(p0[m]);
             }
-            
-            // Find segment length and direction in real space
-            seg.len = norm(seg.dir);
-            vec3scale(seg.dir,1.0/seg.len);
-            
-            // Add the first voxel in the map if it is within the mask
-            if ( img.isInside(A) && mask[A[0]][A[1]][A[2]] ) {
+
+            if ( img->isInside(A) && mask(A) ) {
                 addToMap();
             }
 
-            // Segment does not leave the voxel, add this segment and continue with the next one
-            if ( (A[0]==B[0]) && (A[1]==B[1]) && (A[2]==B[2]) ) {
-                for (int m=0;m<3;m++) {
-                    p0[m] = p1[m];
-                }
-                continue;
-            }
-            
-            // Find length and direction of segment in grid space
-            vec3sub(dir,p1,p0);
-            length = norm(dir);
-            vec3scale(dir,1.0/length);
+            length -= t;
 
-            while (length>0.0) {
+        }
 
-                if (rayTraceVoxel(A,p0,dir,t)) {
-                    t += EPS4;
-                } else {
-                    t  = EPS4; // otherwise t is NAN
-                }
+        for (int m=0;m<3;m++) {
+            p0[m] = p1[m];
+            A[m]  = B[m];
+        }
 
-                for (int m=0;m<3;m++) {
-                    p0[m] += t*dir[m];
-                    A[m]   = std::round(p0[m]);
-                }
+        arcLength += seg.len;
 
-                if ( img.isInside(A) && mask[A[0]][A[1]][A[2]] ) {
-                    addToMap();
-                }
+    }
 
-                length -= t;
+}
 
-            }
+// mapping contains the streamline2faceMaps of each face of the input surface in CSR form
+// if mapOnce is true, then a face will not have two instances from the same streamline, and the crossings of each face are sorted by streamline index
+void NIBR::tractogram2surfaceMapper(NIBR::TractogramReader* tractogram, NIBR::Surface* surf, NIBR::face2streamlineMap& mapping, bool mapOnce)
+{
 
-            for (int m=0;m<3;m++) {
-                p0[m] = p1[m];
-                A[m]  = B[m];
-            }
-            
+    surf->calcCentersOfFaces();
+
+    std::vector<std::vector<std::vector<std::vector<int>>>> surfaceGrid;
+
+    // Index surface and create mask
+    NIBR::Image<int> img;
+    NIBR::BitMask mask = indexSurfaceBoundary(surf,&img,&surfaceGrid,false);
+
+    // Each thread appends its crossings to a single contiguous buffer
+    std::vector<std::vector<streamline2faceCrossing>> threadCrossings(NIBR::MT::MAXNUMBEROFTHREADS());
+
+    tractogram->reset();
+
+    auto doMapping = [&](const NIBR::MT::TASK& task)->void {        
+
+        auto [success,streamline,streamlineId] = tractogram->getNextStreamline();
 
+        auto&       buffer = threadCrossings[task.threadId];
+        std::size_t beg    = buffer.size();
+
+        streamline2surfaceCrossings(streamline, streamlineId, surf, &img, mask, &surfaceGrid, buffer);
+
+        // Crossings of a streamline are contiguous in the buffer, so duplicates are removed right here
+        if (mapOnce && ((buffer.size()-beg) > 1)) {
+            std::stable_sort(buffer.begin()+beg, buffer.end(), [](const streamline2faceCrossing& c1, const streamline2faceCrossing& c2){return c1.face < c2.face;});
+            auto it = std::unique(buffer.begin()+beg, buffer.end(), [](const streamline2faceCrossing& c1, const streamline2faceCrossing& c2){return c1.face == c2.face;});
+            buffer.erase(it, buffer.end());
         }
 
     };
     NIBR::MT::MTRUN(tractogram->numberOfStreamlines, NIBR::MT::MAXNUMBEROFTHREADS(), "Tractogram to surface mapping", doMapping);
 
-    // Clean up 
-    for (int i = 0; i < img.imgDims[0]; i++) {
-        for (int j = 0; j < img.imgDims[1]; j++) {
-            delete[] mask[i][j];
-        }
-        delete[] mask[i];
-    }
-    delete[] mask;
+    // Group crossings by face
+    std::vector<streamline2faceCrossing> crossings;
+    parallelGroupByKey(threadCrossings, surf->nf, [](const streamline2faceCrossing& c){return std::size_t(c.face);}, mapping.offsets, crossings);
+
+    mapping.crossings.resize(crossings.size());
 
     auto finMapping = [&](const NIBR::MT::TASK& task)->void {  
 
         int f = task.no; 
 
-        for (int t = 1; t < NIBR::MT::MAXNUMBEROFTHREADS(); t++) {
-            if (!map2surf[t][f].empty()) {
-                map2surf[0][f].insert(map2surf[0][f].end(), map2surf[t][f].begin(), map2surf[t][f].end());
-                map2surf[t][f].clear();
-            }
+        for (std::size_t n = mapping.offsets[f]; n < mapping.offsets[f+1]; n++) {
+            mapping.crossings[n] = crossings[n].map;
         }
-        
+
         if (mapOnce) {
-            if (!map2surf[0][f].empty()) {
-                std::sort(map2surf[0][f].begin(), map2surf[0][f].end(),[](streamline2faceMap s1,streamline2faceMap s2){return (s1.index  < s2.index) ? 1 : 0;});
-                auto it = std::unique (map2surf[0][f].begin(), map2surf[0][f].end(),[](streamline2faceMap s1,streamline2faceMap s2){return (s1.index == s2.index) ? 1 : 0;});
-                map2surf[0][f].erase(it, map2surf[0][f].end());
-            }
+            std::sort(mapping.crossings.begin()+mapping.offsets[f], mapping.crossings.begin()+mapping.offsets[f+1],[](const streamline2faceMap& s1, const streamline2faceMap& s2){return s1.index < s2.index;});
         }
 
-
     };
     NIBR::MT::MTRUN(surf->nf, NIBR::MT::MAXNUMBEROFTHREADS(), finMapping);
 
-    mapping = map2surf[0];
+}
+
+void NIBR::tractogram2surfaceMapper(NIBR::TractogramReader* tractogram, NIBR::Surface* surf, std::vector<std::vector<NIBR::streamline2faceMap>>& mapping, bool mapOnce)
+{
+    face2streamlineMap csr;
+    tractogram2surfaceMapper(tractogram, surf, csr, mapOnce);
 
+    mapping.clear();
+    mapping.resize(surf->nf);
+
+    auto toVector = [&](const NIBR::MT::TASK& task)->void {
+        mapping[task.no].assign(csr.begin(task.no), csr.end(task.no));
+    };
+    NIBR::MT::MTRUN(surf->nf, NIBR::MT::MAXNUMBEROFTHREADS(), toVector);
 }
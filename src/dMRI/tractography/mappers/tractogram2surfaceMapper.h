@@ -16,6 +16,26 @@ namespace NIBR
         float angle;
     };
 
+    struct streamline2faceCrossing {
+        int                face;
+        float              arcLength;   // Distance along the streamline from its first point to the crossing
+        streamline2faceMap map;
+    };
+
+    // Traces a single streamline on the surface grid prepared by indexSurfaceBoundary and appends all face crossings to crossings
+    void streamline2surfaceCrossings(const Streamline& streamline, int streamlineId, NIBR::Surface* surf, NIBR::Image<int>* img, const NIBR::BitMask& mask, std::vector<std::vector<std::vector<std::vector<int>>>>* surfaceGrid, std::vector<streamline2faceCrossing>& crossings);
+
+    // Crossings of all faces in CSR form. Crossings of face f are crossings[offsets[f]] ... crossings[offsets[f+1]-1]
+    struct face2streamlineMap {
+        std::vector<std::size_t>        offsets;
+        std::vector<streamline2faceMap> crossings;
+
+        std::size_t                 size (int f) const {return offsets[f+1] - offsets[f];}
+        const streamline2faceMap*   begin(int f) const {return crossings.data() + offsets[f];}
+        const streamline2faceMap*   end  (int f) const {return crossings.data() + offsets[f+1];}
+    };
+
+    void tractogram2surfaceMapper(NIBR::TractogramReader* tractogram, NIBR::Surface* surf, face2streamlineMap& mapping, bool mapOnce);
     void tractogram2surfaceMapper(NIBR::TractogramReader* tractogram, NIBR::Surface* surf, std::vector<std::vector<streamline2faceMap>>& mapping, bool mapOnce);
 
 }
@@ -11,7 +11,7 @@ namespace NIBR
     bool index2image(
         TractogramReader& tractogram, 
         Image<T>& img, 
-        bool***& masker,
+        BitMask& masker,
         std::vector<int64_t>& inds,
         std::function<void(Tractogram2ImageMapper<T>* tim, int* _gridPos, NIBR::Segment& _seg)> processor, 
         std::function<void(Tractogram2ImageMapper<T>* tim)> indexer, 
@@ -49,7 +49,7 @@ namespace NIBR
 
             Tractogram2ImageMapper<T> gridder(&tractogram,&img);
             gridder.optimizeForSmallMask(false);
-            gridder.setMask(masker);
+            gridder.setMask(&masker);
             gridder.setData((void*)(&gridData));
             allocater(&gridder);
             gridder.run(processor,indexer,range.first,range.second);
@@ -107,27 +107,11 @@ namespace NIBR
 
         file_vId.close();
 
-        bool*** masker = new bool**[mask.imgDims[0]];
-        for (int i = 0; i < mask.imgDims[0]; i++) {
-            masker[i] = new bool*[mask.imgDims[1]];
-            for (int j = 0; j < mask.imgDims[1]; j++) {
-                masker[i][j] = new bool[mask.imgDims[2]];
-                for (int k = 0; k < mask.imgDims[2]; k++)
-                    masker[i][j][k] = ((mask)(i,j,k)>0) ? true : false;
-            }
-        }
-
+        BitMask masker;
+        masker.fromImage(mask, [](int val)->bool {return val>0;});
 
         bool success = index2image(tractogram,img,masker,inds,processor,indexer,allocater,deallocater,data,filePrefix,splitCount);
         
-        for (int i = 0; i < mask.imgDims[0]; i++) {
-            for (int j = 0; j < mask.imgDims[1]; j++) {
-                delete[] masker[i][j];
-            }
-            delete[] masker[i];
-        }
-        delete[] masker;
-        
         return success;
     }
 
@@ -162,7 +146,7 @@ namespace NIBR
     bool index2image(
         TractogramReader& tractogram, 
         Image<T>& img, 
-        bool***& mask,
+        BitMask& mask,
         std::vector<int64_t>& inds,
         std::function<void(Tractogram2ImageMapper<T>* tim, int* _gridPos, NIBR::Segment& _seg)> processor, 
         std::function<void(Tractogram2ImageMapper<T>* tim)> indexer,
@@ -184,7 +168,7 @@ namespace NIBR
 
         Tractogram2ImageMapper<T> gridder(&tractogram,&img);
         gridder.optimizeForSmallMask(true);
-        gridder.setMask(mask);
+        gridder.setMask(&mask);
         gridder.setData((void*)(&gridData));
         allocater(&gridder);
 
@@ -199,7 +183,7 @@ namespace NIBR
     bool index2image(
         TractogramReader& tractogram, 
         Image<T>& img, 
-        bool***& mask,
+        BitMask& mask,
         std::vector<int64_t>& inds,
         std::function<void(Tractogram2ImageMapper<T>* tim, int* _gridPos, NIBR::Segment& _seg)> processor, 
         std::function<void(Tractogram2ImageMapper<T>* tim)> indexer,
@@ -225,7 +209,7 @@ namespace NIBR
 
         Tractogram2ImageMapper<T> gridder(&tractogram,&img);
         gridder.optimizeForSmallMask(true);
-        gridder.setMask(mask);
+        gridder.setMask(&mask);
         gridder.setData((void*)(&gridData));
         allocater(&gridder);
 
@@ -19,14 +19,14 @@ void NIBR::index2surface(TractogramReader& tractogram, Surface& surf, float sigm
     surf.readMesh();
 
     disp(MSG_DETAIL,"Computing neigboring vertices");
-    surf.getNeighboringVertices();
+    surf.getNeighboringVerticesCSR();
     
     disp(MSG_DETAIL,"Starting tractogram to surface mapping");
-    std::vector<std::vector<streamline2faceMap>> surfMap; // surfMap[n] stores the list of streamlines in n^th face of the mesh. surfMap[n][s].index is the streamlineId of the s^th streamline crossing this face
+    face2streamlineMap surfMap; // surfMap.begin(n) ... surfMap.end(n) is the list of streamlines in n^th face of the mesh. index is the streamlineId of the streamline crossing this face
     tractogram2surfaceMapper(&tractogram, &surf, surfMap, true);
     
     disp(MSG_DETAIL,"Setting surface indexing parameters");
-    std::vector<std::vector<std::pair<int,streamline2faceMap*>>> s2f; // s2f stores the list of face indices that each streamline crosses
+    std::vector<std::vector<std::pair<int,const streamline2faceMap*>>> s2f; // s2f stores the list of face indices that each streamline crosses
     s2f.resize(tractogram.numberOfStreamlines);
 
     // Set variance and maxVertexMappingDistance
@@ -41,12 +41,16 @@ void NIBR::index2surface(TractogramReader& tractogram, Surface& surf, float sigm
     float variance                 = sigma*sigma;
 
     for (int n = 0; n < surf.nf; n++) {
-        for (auto& s : surfMap[n]) {
-            auto tmp = std::make_pair(n,&s);
-            s2f[s.index].push_back(tmp);
+        for (auto s = surfMap.begin(n); s != surfMap.end(n); s++) {
+            s2f[s->index].emplace_back(n,s);
         }
     }
 
+    // Per thread buffers for vertex neighborhood search
+    std::vector<VertexNeighborhoodBuffer>               nbBuffer(NIBR::MT::MAXNUMBEROFTHREADS());
+    std::vector<std::vector<std::pair<int,float>>>      distMaps(NIBR::MT::MAXNUMBEROFTHREADS());
+    std::vector<std::vector<float>>                     gDists(NIBR::MT::MAXNUMBEROFTHREADS());
+
     int starting  = 0;
     int remaining = tractogram.numberOfStreamlines;
     int batchSize = (remaining < 500000) ? remaining : 500000;
@@ -60,6 +64,9 @@ void NIBR::index2surface(TractogramReader& tractogram, Surface& surf, float sigm
 
         auto run = [&](const NIBR::MT::TASK& task)->void{
 
+            auto& distMap = distMaps[task.threadId];
+            auto& gDist   = gDists[task.threadId];
+
             // Loop all the faces this streamline crosses
             for (auto s : s2f[starting+task.no]) {
 
@@ -67,8 +74,8 @@ void NIBR::index2surface(TractogramReader& tractogram, Surface& surf, float sigm
                 float scaler = 0;
                     
                 // distMap has the vertexId and the distance to the given point (s.second) that is on a given face (s.first)
-                std::unordered_map<int,float> distMap = getVertexNeigborhoodOfAPoint(&surf, &s.second->p[0], s.first, maxVertexMappingDistance); // get the vertex distances for the current point and face    
-                std::vector<float> gDist;
+                getVertexNeigborhoodOfAPoint(&surf, &s.second->p[0], s.first, maxVertexMappingDistance, nbBuffer[task.threadId], distMap); // get the vertex distances for the current point and face    
+                gDist.clear();
 
                 for (auto& m : distMap) {
                     float tmp = gaussian2D_var(m.second,variance);
@@ -133,8 +140,7 @@ void NIBR::index2surface(TractogramReader& tractogram, Surface& surf, float sigm
     positions[tractogram.numberOfStreamlines] = file_map.tellp();
     file_map.close();
 
-    surfMap.clear(); // This is not needed anymore
-    surfMap.shrink_to_fit();        
+    surfMap = face2streamlineMap(); // This is not needed anymore
 
 
     for(const auto &pos : positions) {
@@ -397,22 +403,20 @@ std::vector<std::unordered_map<int,float>> NIBR::index2surface(TractogramReader&
     if (surf.nv == 0) {
         surf.readMesh();
     }
-    surf.getNeighboringVertices();
+    surf.getNeighboringVerticesCSR();
     
     std::vector<std::unordered_map<int,float[3]>> s2f; // s2f stores the list of face indices and crossing point for each streamline
     s2f.resize(tractogram.numberOfStreamlines);
     {
-        std::vector<std::vector<streamline2faceMap>> surfMap; // surfMap[n] stores the list of streamlines in n^th face of the mesh. surfMapp[n][s].index is the streamlineId of the s^th streamline crossing this face
+        face2streamlineMap surfMap; // surfMap.begin(n) ... surfMap.end(n) is the list of streamlines in n^th face of the mesh. index is the streamlineId of the streamline crossing this face
         tractogram2surfaceMapper(&tractogram, &surf, surfMap, true);
         for (int n = 0; n < surf.nf; n++) {
-            for (auto m : surfMap[n]) {
-                s2f[m.index][n][0] = m.p[0];
-                s2f[m.index][n][1] = m.p[1];
-                s2f[m.index][n][2] = m.p[2];
+            for (auto m = surfMap.begin(n); m != surfMap.end(n); m++) {
+                s2f[m->index][n][0] = m->p[0];
+                s2f[m->index][n][1] = m->p[1];
+                s2f[m->index][n][2] = m->p[2];
             }
         }
-        surfMap.clear();
-        surfMap.shrink_to_fit();
     }
 
     // Set variance and maxVertexMappingDistance
@@ -426,17 +430,25 @@ std::vector<std::unordered_map<int,float>> NIBR::index2surface(TractogramReader&
     float maxVertexMappingDistance = 3.0f*sigma;  // we will not consider any vertex beyond 3*sigma
     float variance                 = sigma*sigma;
 
+    // Per thread buffers for vertex neighborhood search
+    std::vector<VertexNeighborhoodBuffer>               nbBuffer(NIBR::MT::MAXNUMBEROFTHREADS());
+    std::vector<std::vector<std::pair<int,float>>>      distMaps(NIBR::MT::MAXNUMBEROFTHREADS());
+    std::vector<std::vector<float>>                     gDists(NIBR::MT::MAXNUMBEROFTHREADS());
+
     auto run = [&](const NIBR::MT::TASK& task)->void{
 
+        auto& distMap = distMaps[task.threadId];
+        auto& gDist   = gDists[task.threadId];
+
         // Loop all the faces this streamline crosses
-        for (auto s : s2f[task.no]) {
+        for (auto& s : s2f[task.no]) {
 
             // For each hit, the total connectivity of the streamline on the whole mesh will be scaled to 1
             float scaler = 0;
                 
             // distMap has the vertexId and the distance to the given point (s.second) that is on a given face (s.first)
-            std::unordered_map<int,float> distMap = getVertexNeigborhoodOfAPoint(&surf, &s.second[0], s.first, maxVertexMappingDistance); // get the vertex distances for the current point and face    
-            std::vector<float> gDist;
+            getVertexNeigborhoodOfAPoint(&surf, &s.second[0], s.first, maxVertexMappingDistance, nbBuffer[task.threadId], distMap); // get the vertex distances for the current point and face    
+            gDist.clear();
 
             for (auto& m : distMap) {
                 float tmp = gaussian2D_var(m.second,variance);
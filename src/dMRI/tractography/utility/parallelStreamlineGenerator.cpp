@@ -2,25 +2,31 @@
 
 using namespace NIBR;
 
-void NIBR::generateParallelStreamlineBatch(
+void NIBR::computeParallelTransportFrames(
     const Streamline& streamline, 
-    StreamlineBatch& outBatch, 
-    const std::vector<float>& scale_N, 
-    const std::vector<float>& scale_B,
+    std::vector<float>& frames, 
     int threadId) 
 {
     int len = streamline.size();
-    int par = scale_N.size();
 
     if (len < 2) {
-        outBatch.clear();
+        frames.clear();
         return;
     }
 
-    outBatch.resize(par);
-    for (int p = 0; p < par; p++) {
-        outBatch[p].resize(len);
-    }
+    frames.resize(6*len);
+
+    float* Nx = frames.data();
+    float* Ny = Nx + len;
+    float* Nz = Ny + len;
+    float* Bx = Nz + len;
+    float* By = Bx + len;
+    float* Bz = By + len;
+
+    auto setFrame = [&](int l, const float* N, const float* B)->void {
+        Nx[l] = N[0]; Ny[l] = N[1]; Nz[l] = N[2];
+        Bx[l] = B[0]; By[l] = B[1]; Bz[l] = B[2];
+    };
 
     float T[3], N[3], B[3], curr_T[3];
     const int window = 6; 
@@ -52,9 +58,7 @@ void NIBR::generateParallelStreamlineBatch(
     normalize(N);
     cross(B, T, N);
 
-    for (int p = 0; p < par; p++)
-        for (int i = 0; i < 3; i++)
-            outBatch[p][0][i] = streamline[0][i] + N[i] * scale_N[p] + B[i] * scale_B[p];
+    setFrame(0, N, B);
 
     for (auto l = 1; l < (len - 1); l++) {
 
@@ -128,19 +132,69 @@ void NIBR::generateParallelStreamlineBatch(
 
         cross(B, T, N);
 
-        for (int p = 0; p < par; p++) {
-            for (int i = 0; i < 3; i++) {
-                outBatch[p][l][i] = streamline[l][i] + N[i] * scale_N[p] + B[i] * scale_B[p];
-            }
-        }
+        setFrame(l, N, B);
     }
 
-    for (int p = 0; p < par; p++)
-        for (int i = 0; i < 3; i++)
-            outBatch[p][len - 1][i] = streamline[len - 1][i] + N[i] * scale_N[p] + B[i] * scale_B[p];        
+    setFrame(len - 1, N, B);
 }
 
 
+void NIBR::makeParallelStreamline(
+    const Streamline& streamline, 
+    const std::vector<float>& frames, 
+    float scale_N, 
+    float scale_B, 
+    Streamline& out) 
+{
+    int len = streamline.size();
+
+    out.resize(len);
+
+    if (len < 2) {
+        if (len == 1) out[0] = streamline[0];
+        return;
+    }
+
+    const float* Nx = frames.data();
+    const float* Ny = Nx + len;
+    const float* Nz = Ny + len;
+    const float* Bx = Nz + len;
+    const float* By = Bx + len;
+    const float* Bz = By + len;
+
+    for (int l = 0; l < len; l++) {
+        out[l][0] = streamline[l][0] + Nx[l] * scale_N + Bx[l] * scale_B;
+        out[l][1] = streamline[l][1] + Ny[l] * scale_N + By[l] * scale_B;
+        out[l][2] = streamline[l][2] + Nz[l] * scale_N + Bz[l] * scale_B;
+    }
+}
+
+
+void NIBR::generateParallelStreamlineBatch(
+    const Streamline& streamline, 
+    StreamlineBatch& outBatch, 
+    const std::vector<float>& scale_N, 
+    const std::vector<float>& scale_B,
+    int threadId) 
+{
+    int par = scale_N.size();
+
+    if (streamline.size() < 2) {
+        outBatch.clear();
+        return;
+    }
+
+    std::vector<float> frames;
+    computeParallelTransportFrames(streamline, frames, threadId);
+
+    outBatch.resize(par);
+    for (int p = 0; p < par; p++) {
+        makeParallelStreamline(streamline, frames, scale_N[p], scale_B[p], outBatch[p]);
+    }
+}
+
+
+
 void NIBR::getParallelStreamlines(Tractogram& out, NIBR::TractogramReader* tractogram, float radius, int ringCount, int pointCountPerRing)
 {
     int numStreamlines = tractogram->numberOfStreamlines;
@@ -24,5 +24,12 @@ namespace NIBR
     // Low level function used to generate a batch of parallel streamlines around a given streamline
     void generateParallelStreamlineBatch(const Streamline& streamline, StreamlineBatch& outBatch, const std::vector<float>& scale_N, const std::vector<float>& scale_B,int threadId);
 
+    // Computes the parallel transport frame along a streamline, which is what generateParallelStreamlineBatch uses.
+    // frames is filled in SoA layout: [Nx, Ny, Nz, Bx, By, Bz], each streamline.size() long, and can be reused between calls.
+    void computeParallelTransportFrames(const Streamline& streamline, std::vector<float>& frames, int threadId);
+
+    // Writes a single parallel streamline into out using precomputed frames. out is resized, so its capacity is reused.
+    void makeParallelStreamline(const Streamline& streamline, const std::vector<float>& frames, float scale_N, float scale_B, Streamline& out);
+
     
 }
@@ -2,6 +2,7 @@
 
 #include "base/nibr.h"
 #include "image/image.h"
+#include "image/image_bitmask.h"
 #include "dMRI/tractography/io/tractogramReader.h"
 #include <vector>
 
@@ -26,7 +27,7 @@ namespace NIBR
         const Streamline& streamline,
         std::size_t streamlineId,
         Image<T>& img,
-        bool*** mask, 
+        const BitMask* mask, 
         const std::function<void(std::unordered_map<int64_t,float>*,Image<T>*,int*,NIBR::Segment&,void*)>& f, void* fData)
 
     {
@@ -52,7 +53,7 @@ namespace NIBR
         A[2]  = std::round(p0[2]);
 
         auto runFun = [&]() {
-            if ( img.isInside(A) && ((mask==NULL) || mask[A[0]][A[1]][A[2]]) ) {
+            if ( img.isInside(A) && ((mask==NULL) || (*mask)(A)) ) {
                 f(&vIdx,&img,&A[0],seg,fData);
             }
         };
@@ -174,7 +175,7 @@ namespace NIBR
         TractogramReader* tractogram,
         std::size_t streamlineId,
         Image<T>& img,
-        bool*** mask, 
+        const BitMask* mask, 
         const std::function<void(std::unordered_map<int64_t,float>*,Image<T>*,int*,NIBR::Segment&,void*)>& f, void* fData)
 
     {
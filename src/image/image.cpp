@@ -1,8 +1,46 @@
 #include "image.h"
 #include <vector>
+#include <map>
+#include <mutex>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 using namespace NIBR;
 
+namespace {
+    std::mutex                                          mappedImageFileLock;
+    std::map<std::pair<uint64_t,uint64_t>,int>          mappedImageFiles;
+}
+
+void NIBR::addMappedImageFile(uint64_t dev, uint64_t ino)
+{
+    std::lock_guard<std::mutex> lock(mappedImageFileLock);
+    mappedImageFiles[std::make_pair(dev,ino)]++;
+}
+
+void NIBR::removeMappedImageFile(uint64_t dev, uint64_t ino)
+{
+    std::lock_guard<std::mutex> lock(mappedImageFileLock);
+    auto it = mappedImageFiles.find(std::make_pair(dev,ino));
+    if (it == mappedImageFiles.end()) return;
+    if (--(it->second) == 0) mappedImageFiles.erase(it);
+}
+
+bool NIBR::isMappedImageFile(std::string filePath)
+{
+#ifndef _WIN32
+    struct stat st;
+    if (stat(filePath.c_str(),&st) != 0) return false;
+    std::lock_guard<std::mutex> lock(mappedImageFileLock);
+    return mappedImageFiles.find(std::make_pair(uint64_t(st.st_dev),uint64_t(st.st_ino))) != mappedImageFiles.end();
+#else
+    return false;
+#endif
+}
+
 template<typename T>
 void NIBR::Image<T>::init()
 {
@@ -23,6 +61,10 @@ void NIBR::Image<T>::init()
     timeUnit        = UNKNOWNTIMEUNIT;
     headerIsRead    = false;
     data            = NULL;
+    mappedRegion    = NULL;
+    mappedLength    = 0;
+    mappedFile[0]   = 0;
+    mappedFile[1]   = 0;
     outsideVal      = 0;
     interpMethod    = LINEAR;
     setInterpolationMethod(LINEAR);
@@ -74,11 +116,29 @@ NIBR::Image<T>::Image(int* _indexOrder)
 }
 
 template<typename T>
-void NIBR::Image<T>::clear() {
+void NIBR::Image<T>::deallocData() {
+
+    if (mappedRegion!=NULL) {
+        #ifndef _WIN32
+        munmap(mappedRegion,mappedLength);
+        #endif
+        removeMappedImageFile(mappedFile[0],mappedFile[1]);
+        mappedRegion = NULL;
+        mappedLength = 0;
+        data         = NULL;
+        return;
+    }
+
     if (data!=NULL) {
         delete[] data;
         data = NULL;
-    };
+    }
+
+}
+
+template<typename T>
+void NIBR::Image<T>::clear() {
+    deallocData();
     init();
 }
 
@@ -111,6 +171,9 @@ NIBR::Image<T>::Image(const Image &img) {
     memcpy(indexOrder,img.indexOrder,7*sizeof(int));
     inputDataType       = img.inputDataType;
     setInterpolationMethod(interpMethod);
+    data                = NULL;
+    mappedRegion        = NULL;
+    mappedLength        = 0;
     allocData();
     memcpy(data,img.data,numel*sizeof(T));
 }
@@ -28,10 +28,19 @@
 // e.g. Image<double> img; double a[3]={0.1,0.2,0.3}; double A=img(a); performs the interpolation in double precision.
 // Note that in order to use this functionality, the input point must have the same data type as the output.
 // e.g. Image<double> img; float a[3]={0.1,0.2,0.3}; double A=img(a); performs the interpolation in float precision and return a double.
+//
+// 3. Uncompressed nifti files are memory mapped when the data on disk can be used as is, i.e.,
+// the data type matches T, there is no scaling, byte swapping or reindexing. Then read() returns immediately and
+// only the touched pages are loaded. Writing into data is copy-on-write, so the file on disk is never modified.
 
 namespace NIBR
 {
 
+    // Image files, identified by their device and inode numbers, that are currently memory mapped by Image<T>::read()
+    void addMappedImageFile(uint64_t dev, uint64_t ino);
+    void removeMappedImageFile(uint64_t dev, uint64_t ino);
+    bool isMappedImageFile(std::string filePath);
+
     template<typename T>
     class Image {
 
@@ -111,8 +120,9 @@ namespace NIBR
         std::vector<float>        getBoundingBox();
         std::vector<std::string>  getOrientation() {return aff2axcodes(ijk2xyz);};
 
-        void          allocData()   {parseHeader(); data = new T[numel]();   };
-        void          deallocData() {if (data!=NULL) { delete[] data; data = NULL; } };
+        void          allocData()   {deallocData(); parseHeader(); data = new T[numel]();   }; // releases the current data first, mapped or not
+        void          deallocData();
+        bool          isMapped()    {return mappedRegion!=NULL;}
         
         void          setOutsideVal(T _outsideVal) {outsideVal = _outsideVal;}
         T             getOutsideVal() {return outsideVal;}
@@ -200,6 +210,13 @@ namespace NIBR
         bool                read_nii();
         bool                read_mghz();
 
+        // Uncompressed nifti data that does not need conversion is privately memory mapped instead of read,
+        // so pages are loaded only when touched and copied only when written.
+        bool                map_nii(nifti_image* nim, bool reIdx, bool swapByte);
+        void*               mappedRegion;
+        size_t              mappedLength;
+        uint64_t            mappedFile[2];  // device and inode numbers of the mapped file
+
         #if defined(HAS_DCM2NIIX)
         bool                readHeader_dcm();
         bool                read_dcm();
@@ -476,48 +493,96 @@ namespace NIBR
 
     template<typename T>
     void Image<T>::indexData(int* _indexOrder) {
+
+        int64_t oldS2i[7];
         
-        for (int i=0; i<7; i++) 
-            s2i[i] = 1;
+        for (int i=0; i<7; i++) {
+            oldS2i[i] = 1;
+            s2i[i]    = 1;
+        }
         
         for (int i=1; i<7; i++)
-            for (int j=0; j<i; j++)
-                s2i[_indexOrder[i]] *= imgDims[_indexOrder[j]];
+            for (int j=0; j<i; j++) {
+                oldS2i[indexOrder[i]] *= imgDims[indexOrder[j]];
+                s2i[_indexOrder[i]]   *= imgDims[_indexOrder[j]];
+            }
             
         if (data==NULL) {
             for (int i=0; i<7; i++)
                 indexOrder[i] = _indexOrder[i];
             return;
         }
-        
-        int64_t* newIndices = (int64_t*) malloc(numel*sizeof(int64_t));
-        
+
+        // Fastest changing non-singleton dimensions of the new (a) and the current (b) order.
+        // Data is transposed out-of-place in tiles of the a-b plane, so that both reads and writes stay in cache.
+        // The remaining dimensions are only offsets and the tiles are processed in parallel.
+        int a = -1;
+        int b = -1;
+        for (int i=0; i<7; i++) {
+            if ((a<0) && (imgDims[_indexOrder[i]]>1)) a = _indexOrder[i];
+            if ((b<0) && (imgDims[indexOrder[i]] >1)) b = indexOrder[i];
+        }
+
+        if (a<0) {
+            for (int i=0; i<7; i++)
+                indexOrder[i] = _indexOrder[i];
+            return;
+        }
+
+        constexpr int64_t tile = 64;
+
+        std::vector<int> outerDims;
+        int64_t outerCnt = 1;
+        for (int d=0; d<7; d++)
+            if ((d!=a) && (d!=b) && (imgDims[d]>1)) {
+                outerDims.push_back(d);
+                outerCnt *= imgDims[d];
+            }
+
+        int64_t tileCntA = (imgDims[a] + tile - 1) / tile;
+        T*      newData  = new T[numel];
+
         auto run = [&](const NIBR::MT::TASK& task) {
-            int64_t sub[7];
-            ind2sub(task.no,sub);
-            newIndices[task.no] = sub[0]*s2i[0] + sub[1]*s2i[1] + sub[2]*s2i[2] + sub[3]*s2i[3] + sub[4]*s2i[4] + sub[5]*s2i[5] + sub[6]*s2i[6];
+
+            int64_t outerInd = task.no / tileCntA;
+            int64_t aBeg     = (task.no % tileCntA) * tile;
+            int64_t aEnd     = std::min(aBeg + tile, imgDims[a]);
+
+            const T* src = data;
+            T*       dst = newData;
+
+            for (auto d : outerDims) {
+                int64_t sub = outerInd % imgDims[d];
+                outerInd   /= imgDims[d];
+                src        += sub*oldS2i[d];
+                dst        += sub*s2i[d];
+            }
+
+            if (a==b) {
+                std::copy(src + aBeg, src + aEnd, dst + aBeg);
+                return;
+            }
+
+            // Unit stride along b in the input and along a in the output
+            for (int64_t bBeg=0; bBeg<imgDims[b]; bBeg+=tile) {
+                int64_t bEnd = std::min(bBeg + tile, imgDims[b]);
+                for (int64_t ib=bBeg; ib<bEnd; ib++) {
+                    const T* s = src + ib + aBeg*oldS2i[a];
+                    T*       o = dst + ib*s2i[b];
+                    for (int64_t ia=aBeg; ia<aEnd; ia++, s+=oldS2i[a])
+                        o[ia] = *s;
+                }
+            }
+
         };
-        NIBR::MT::MTRUN(numel,NIBR::MT::MAXNUMBEROFTHREADS(),run);
+        NIBR::MT::MTRUN(outerCnt*tileCntA,NIBR::MT::MAXNUMBEROFTHREADS(),run);
         
+        deallocData();
+        data = newData;
+
         for (int i=0; i<7; i++)
             indexOrder[i] = _indexOrder[i];
         
-        for (int64_t i=0; i<numel; i++) {
-            while (newIndices[i] != i) {
-                int64_t tmpIndx  = newIndices[newIndices[i]];
-                T       tmpData  = data[newIndices[i]];
-    
-                data[newIndices[i]]       = data[i];
-                newIndices[newIndices[i]] = newIndices[i];
-    
-                newIndices[i] = tmpIndx;
-                data[i]       = tmpData;
-            }
-        }
-        
-        
-        free(newIndices);
-        
     }
 
     template<typename T>
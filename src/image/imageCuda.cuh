@@ -40,8 +40,7 @@ namespace NIBR
 
             NIBR::CUDAHANDLER::CUDA_PRINT_ERROR(cudaMalloc((void **)&cudaData, sizeof(T)*this->numel));
             NIBR::CUDAHANDLER::CUDA_PRINT_ERROR(cudaMemcpy(cudaData, this->data, sizeof(T)*this->numel,cudaMemcpyHostToDevice));
-            delete[] this->data;
-            this->data = NULL;
+            this->deallocData();
 
             NIBR::CUDAHANDLER::CUDA_PRINT_ERROR(cudaMalloc((void **)&gpuClass,    sizeof(CUDAImage<T>)));
             NIBR::CUDAHANDLER::CUDA_PRINT_ERROR(cudaMemcpy(gpuClass, this, sizeof(CUDAImage<T>), cudaMemcpyHostToDevice));
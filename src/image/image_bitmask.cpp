@@ -0,0 +1,81 @@
+#include "image_bitmask.h"
+
+using namespace NIBR;
+
+void NIBR::BitMask::create(const int64_t* _dims)
+{
+    for (int i=0; i<3; i++) dims[i] = _dims[i];
+    wordsPerRow = packedWordsPerRow(dims);
+    words.assign(wordsPerRow*dims[1]*dims[2],0);
+}
+
+void NIBR::BitMask::clear()
+{
+    for (int i=0; i<3; i++) dims[i] = 0;
+    wordsPerRow = 0;
+    std::vector<uint64_t>().swap(words);
+}
+
+bool NIBR::BitMask::sameSize(const BitMask& other) const
+{
+    return (dims[0]==other.dims[0]) && (dims[1]==other.dims[1]) && (dims[2]==other.dims[2]);
+}
+
+int64_t NIBR::BitMask::count() const
+{
+    int64_t cnt = 0;
+    for (uint64_t w : words) {
+#if defined(__GNUC__) || defined(__clang__)
+        cnt += __builtin_popcountll(w);
+#else
+        w   = w - ((w >> 1) & 0x5555555555555555ULL);
+        w   = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+        w   = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        cnt += (w * 0x0101010101010101ULL) >> 56;
+#endif
+    }
+    return cnt;
+}
+
+NIBR::BitMask& NIBR::BitMask::operator&=(const BitMask& other)
+{
+    if (!sameSize(other)) {disp(MSG_ERROR,"Masks do not have the same dimensions"); return *this;}
+    for (size_t n=0; n<words.size(); n++) words[n] &= other.words[n];
+    return *this;
+}
+
+NIBR::BitMask& NIBR::BitMask::operator|=(const BitMask& other)
+{
+    if (!sameSize(other)) {disp(MSG_ERROR,"Masks do not have the same dimensions"); return *this;}
+    for (size_t n=0; n<words.size(); n++) words[n] |= other.words[n];
+    return *this;
+}
+
+NIBR::BitMask& NIBR::BitMask::operator^=(const BitMask& other)
+{
+    if (!sameSize(other)) {disp(MSG_ERROR,"Masks do not have the same dimensions"); return *this;}
+    for (size_t n=0; n<words.size(); n++) words[n] ^= other.words[n];
+    return *this;
+}
+
+NIBR::BitMask& NIBR::BitMask::subtract(const BitMask& other)
+{
+    if (!sameSize(other)) {disp(MSG_ERROR,"Masks do not have the same dimensions"); return *this;}
+    for (size_t n=0; n<words.size(); n++) words[n] &= ~other.words[n];
+    return *this;
+}
+
+NIBR::BitMask& NIBR::BitMask::invert()
+{
+    if (words.empty()) return *this;
+
+    // Padding bits must stay zero
+    const uint64_t lastMask = (dims[0]%64) ? ((uint64_t(1) << (dims[0]%64)) - 1) : ~uint64_t(0);
+
+    for (size_t n=0; n<words.size(); n++) {
+        words[n] = ~words[n];
+        if ((n % wordsPerRow) == size_t(wordsPerRow-1)) words[n] &= lastMask;
+    }
+
+    return *this;
+}
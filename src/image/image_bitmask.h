@@ -0,0 +1,118 @@
+#pragma once
+
+#include "base/nibr.h"
+#include "image/image.h"
+#include <cstdint>
+#include <vector>
+
+// Bit-packed binary mask of the first three image dimensions.
+//
+// Voxels are packed along x, 64 voxels per word. Each row (j,k) starts at word (j + ny*k)*wordsPerRow, which is the layout
+// used by the packed morphological operators. The padding bits after the last voxel of a row are always zero, so set
+// operations and counting work on whole words.
+//
+// Reading is thread-safe. Voxels can be written by multiple threads only if the threads work on different rows.
+
+namespace NIBR
+{
+
+    inline int64_t packedWordsPerRow(const int64_t* dims) {return (dims[0] + 63)/64;}
+
+    class BitMask {
+
+    public:
+
+        BitMask() {}
+        explicit BitMask(const int64_t* _dims) {create(_dims);}
+
+        void    create(const int64_t* _dims);                   // All voxels are false
+        void    clear();
+
+        bool    empty() const {return words.empty();}
+        bool    sameSize(const BitMask& other) const;
+        int64_t count() const;                                  // Number of true voxels
+
+        bool isInside(int64_t i, int64_t j, int64_t k) const {
+            return (i>=0) && (i<dims[0]) && (j>=0) && (j<dims[1]) && (k>=0) && (k<dims[2]);
+        }
+
+        // Lookups do not check the bounds
+        bool get(int64_t i, int64_t j, int64_t k)        const {return (words[wordIndex(i,j,k)] >> (i&63)) & 1;}
+        bool operator()(int64_t i, int64_t j, int64_t k) const {return get(i,j,k);}
+        bool operator()(const int* ijk)                  const {return get(ijk[0],ijk[1],ijk[2]);}
+
+        void set(int64_t i, int64_t j, int64_t k, bool val) {
+            const uint64_t bit = uint64_t(1) << (i&63);
+            if (val) words[wordIndex(i,j,k)] |=  bit;
+            else     words[wordIndex(i,j,k)] &= ~bit;
+        }
+
+        // Set operations on whole words. Both masks must have the same dimensions.
+        BitMask& operator&=(const BitMask& other);
+        BitMask& operator|=(const BitMask& other);
+        BitMask& operator^=(const BitMask& other);
+        BitMask& subtract(const BitMask& other);                // Removes the voxels of other
+        BitMask& invert();
+
+        // Calls f(i,j,k) for each true voxel in raster order. Empty words are skipped.
+        template<class F>
+        void forEach(F f) const {
+            const int64_t rowCnt = dims[1]*dims[2];
+            for (int64_t r=0; r<rowCnt; r++) {
+                const int64_t j = r % dims[1];
+                const int64_t k = r / dims[1];
+                for (int64_t w=0; w<wordsPerRow; w++) {
+                    uint64_t word = words[r*wordsPerRow + w];
+                    while (word) {
+                        f(w*64 + lowestSetBit(word), j, k);
+                        word &= word - 1;
+                    }
+                }
+            }
+        }
+
+        // Voxel (i,j,k) is true if isTrue(img(i,j,k)) is true. Only the first volume of img is used.
+        template<typename T, class F>
+        void fromImage(NIBR::Image<T>& img, F isTrue) {
+
+            create(img.imgDims);
+
+            NIBR::MT::MTRUN(dims[2], [&](const NIBR::MT::TASK& task)->void {
+                const int64_t k = task.no;
+                for (int64_t j=0; j<dims[1]; j++) {
+                    uint64_t* row = words.data() + (j + dims[1]*k)*wordsPerRow;
+                    for (int64_t i=0; i<dims[0]; i++)
+                        if (isTrue(img.data[img.sub2ind(i,j,k)]))
+                            row[i/64] |= uint64_t(1) << (i%64);
+                }
+            });
+
+        }
+
+        template<typename T>
+        void fromNonZero(NIBR::Image<T>& img) {fromImage(img, [](T val)->bool {return val != 0;});}
+
+        template<typename T>
+        void fromLabel(NIBR::Image<T>& img, T label) {fromImage(img, [label](T val)->bool {return val == label;});}
+
+        int64_t               dims[3]     = {0,0,0};
+        int64_t               wordsPerRow = 0;
+        std::vector<uint64_t> words;
+
+    private:
+
+        int64_t wordIndex(int64_t i, int64_t j, int64_t k) const {return (j + dims[1]*k)*wordsPerRow + (i>>6);}
+
+        static int lowestSetBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+            return __builtin_ctzll(word);
+#else
+            int b = 0;
+            while (!((word >> b) & 1)) b++;
+            return b;
+#endif
+        }
+
+    };
+
+}
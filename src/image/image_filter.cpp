@@ -0,0 +1,284 @@
+#include "image_filter.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace NIBR;
+
+#define FILTER_ROW_BLOCK_SIZE   16      // number of rows filtered by a single task
+#define FILTER_SLICE_BLOCK_SIZE 4096    // number of slice values filtered by a single task
+
+bool NIBR::SeparableWeights::isIdentity() const
+{
+    if ((width != 1) || (inpLen != outLen))
+        return false;
+
+    for (int64_t o=0; o<outLen; o++)
+        if ((ind[o] != o) || (w[o] != 1.0f))
+            return false;
+
+    return true;
+}
+
+namespace {
+
+    NIBR::SeparableWeights allocWeights(int64_t inpLen, int64_t outLen, int width)
+    {
+        NIBR::SeparableWeights out;
+        out.inpLen = inpLen;
+        out.outLen = outLen;
+        out.width  = width;
+        out.ind.assign(outLen*width,0);
+        out.w.assign(outLen*width,0.0f);
+        out.coverage.assign(outLen,1.0f);
+        return out;
+    }
+
+    // Symmetric kernel of length 2*radius+1 with replicated edges
+    NIBR::SeparableWeights symmetricWeights(int64_t len, const std::vector<float>& kernel)
+    {
+        const int     width  = kernel.size();
+        const int64_t radius = width/2;
+
+        NIBR::SeparableWeights out = allocWeights(len,len,width);
+
+        for (int64_t o=0; o<len; o++)
+            for (int m=0; m<width; m++) {
+                out.ind[o*width+m] = std::clamp(o + m - radius, int64_t(0), len-1);
+                out.w[o*width+m]   = kernel[m];
+            }
+
+        return out;
+    }
+
+}
+
+NIBR::SeparableWeights NIBR::identityWeights(int64_t len)
+{
+    SeparableWeights out = allocWeights(len,len,1);
+    for (int64_t o=0; o<len; o++) {
+        out.ind[o] = o;
+        out.w[o]   = 1.0f;
+    }
+    return out;
+}
+
+NIBR::SeparableWeights NIBR::gaussianWeights(int64_t len, float sigma)
+{
+
+    if (sigma <= 0)
+        return identityWeights(len);
+
+    const int64_t radius = std::ceil(3*sigma);
+
+    std::vector<float> kernel(2*radius+1);
+    double sum = 0;
+    for (int64_t m=-radius; m<=radius; m++) {
+        kernel[m+radius] = std::exp(-0.5*double(m*m)/(double(sigma)*sigma));
+        sum             += kernel[m+radius];
+    }
+    for (auto& k : kernel) k /= sum;
+
+    return symmetricWeights(len,kernel);
+
+}
+
+NIBR::SeparableWeights NIBR::boxWeights(int64_t len, int64_t width)
+{
+
+    if (width <= 1)
+        return identityWeights(len);
+
+    const int64_t radius = width/2;
+
+    return symmetricWeights(len,std::vector<float>(2*radius+1,1.0f/float(2*radius+1)));
+
+}
+
+NIBR::SeparableWeights NIBR::downsampleWeights(int64_t inpLen, int64_t factor)
+{
+
+    if (factor <= 1)
+        return identityWeights(inpLen);
+
+    const int64_t outLen = (inpLen + factor - 1)/factor;
+
+    SeparableWeights out = allocWeights(inpLen,outLen,factor);
+    out.scale  = factor;
+    out.offset = (factor-1)*0.5;
+
+    for (int64_t o=0; o<outLen; o++) {
+        int64_t beg = o*factor;
+        int64_t cnt = std::min(factor, inpLen - beg);
+        for (int64_t m=0; m<factor; m++) {
+            out.ind[o*factor+m] = std::min(beg + m, inpLen-1);
+            out.w[o*factor+m]   = (m<cnt) ? 1.0f/float(cnt) : 0.0f;
+        }
+    }
+
+    return out;
+
+}
+
+NIBR::SeparableWeights NIBR::upsampleWeights(int64_t inpLen, int64_t factor)
+{
+
+    if (factor <= 1)
+        return identityWeights(inpLen);
+
+    const int64_t outLen = inpLen*factor;
+
+    SeparableWeights out = allocWeights(inpLen,outLen,2);
+    out.scale  = 1.0/factor;
+    out.offset = 0.5/factor - 0.5;
+
+    for (int64_t o=0; o<outLen; o++) {
+        double  x  = std::clamp((o+0.5)/double(factor) - 0.5, 0.0, double(inpLen-1));
+        int64_t lo = std::min(int64_t(x), inpLen-1);
+        out.ind[2*o]   = lo;
+        out.ind[2*o+1] = std::min(lo+1, inpLen-1);
+        out.w[2*o+1]   = float(x - lo);
+        out.w[2*o]     = 1.0f - out.w[2*o+1];
+    }
+
+    return out;
+
+}
+
+NIBR::SeparableWeights NIBR::interpolationWeights(int64_t inpLen, int64_t outLen, double scale, double offset, INTERPMETHOD method)
+{
+
+    SeparableWeights out = allocWeights(inpLen,outLen,(method==NEAREST) ? 1 : 2);
+    out.scale  = scale;
+    out.offset = offset;
+
+    for (int64_t o=0; o<outLen; o++) {
+
+        double x = scale*o + offset;
+
+        if (method==NEAREST) {
+
+            int64_t c = std::round(x);
+            bool inside = (c>=0) && (c<inpLen);
+
+            out.ind[o]      = inside ? c : 0;
+            out.w[o]        = inside ? 1.0f : 0.0f;
+            out.coverage[o] = out.w[o];
+            continue;
+
+        }
+
+        // Same as Interpolator::init_interp_linear, where c-1 and c are the two neighbors
+        int64_t c   = int64_t(x + 1.0);
+        float   cfs = float(c - x);
+
+        if ( (c<0) || (c>=inpLen) ) {
+            out.ind[2*o]     = 0;
+            out.ind[2*o+1]   = 0;
+            out.coverage[o]  = 0;
+            continue;
+        }
+
+        if (cfs>1) cfs -= 1.0f;
+        if (cfs<0) cfs += 1.0f;
+
+        // c-1 is outside if c==0
+        out.ind[2*o]     = (c>0) ? c-1 : 0;
+        out.w[2*o]       = (c>0) ? cfs : 0.0f;
+        out.ind[2*o+1]   = c;
+        out.w[2*o+1]     = 1.0f - cfs;
+        out.coverage[o]  = (c>0) ? 1.0f : 1.0f - cfs;
+
+    }
+
+    return out;
+
+}
+
+void NIBR::separableFilter(float* out, const float* inp, const int64_t inpDims[3], const SeparableWeights w[3])
+{
+
+    const int64_t nx = inpDims[0], ny = inpDims[1], nz = inpDims[2];
+    const int64_t ox = w[0].outLen, oy = w[1].outLen, oz = w[2].outLen;
+
+    std::vector<float> bufX, bufY;
+
+    // Along x: each row is gathered with the taps
+    const float* srcX = inp;
+    if (!w[0].isIdentity()) {
+
+        bufX.resize(ox*ny*nz);
+        const int64_t rowCnt   = ny*nz;
+        const int     width    = w[0].width;
+
+        NIBR::MT::MTRUN((rowCnt + FILTER_ROW_BLOCK_SIZE - 1)/FILTER_ROW_BLOCK_SIZE, [&](const NIBR::MT::TASK& task)->void {
+            int64_t rowEnd = std::min(int64_t(task.no+1)*FILTER_ROW_BLOCK_SIZE, rowCnt);
+            for (int64_t r=task.no*FILTER_ROW_BLOCK_SIZE; r<rowEnd; r++) {
+                const float* s = inp  + r*nx;
+                float*       d = bufX.data() + r*ox;
+                for (int64_t o=0; o<ox; o++) {
+                    float sum = 0;
+                    for (int m=0; m<width; m++)
+                        sum += w[0].w[o*width+m]*s[w[0].ind[o*width+m]];
+                    d[o] = sum;
+                }
+            }
+        });
+
+        srcX = bufX.data();
+    }
+
+    // Along y: each output row is a weighted sum of input rows
+    const float* srcY = srcX;
+    if (!w[1].isIdentity()) {
+
+        bufY.resize(ox*oy*nz);
+        const int64_t rowCnt = oy*nz;
+        const int     width  = w[1].width;
+
+        NIBR::MT::MTRUN((rowCnt + FILTER_ROW_BLOCK_SIZE - 1)/FILTER_ROW_BLOCK_SIZE, [&](const NIBR::MT::TASK& task)->void {
+            int64_t rowEnd = std::min(int64_t(task.no+1)*FILTER_ROW_BLOCK_SIZE, rowCnt);
+            for (int64_t r=task.no*FILTER_ROW_BLOCK_SIZE; r<rowEnd; r++) {
+                int64_t o = r % oy;
+                int64_t k = r / oy;
+                float*  d = bufY.data() + r*ox;
+                std::fill(d, d+ox, 0.0f);
+                for (int m=0; m<width; m++) {
+                    const float  wm = w[1].w[o*width+m];
+                    if (wm == 0) continue;
+                    const float* s  = srcX + (k*ny + w[1].ind[o*width+m])*ox;
+                    for (int64_t i=0; i<ox; i++)
+                        d[i] += wm*s[i];
+                }
+            }
+        });
+
+        srcY = bufY.data();
+    }
+
+    // Along z: each output slice is a weighted sum of input slices
+    const int64_t sliceLen = ox*oy;
+
+    if (w[2].isIdentity()) {
+        std::copy(srcY, srcY + sliceLen*oz, out);
+        return;
+    }
+
+    const int64_t blockPerSlice = (sliceLen + FILTER_SLICE_BLOCK_SIZE - 1)/FILTER_SLICE_BLOCK_SIZE;
+    const int     width         = w[2].width;
+
+    NIBR::MT::MTRUN(oz*blockPerSlice, [&](const NIBR::MT::TASK& task)->void {
+        int64_t o   = task.no / blockPerSlice;
+        int64_t beg = (task.no % blockPerSlice)*FILTER_SLICE_BLOCK_SIZE;
+        int64_t end = std::min(beg + FILTER_SLICE_BLOCK_SIZE, sliceLen);
+        float*  d   = out + o*sliceLen;
+        std::fill(d+beg, d+end, 0.0f);
+        for (int m=0; m<width; m++) {
+            const float  wm = w[2].w[o*width+m];
+            if (wm == 0) continue;
+            const float* s  = srcY + w[2].ind[o*width+m]*sliceLen;
+            for (int64_t i=beg; i<end; i++)
+                d[i] += wm*s[i];
+        }
+    });
+
+}
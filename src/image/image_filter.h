@@ -0,0 +1,233 @@
+#pragma once
+
+#include "base/nibr.h"
+#include "image/image.h"
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+// Separable filtering of the first three image dimensions.
+//
+// Filtering along an axis maps an input line of length inpLen to an output line of length outLen.
+// Each output sample is a weighted sum of a fixed number of input samples (taps). Taps and weights are
+// precomputed once per axis, so the same engine performs smoothing, up/downsampling and axis-aligned resampling.
+// Taps outside the input are dropped, in which case the sum of the weights of an output sample, i.e., its
+// coverage, is less than 1. The missing part is filled with the outsideVal of the input image.
+//
+// The volumes are filtered one after another with three 1D passes. The passes along y and z are weighted sums of
+// contiguous rows and slices, which vectorize, and all passes run in parallel over blocks of rows.
+
+namespace NIBR
+{
+
+    struct SeparableWeights {
+        int64_t              inpLen   = 0;
+        int64_t              outLen   = 0;
+        int                  width    = 0;      // number of taps per output sample
+        std::vector<int64_t> ind;               // outLen*width input indices, always within [0,inpLen)
+        std::vector<float>   w;                 // outLen*width weights
+        std::vector<float>   coverage;          // outLen sums of weights
+        double               scale    = 1;      // output sample o is centered at input coordinate scale*o + offset
+        double               offset   = 0;
+        bool                 isIdentity() const;
+    };
+
+    // The edges are replicated for smoothing, so the coverage is always 1.
+    SeparableWeights identityWeights(int64_t len);
+    SeparableWeights gaussianWeights(int64_t len, float sigma);                // sigma is in voxels, kernel is truncated at 3 sigma
+    SeparableWeights boxWeights(int64_t len, int64_t width);                   // width is in voxels and is rounded up to an odd number
+
+    // Averages non-overlapping blocks of factor voxels. The last block might be incomplete.
+    SeparableWeights downsampleWeights(int64_t inpLen, int64_t factor);
+
+    // Linear interpolation at input coordinate (o+0.5)/factor - 0.5 for output sample o.
+    // Coordinates are clamped, so the edges are replicated instead of being mixed with outsideVal.
+    SeparableWeights upsampleWeights(int64_t inpLen, int64_t factor);
+
+    // Output sample o is interpolated at input coordinate scale*o + offset.
+    // The boundary is handled as in Interpolator, i.e., samples outside the input are taken as outsideVal.
+    SeparableWeights interpolationWeights(int64_t inpLen, int64_t outLen, double scale, double offset, INTERPMETHOD method);
+
+    // inp and out are single 3D volumes in standard order, i.e., i is the fastest changing index.
+    // out has dimensions w[0].outLen x w[1].outLen x w[2].outLen. The coverage is not applied here.
+    void separableFilter(float* out, const float* inp, const int64_t inpDims[3], const SeparableWeights w[3]);
+
+    // Filters all volumes of inp. If out has no data, it is created on the output grid of the weights,
+    // i.e., voxel o along axis a is placed at input voxel coordinate w[a].scale*o + w[a].offset.
+    template<typename T_OUT, typename T_INP>
+    void imgSeparableFilter(NIBR::Image<T_OUT>& out, NIBR::Image<T_INP>& inp, const SeparableWeights w[3])
+    {
+
+        for (int a=0; a<3; a++) {
+            if (w[a].inpLen != inp.imgDims[a]) {
+                disp(MSG_ERROR,"Filter length does not match image dimension");
+                return;
+            }
+        }
+
+        if (out.data==NULL) {
+            int64_t dims[7];
+            float   pixd[7];
+            float   ijk2xyz[3][4];
+            for (int i=0; i<7; i++) {
+                dims[i] = (i<3) ? w[i].outLen : inp.imgDims[i];
+                pixd[i] = (i<3) ? inp.pixDims[i]*std::fabs(w[i].scale) : inp.pixDims[i];
+            }
+            for (int i=0; i<3; i++) {
+                ijk2xyz[i][3] = inp.ijk2xyz[i][3];
+                for (int j=0; j<3; j++) {
+                    ijk2xyz[i][j]  = inp.ijk2xyz[i][j]*w[j].scale;
+                    ijk2xyz[i][3] += inp.ijk2xyz[i][j]*w[j].offset;
+                }
+            }
+            out.create(inp.numberOfDimensions, dims, pixd, ijk2xyz, true);
+        }
+
+        for (int a=0; a<3; a++) {
+            if (out.imgDims[a] != w[a].outLen) {
+                disp(MSG_ERROR,"Filter output length does not match image dimension");
+                return;
+            }
+        }
+
+        const int64_t inpDims[3] = {inp.imgDims[0],inp.imgDims[1],inp.imgDims[2]};
+        const int64_t outCnt     = w[0].outLen*w[1].outLen*w[2].outLen;
+        const int64_t valCnt     = std::min(inp.valCnt,out.valCnt);
+        const float   fillVal    = float(inp.outsideVal);
+
+        bool fill = false;
+        if (fillVal != 0)
+            for (int a=0; a<3; a++)
+                for (auto c : w[a].coverage)
+                    if (c != 1.0f) fill = true;
+
+        std::vector<float> src(inp.voxCnt);
+        std::vector<float> dst(outCnt);
+
+        for (int64_t t=0; t<valCnt; t++) {
+
+            NIBR::MT::MTRUN(inpDims[2], [&](const NIBR::MT::TASK& task)->void {
+                int64_t k = task.no;
+                for (int64_t j=0; j<inpDims[1]; j++)
+                    for (int64_t i=0; i<inpDims[0]; i++)
+                        src[i + inpDims[0]*(j + inpDims[1]*k)] = float(inp.data[inp.sub2ind(i,j,k,t)]);
+            });
+
+            separableFilter(dst.data(), src.data(), inpDims, w);
+
+            NIBR::MT::MTRUN(w[2].outLen, [&](const NIBR::MT::TASK& task)->void {
+                int64_t k = task.no;
+                for (int64_t j=0; j<w[1].outLen; j++)
+                    for (int64_t i=0; i<w[0].outLen; i++) {
+                        float val = dst[i + w[0].outLen*(j + w[1].outLen*k)];
+                        if (fill) val += fillVal*(1.0f - w[0].coverage[i]*w[1].coverage[j]*w[2].coverage[k]);
+                        out.data[out.sub2ind(i,j,k,t)] = static_cast<T_OUT>(val);
+                    }
+            });
+
+        }
+
+    }
+
+    // sigma is in the spatial unit of the image
+    template<typename T_OUT, typename T_INP>
+    void imgSmoothGaussian(NIBR::Image<T_OUT>& out, NIBR::Image<T_INP>& inp, float sigma)
+    {
+        SeparableWeights w[3];
+        for (int a=0; a<3; a++)
+            w[a] = gaussianWeights(inp.imgDims[a], sigma/inp.pixDims[a]);
+        imgSeparableFilter(out,inp,w);
+    }
+
+    // width is in voxels
+    template<typename T_OUT, typename T_INP>
+    void imgSmoothBox(NIBR::Image<T_OUT>& out, NIBR::Image<T_INP>& inp, int64_t width)
+    {
+        SeparableWeights w[3];
+        for (int a=0; a<3; a++)
+            w[a] = boxWeights(inp.imgDims[a], width);
+        imgSeparableFilter(out,inp,w);
+    }
+
+    // Averages blocks of factor x factor x factor voxels. The centers of the output voxels are the centers of the blocks.
+    template<typename T_OUT, typename T_INP>
+    void imgDownsample(NIBR::Image<T_OUT>& out, NIBR::Image<T_INP>& inp, int64_t factor)
+    {
+
+        if (factor<1) {
+            disp(MSG_ERROR,"Downsampling factor must be a positive integer");
+            return;
+        }
+
+        SeparableWeights w[3];
+        for (int a=0; a<3; a++)
+            w[a] = downsampleWeights(inp.imgDims[a], factor);
+
+        out.deallocData();
+        imgSeparableFilter(out,inp,w);
+
+    }
+
+    // Linearly interpolates factor x factor x factor voxels for each input voxel. The output covers the same space as the input.
+    template<typename T_OUT, typename T_INP>
+    void imgUpsample(NIBR::Image<T_OUT>& out, NIBR::Image<T_INP>& inp, int64_t factor)
+    {
+
+        if (factor<1) {
+            disp(MSG_ERROR,"Upsampling factor must be a positive integer");
+            return;
+        }
+
+        SeparableWeights w[3];
+        for (int a=0; a<3; a++)
+            w[a] = upsampleWeights(inp.imgDims[a], factor);
+
+        out.deallocData();
+        imgSeparableFilter(out,inp,w);
+
+    }
+
+    // Resamples img on the grid of imgOut with separable weights if the mapping from the voxel coordinates of imgOut
+    // to those of img, through the transform M in world coordinates, only scales and shifts the axes.
+    // Returns false, without doing anything, if that is not the case or the interpolation method is not supported.
+    template<typename T_INP, typename T_OUT>
+    bool imgResampleAxisAligned(NIBR::Image<T_OUT>* imgOut, NIBR::Image<T_INP>* img, const double M[3][4])
+    {
+
+        if ((img->interpMethod != LINEAR) && (img->interpMethod != NEAREST))
+            return false;
+
+        // A = xyz2ijk(img) * M * ijk2xyz(imgOut)
+        double B[3][4];
+        double A[3][4];
+
+        for (int i=0; i<3; i++)
+            for (int j=0; j<4; j++) {
+                B[i][j] = (j==3) ? M[i][3] : 0;
+                for (int k=0; k<3; k++)
+                    B[i][j] += M[i][k]*imgOut->ijk2xyz[k][j];
+            }
+
+        for (int i=0; i<3; i++)
+            for (int j=0; j<4; j++) {
+                A[i][j] = (j==3) ? img->xyz2ijk[i][3] : 0;
+                for (int k=0; k<3; k++)
+                    A[i][j] += img->xyz2ijk[i][k]*B[k][j];
+            }
+
+        for (int i=0; i<3; i++)
+            for (int j=0; j<3; j++)
+                if ((i!=j) && (std::fabs(A[i][j]) > 1e-6))
+                    return false;
+
+        SeparableWeights w[3];
+        for (int a=0; a<3; a++)
+            w[a] = interpolationWeights(img->imgDims[a], imgOut->imgDims[a], A[a][a], A[a][3], img->interpMethod);
+
+        imgSeparableFilter(*imgOut,*img,w);
+
+        return true;
+
+    }
+
+}
@@ -18,16 +18,14 @@ bool NIBR::isosurface(Image<float> *img, float isoValue, Surface *surf)
     surf->nv = mc.nverts();
     surf->nf = mc.ntrigs();
 
-    surf->vertices = new float *[surf->nv];
+    surf->vertices = allocateRows3<float>(surf->nv);
     for (int n = 0; n < surf->nv; n++) {
-        surf->vertices[n] = new float[3];
         applyTransform(surf->vertices[n],&v[n].x,img->ijk2xyz);
     }
 
     // Flip face orientation so they point outwards
-    surf->faces = new int *[surf->nf];
+    surf->faces = allocateRows3<int>(surf->nf);
     for (int n = 0; n < surf->nf; n++) {
-        surf->faces[n] = new int[3];
         surf->faces[n][0] = f[n].v3;
         surf->faces[n][1] = f[n].v2;
         surf->faces[n][2] = f[n].v1;
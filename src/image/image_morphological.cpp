@@ -0,0 +1,245 @@
+#include "image_morphological.h"
+#include <map>
+
+using namespace NIBR;
+
+namespace {
+
+    // Neighbors grouped by row, i.e., by (dy,dz), with the x shifts used in each row
+    struct RowShift {
+        int  dy;
+        int  dz;
+        bool dx[3];     // -1, 0, 1
+    };
+
+    std::vector<RowShift> getRowShifts(CONN3D conn)
+    {
+        std::map<std::pair<int,int>,RowShift> shifts;
+
+        for (auto n : get3DNeighbors(conn)) {
+            auto& s = shifts[std::make_pair(n[1],n[2])];
+            s.dy = n[1];
+            s.dz = n[2];
+            s.dx[n[0]+1] = true;
+        }
+
+        std::vector<RowShift> out;
+        for (auto& s : shifts) out.push_back(s.second);
+        return out;
+    }
+
+    void packedMorph(std::vector<uint64_t>& out, const std::vector<uint64_t>& inp, const int64_t* dims, CONN3D conn, bool erode)
+    {
+
+        const int64_t  nx       = dims[0];
+        const int64_t  ny       = dims[1];
+        const int64_t  nz       = dims[2];
+        const int64_t  W        = packedWordsPerRow(dims);
+        const uint64_t lastMask = (nx%64) ? ((uint64_t(1) << (nx%64)) - 1) : ~uint64_t(0);
+
+        // Bits outside the image are 1 for erosion and 0 for dilation, so that they do not change the result
+        const uint64_t fill     = erode ? ~uint64_t(0) : 0;
+
+        const std::vector<RowShift> shifts = getRowShifts(conn);
+
+        out.assign(inp.size(),0);
+
+        NIBR::MT::MTRUN(nz, [&](const NIBR::MT::TASK& task)->void {
+
+            const int64_t k = task.no;
+
+            std::vector<uint64_t> acc(W);
+
+            for (int64_t j=0; j<ny; j++) {
+
+                std::fill(acc.begin(), acc.end(), fill);
+
+                for (const auto& s : shifts) {
+
+                    const int64_t jj = j + s.dy;
+                    const int64_t kk = k + s.dz;
+                    if ((jj<0) || (jj>=ny) || (kk<0) || (kk>=nz)) continue;
+
+                    const uint64_t* src = inp.data() + (jj + ny*kk)*W;
+
+                    auto word = [&](int64_t w)->uint64_t {
+                        if ((w<0) || (w>=W)) return fill;
+                        return (w==W-1) ? ((src[w] & lastMask) | (fill & ~lastMask)) : src[w];
+                    };
+
+                    for (int64_t w=0; w<W; w++) {
+                        const uint64_t cur = word(w);
+                        uint64_t val = erode ? ~uint64_t(0) : 0;
+                        if (s.dx[0]) val = erode ? (val & ((cur << 1) | (word(w-1) >> 63))) : (val | ((cur << 1) | (word(w-1) >> 63)));
+                        if (s.dx[1]) val = erode ? (val & cur)                              : (val | cur);
+                        if (s.dx[2]) val = erode ? (val & ((cur >> 1) | (word(w+1) << 63))) : (val | ((cur >> 1) | (word(w+1) << 63)));
+                        acc[w] = erode ? (acc[w] & val) : (acc[w] | val);
+                    }
+
+                }
+
+                // The voxel itself
+                const uint64_t* self = inp.data() + (j + ny*k)*W;
+                uint64_t*       dst  = out.data() + (j + ny*k)*W;
+                for (int64_t w=0; w<W; w++)
+                    dst[w] = erode ? (acc[w] & self[w]) : (acc[w] | self[w]);
+                dst[W-1] &= lastMask;
+
+            }
+
+        });
+
+    }
+
+    int64_t findRoot(std::vector<int64_t>& parent, int64_t a)
+    {
+        while (parent[a] != a) {
+            parent[a] = parent[parent[a]];
+            a = parent[a];
+        }
+        return a;
+    }
+
+    // The smaller index becomes the root, so the root of a component is its first run in raster order
+    void unite(std::vector<int64_t>& parent, int64_t a, int64_t b)
+    {
+        a = findRoot(parent,a);
+        b = findRoot(parent,b);
+        if (a < b) parent[b] = a;
+        else if (b < a) parent[a] = b;
+    }
+
+}
+
+void NIBR::packedErode (std::vector<uint64_t>& out, const std::vector<uint64_t>& inp, const int64_t* dims, CONN3D conn) {packedMorph(out,inp,dims,conn,true); }
+void NIBR::packedDilate(std::vector<uint64_t>& out, const std::vector<uint64_t>& inp, const int64_t* dims, CONN3D conn) {packedMorph(out,inp,dims,conn,false);}
+
+NIBR::PackedRuns NIBR::packedRuns(const std::vector<uint64_t>& mask, const int64_t* dims)
+{
+
+    const int64_t nx      = dims[0];
+    const int64_t rowCnt  = dims[1]*dims[2];
+    const int64_t W       = packedWordsPerRow(dims);
+
+    auto bit = [&](const uint64_t* row, int64_t i)->bool {
+        return (i<nx) && ((row[i/64] >> (i%64)) & 1);
+    };
+
+    PackedRuns runs;
+    runs.rowStart.assign(rowCnt+1,0);
+
+    // Count, then fill
+    NIBR::MT::MTRUN(rowCnt, [&](const NIBR::MT::TASK& task)->void {
+        const uint64_t* row = mask.data() + task.no*W;
+        int64_t cnt = 0;
+        for (int64_t i=0; i<nx; i++)
+            if (bit(row,i) && !((i>0) && bit(row,i-1))) cnt++;
+        runs.rowStart[task.no+1] = cnt;
+    });
+
+    for (int64_t r=0; r<rowCnt; r++)
+        runs.rowStart[r+1] += runs.rowStart[r];
+
+    runs.beg.resize(runs.rowStart[rowCnt]);
+    runs.end.resize(runs.rowStart[rowCnt]);
+
+    NIBR::MT::MTRUN(rowCnt, [&](const NIBR::MT::TASK& task)->void {
+        const uint64_t* row = mask.data() + task.no*W;
+        int64_t r = runs.rowStart[task.no];
+        for (int64_t i=0; i<nx; i++) {
+            if (!bit(row,i)) continue;
+            runs.beg[r] = i;
+            while (bit(row,i+1)) i++;
+            runs.end[r] = i;
+            r++;
+        }
+    });
+
+    return runs;
+
+}
+
+void NIBR::labelPackedRuns(std::vector<int>& labels, std::vector<size_t>& voxelCounts, const PackedRuns& runs, const int64_t* dims, CONN3D conn)
+{
+
+    const int64_t ny     = dims[1];
+    const int64_t nz     = dims[2];
+    const int64_t runCnt = runs.beg.size();
+
+    std::vector<int64_t> parent(runCnt);
+    for (int64_t r=0; r<runCnt; r++) parent[r] = r;
+
+    // Previously scanned neighbor rows. If touch is true, runs that are diagonal along x are connected as well.
+    struct RowLink {
+        int  dy;
+        int  dz;
+        bool touch;
+    };
+
+    std::vector<RowLink> links;
+    switch (conn) {
+        case CONN6:  links = {{-1,0,false},{0,-1,false}}; break;
+        case CONN18: links = {{-1,0,true}, {0,-1,true}, {-1,-1,false},{1,-1,false}}; break;
+        case CONN27: links = {{-1,0,true}, {0,-1,true}, {-1,-1,true}, {1,-1,true}};  break;
+    }
+
+    // Unites the runs of row (j,k) with the runs of the linked rows, where kMin is the first slice that can be linked
+    auto linkRow = [&](int64_t j, int64_t k, int64_t kMin) {
+
+        const int64_t row = j + ny*k;
+
+        for (const auto& l : links) {
+
+            const int64_t jj = j + l.dy;
+            const int64_t kk = k + l.dz;
+            if ((jj<0) || (jj>=ny) || (kk<kMin)) continue;
+
+            const int64_t nrow = jj + ny*kk;
+            const int     d    = l.touch ? 1 : 0;
+
+            int64_t a = runs.rowStart[row],  aEnd = runs.rowStart[row+1];
+            int64_t b = runs.rowStart[nrow], bEnd = runs.rowStart[nrow+1];
+
+            while ((a<aEnd) && (b<bEnd)) {
+                if ((runs.beg[a] <= runs.end[b] + d) && (runs.beg[b] <= runs.end[a] + d))
+                    unite(parent,a,b);
+                if (runs.end[a] < runs.end[b]) a++; else b++;
+            }
+
+        }
+
+    };
+
+    // First pass in slabs, where the runs of a slab are only linked within the slab
+    const int64_t slabCnt  = std::min(nz, int64_t(4*NIBR::MT::MAXNUMBEROFTHREADS()));
+    const int64_t slabSize = (nz + slabCnt - 1)/slabCnt;
+
+    NIBR::MT::MTRUN(slabCnt, [&](const NIBR::MT::TASK& task)->void {
+        const int64_t kBeg = task.no*slabSize;
+        const int64_t kEnd = std::min(kBeg + slabSize, nz);
+        for (int64_t k=kBeg; k<kEnd; k++)
+            for (int64_t j=0; j<ny; j++)
+                linkRow(j,k,kBeg);
+    });
+
+    // Merge equivalences across slab borders
+    for (int64_t kBeg=slabSize; kBeg<nz; kBeg+=slabSize)
+        for (int64_t j=0; j<ny; j++)
+            linkRow(j,kBeg,kBeg-1);
+
+    // Second pass. Roots are the first runs of components, so labels follow the raster order.
+    labels.assign(runCnt,0);
+    voxelCounts.assign(1,0);
+
+    for (int64_t r=0; r<runCnt; r++) {
+        const int64_t root = findRoot(parent,r);
+        if (root == r) {
+            labels[r] = voxelCounts.size();
+            voxelCounts.push_back(0);
+        } else {
+            labels[r] = labels[root];
+        }
+        voxelCounts[labels[r]] += runs.end[r] - runs.beg[r] + 1;
+    }
+
+}
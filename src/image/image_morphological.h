@@ -3,6 +3,7 @@
 #include "base/nibr.h"
 #include "image/image.h"
 #include "image/image_operators.h"
+#include "image/image_bitmask.h"
 #include "math/conn3D.h"
 #include <sys/types.h>
 #include <tuple>
@@ -11,6 +12,33 @@
 namespace NIBR
 {
 
+    // Binary masks are packed as in BitMask, i.e., along x with 64 voxels per word, and each row (j,k) starts at word (j + ny*k)*packedWordsPerRow(dims).
+    template<typename T>
+    std::vector<uint64_t> packNonZero(NIBR::Image<T>& img)
+    {
+        BitMask mask;
+        mask.fromNonZero(img);
+        return std::move(mask.words);
+    }
+
+    // Each word is computed from the shifted words of the neighboring rows, so erosion and dilation cost a few bit operations per 64 voxels.
+    // Neighbors outside the image do not erode and do not dilate.
+    void packedErode (std::vector<uint64_t>& out, const std::vector<uint64_t>& inp, const int64_t* dims, CONN3D conn);
+    void packedDilate(std::vector<uint64_t>& out, const std::vector<uint64_t>& inp, const int64_t* dims, CONN3D conn);
+
+    // Runs of consecutive foreground voxels along x, listed row by row. beg and end are inclusive.
+    struct PackedRuns {
+        std::vector<int64_t> rowStart;  // (ny*nz + 1) offsets into beg and end
+        std::vector<int32_t> beg;
+        std::vector<int32_t> end;
+    };
+
+    PackedRuns packedRuns(const std::vector<uint64_t>& mask, const int64_t* dims);
+
+    // Two-pass union-find labeling of the runs. Slabs along z are labeled in parallel, then equivalences across slab borders are merged.
+    // labels has one label per run, starting from 1 in raster order. voxelCounts[0] is unused.
+    void labelPackedRuns(std::vector<int>& labels, std::vector<size_t>& voxelCounts, const PackedRuns& runs, const int64_t* dims, CONN3D conn);
+
     // imgErode
     // template<typename T>
     // void imgErode(NIBR::Image<T>& inp, CONN3D conn)
@@ -56,33 +84,24 @@ namespace NIBR
     template<typename T>
     void imgErode(NIBR::Image<T>& inp, CONN3D conn)
     {
-        auto N = get3DNeighbors(conn);
-        std::vector<int> inds = getNonZeroIndices(&inp);
-
-        std::vector<int> to_delete;
-        to_delete.reserve(inds.size()); 
-
-        int64_t i, j, k;
-
-        for (auto n : inds) {
-
-            inp.ind2sub(n, i, j, k);
-
-            for (auto nn : N) {
-                int64_t ii = i + nn[0];
-                int64_t jj = j + nn[1];
-                int64_t kk = k + nn[2];
-
-                if ( inp.isInside(ii,jj,kk) && (inp(ii,jj,kk) == 0) ) {
-                    to_delete.push_back(n);
-                    break;
+        const int64_t W = packedWordsPerRow(inp.imgDims);
+
+        std::vector<uint64_t> mask = packNonZero(inp);
+        std::vector<uint64_t> eroded;
+        packedErode(eroded, mask, inp.imgDims, conn);
+
+        // Voxels that are in mask but not in eroded are removed
+        NIBR::MT::MTRUN(inp.imgDims[2], [&](const NIBR::MT::TASK& task)->void {
+            const int64_t k = task.no;
+            for (int64_t j=0; j<inp.imgDims[1]; j++) {
+                const int64_t row = (j + inp.imgDims[1]*k)*W;
+                for (int64_t w=0; w<W; w++) {
+                    uint64_t diff = mask[row+w] & ~eroded[row+w];
+                    for (int b=0; diff; b++, diff>>=1)
+                        if (diff & 1) inp.data[inp.sub2ind(w*64+b,j,k)] = 0;
                 }
             }
-        }
-        
-        for (auto m : to_delete) {
-            inp.data[m] = 0;
-        }
+        });
     }
     
     template<typename T_OUT,typename T_INP>
@@ -138,25 +157,24 @@ namespace NIBR
     template<typename T>
     void imgDilate(NIBR::Image<T>& inp, CONN3D conn)
     {
-        auto N = get3DNeighbors(conn);
-
-        std::vector<int> inds = getNonZeroIndices(&inp);
-        int64_t i,j,k;
-
-        for (auto idx : inds) {
-
-            inp.ind2sub(idx,i,j,k);
-
-            for (auto n : N) { 
-                int64_t ii = i + n[0];
-                int64_t jj = j + n[1];
-                int64_t kk = k + n[2];
-
-                if ( inp.isInside(ii,jj,kk) && (inp(ii,jj,kk)==0) ) {
-                    *inp.at(ii,jj,kk) = 1;
+        const int64_t W = packedWordsPerRow(inp.imgDims);
+
+        std::vector<uint64_t> mask = packNonZero(inp);
+        std::vector<uint64_t> dilated;
+        packedDilate(dilated, mask, inp.imgDims, conn);
+
+        // Voxels that are added to the mask are set to 1
+        NIBR::MT::MTRUN(inp.imgDims[2], [&](const NIBR::MT::TASK& task)->void {
+            const int64_t k = task.no;
+            for (int64_t j=0; j<inp.imgDims[1]; j++) {
+                const int64_t row = (j + inp.imgDims[1]*k)*W;
+                for (int64_t w=0; w<W; w++) {
+                    uint64_t diff = dilated[row+w] & ~mask[row+w];
+                    for (int b=0; diff; b++, diff>>=1)
+                        if (diff & 1) inp.data[inp.sub2ind(w*64+b,j,k)] = 1;
                 }
             }
-        }
+        });
     }
     
     template<typename T_OUT,typename T_INP>
@@ -175,74 +193,36 @@ namespace NIBR
 
 
     // Connected component labeling
+    // Labels are assigned in the raster order of the first voxel of each component, starting from 1
     template<typename T_INP>
     std::tuple<NIBR::Image<int>, std::vector<std::size_t>> imgConnectedComponents(NIBR::Image<T_INP>& inp, CONN3D conn)
     {
 
         if (inp.numberOfDimensions != 3) {
             disp(MSG_ERROR,"Input has to be 3-dimensional for connected component labeling");
-            std::make_tuple(NIBR::Image<int>(), std::vector<size_t>());
+            return std::make_tuple(NIBR::Image<int>(), std::vector<size_t>());
         }
 
+        // Vector to store voxel counts per label. Index 0 is unused (background)
+        std::vector<size_t> voxelCounts;
+        std::vector<int>    runLabels;
+        PackedRuns          runs = packedRuns(packNonZero(inp), inp.imgDims);
+        
+        labelPackedRuns(runLabels, voxelCounts, runs, inp.imgDims, conn);
+
         // Initialize label image with zeros (background)
         NIBR::Image<int> labels;
         labels.createFromTemplate(inp,true);
-        for (auto n = 0; n < labels.numel; n++) labels.data[n] = 0;
-        
-        // Vector to store voxel counts per label. Index 0 is unused (background)
-        std::vector<size_t> voxelCounts;
-        voxelCounts.push_back(0); // Placeholder for background
-
-        auto N = get3DNeighbors(conn);
-        int current_label = 1; // Start labeling from 1
-
-        // Iterate through each voxel
-        for(int64_t k = 0; k < inp.imgDims[2]; ++k)
-        {
-            for(int64_t j = 0; j < inp.imgDims[1]; ++j)
-            {
-                for(int64_t i = 0; i < inp.imgDims[0]; ++i)
-                {
-                    // Check if voxel is foreground and not yet labeled
-                    if(inp(i, j, k) != 0 && labels(i, j, k) == 0)
-                    {
-                        // Initialize voxel count for the new component
-                        size_t voxelCount = 0;
-
-                        // Perform BFS to label all connected voxels
-                        std::queue<std::tuple<int64_t, int64_t, int64_t>> q;
-                        q.push({i, j, k});
-                        (*labels.at(i, j, k)) = current_label;
-                        voxelCount++;
-
-                        while(!q.empty())
-                        {
-                            auto [x, y, z] = q.front();
-                            q.pop();
-
-                            for(const auto& n : N)
-                            {
-                                int64_t xn = x + n[0];
-                                int64_t yn = y + n[1];
-                                int64_t zn = z + n[2];
-
-                                if(inp.isInside(xn, yn, zn) && inp(xn, yn, zn) != 0 && labels(xn, yn, zn) == 0)
-                                {
-                                    (*labels.at(xn, yn, zn)) = current_label;
-                                    q.push({xn, yn, zn});
-                                    voxelCount++;
-                                }
-                            }
-                        }
-
-                        // Append the voxel count for this component
-                        voxelCounts.push_back(voxelCount);
-
-                        ++current_label; // Increment label for next component
-                    }
-                }
+
+        NIBR::MT::MTRUN(inp.imgDims[2], [&](const NIBR::MT::TASK& task)->void {
+            const int64_t k = task.no;
+            for (int64_t j=0; j<inp.imgDims[1]; j++) {
+                const int64_t row = j + inp.imgDims[1]*k;
+                for (int64_t r=runs.rowStart[row]; r<runs.rowStart[row+1]; r++)
+                    for (int64_t i=runs.beg[r]; i<=runs.end[r]; i++)
+                        labels.data[labels.sub2ind(i,j,k)] = runLabels[r];
             }
-        }
+        });
 
         return std::make_tuple(labels, voxelCounts);
     }
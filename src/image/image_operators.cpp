@@ -5,6 +5,99 @@
 using namespace NIBR;
 using namespace SF;
 
+#define SH_VOXEL_BLOCK_SIZE 256
+
+namespace {
+
+    // Offsets of the first volume of the given voxels, which are listed with their 3D indices
+    std::vector<int64_t> getVolumeOffsets(NIBR::Image<float>* img, const std::vector<int64_t>& voxels) {
+        std::vector<int64_t> offsets(voxels.size());
+        NIBR::MT::MTRUN(voxels.size(), [&](const NIBR::MT::TASK& task)->void {
+            int64_t i,j,k;
+            img->ind2sub(voxels[task.no],i,j,k);
+            offsets[task.no] = img->sub2ind(i,j,k,0);
+        });
+        return offsets;
+    }
+
+    // Ylm is directions x coefficients
+    Eigen::MatrixXf toEigen(const std::vector<std::vector<float>>& Ylm) {
+        Eigen::MatrixXf out(Ylm.size(), Ylm.empty() ? 0 : Ylm[0].size());
+        for (int r = 0; r < out.rows(); r++)
+            for (int c = 0; c < out.cols(); c++)
+                out(r,c) = Ylm[r][c];
+        return out;
+    }
+
+}
+
+namespace {
+
+    // out = M2 * max(M1 * inp, 0) if clamp is true and M2 is not NULL, otherwise the missing steps are skipped
+    void applyAlongVolumes(const Eigen::MatrixXf& M1, bool clamp, const Eigen::MatrixXf* M2, const float* inp, const std::vector<int64_t>& inpOffsets, int64_t inpStride, float* out, const std::vector<int64_t>& outOffsets, int64_t outStride) {
+
+        const int64_t voxCnt   = inpOffsets.size();
+        const int64_t blockCnt = (voxCnt + SH_VOXEL_BLOCK_SIZE - 1) / SH_VOXEL_BLOCK_SIZE;
+
+        const int inpDim = M1.cols();
+        const int outDim = (M2==NULL) ? M1.rows() : M2->rows();
+
+        // Each thread keeps its own panels, where each column is one voxel
+        std::vector<Eigen::MatrixXf> X(NIBR::MT::MAXNUMBEROFTHREADS());
+        std::vector<Eigen::MatrixXf> Y(NIBR::MT::MAXNUMBEROFTHREADS());
+        std::vector<Eigen::MatrixXf> Z(NIBR::MT::MAXNUMBEROFTHREADS());
+
+        NIBR::MT::MTRUN(blockCnt, [&](const NIBR::MT::TASK& task)->void {
+
+            const int64_t beg = task.no * SH_VOXEL_BLOCK_SIZE;
+            const int64_t n   = std::min(int64_t(SH_VOXEL_BLOCK_SIZE), voxCnt - beg);
+
+            Eigen::MatrixXf& x = X[task.threadId];
+            Eigen::MatrixXf& y = Y[task.threadId];
+            x.resize(inpDim, n);
+            y.resize(M1.rows(), n);
+
+            for (int64_t v = 0; v < n; v++) {
+                const float* src = inp + inpOffsets[beg+v];
+                float*       dst = x.data() + v*inpDim;
+                for (int c = 0; c < inpDim; c++)
+                    dst[c] = src[c*inpStride];
+            }
+
+            y.noalias() = M1 * x;
+
+            if (clamp) y = y.cwiseMax(0.0f);
+
+            const Eigen::MatrixXf* res = &y;
+
+            if (M2 != NULL) {
+                Eigen::MatrixXf& z = Z[task.threadId];
+                z.resize(outDim, n);
+                z.noalias() = (*M2) * y;
+                res = &z;
+            }
+
+            for (int64_t v = 0; v < n; v++) {
+                const float* src = res->data() + v*outDim;
+                float*       dst = out + outOffsets[beg+v];
+                for (int r = 0; r < outDim; r++)
+                    dst[r*outStride] = src[r];
+            }
+
+        });
+
+    }
+
+}
+
+void NIBR::applyMatrixAlongVolumes(const Eigen::MatrixXf& M, const float* inp, const std::vector<int64_t>& inpOffsets, int64_t inpStride, float* out, const std::vector<int64_t>& outOffsets, int64_t outStride) {
+    applyAlongVolumes(M, false, NULL, inp, inpOffsets, inpStride, out, outOffsets, outStride);
+}
+
+void NIBR::applyClampedMatrixAlongVolumes(const Eigen::MatrixXf& M1, const Eigen::MatrixXf* M2, const float* inp, const std::vector<int64_t>& inpOffsets, int64_t inpStride, float* out, const std::vector<int64_t>& outOffsets, int64_t outStride) {
+    applyAlongVolumes(M1, true, M2, inp, inpOffsets, inpStride, out, outOffsets, outStride);
+}
+
 void NIBR::sf2sh(NIBR::Image<float>* out, NIBR::Image<float>* inp, std::vector<Point3D>& coords, int shOrder, bool ignoreOddCoeffs) {
     
     std::vector<std::vector<float>> Ylm;
@@ -18,43 +111,14 @@ void NIBR::sf2sh(NIBR::Image<float>* out, NIBR::Image<float>* inp, std::vector<P
         out->create(4, &imgDims[0], inp->pixDims, inp->ijk2xyz, true);
     }
 
-    std::mutex modifier;
-
     // We will find and only process those voxels which have non-zero values
-    std::vector<std::vector<int64_t>> nnzVoxelSubs;
-    auto findNonZeroVoxels = [&](const NIBR::MT::TASK& task)->void {
-        
-        int64_t i   = task.no;
-        
-        for (int64_t j=0; j<inp->imgDims[1]; j++)
-            for (int64_t k=0; k<inp->imgDims[2]; k++)
-                for (int64_t t=0; t<inp->imgDims[3]; t++) {
+    std::vector<int64_t> nnzVoxels = getNonZero3DVoxelIndices(inp);
 
-                    if (inp->data[inp->sub2ind(i,j,k,t)]!=0){
-                        std::vector<int64_t> tmp{i,j,k};
-                        std::lock_guard lock(modifier);
-                        nnzVoxelSubs.push_back(tmp);
-                        break;
-                    }
-                    
-                }
-        
-    };
-    NIBR::MT::MTRUN(inp->imgDims[0],findNonZeroVoxels);
+    // Apply spherical harmonics expansion, coefficients x directions
+    Eigen::MatrixXf M = toEigen(Ylm).transpose();
 
-    // Apply spherical harmonics expansion
-    auto shExpansion = [&](const NIBR::MT::TASK& task)->void {
-        
-        std::vector<int64_t> sub = nnzVoxelSubs[task.no];
-        
-        for (int n=0; n<coeffCount; n++) {
-            out->data[out->sub2ind(sub[0],sub[1],sub[2],n)] = 0;
-            for (int64_t t=0; t<inp->imgDims[3]; t++)
-                out->data[out->sub2ind(sub[0],sub[1],sub[2],n)] += Ylm[t][n]*inp->data[inp->sub2ind(sub[0],sub[1],sub[2],t)];
-        }
-        
-    };
-    NIBR::MT::MTRUN(nnzVoxelSubs.size(),"Applying spherical harmonics expansion",shExpansion);
+    disp(MSG_DETAIL,"Applying spherical harmonics expansion");
+    applyMatrixAlongVolumes(M, inp->data, getVolumeOffsets(inp,nnzVoxels), inp->s2i[3], out->data, getVolumeOffsets(out,nnzVoxels), out->s2i[3]);
 
 }
 
@@ -72,45 +136,16 @@ void NIBR::sh2sf(NIBR::Image<float>* out, NIBR::Image<float>* inp, std::vector<P
         out->create(4, &imgDims[0], inp->pixDims, inp->ijk2xyz, true);
     }
 
-    std::mutex modifier;
-
     // We will find and only process those voxels which have non-zero values
-    std::vector<std::vector<int64_t>> nnzVoxelSubs;
-    auto findNonZeroVoxels = [&](const NIBR::MT::TASK& task)->void {
-        
-        int64_t i   = task.no;
-        
-        for (int64_t j=0; j<inp->imgDims[1]; j++)
-            for (int64_t k=0; k<inp->imgDims[2]; k++)
-                for (int64_t t=0; t<inp->imgDims[3]; t++) {
-
-                    if (inp->data[inp->sub2ind(i,j,k,t)]!=0){
-                        std::vector<int64_t> tmp{i,j,k};
-                        std::lock_guard lock(modifier);
-                        nnzVoxelSubs.push_back(tmp);
-                        break;
-                    }
-                    
-                }
-        
-    };
-    NIBR::MT::MTRUN(inp->imgDims[0],findNonZeroVoxels);
+    std::vector<int64_t> nnzVoxels = getNonZero3DVoxelIndices(inp);
 
     float scale = 4.0 * PI / float(coords.size());
 
-    // Apply spherical harmonics synthesis
-    auto shSynthesis = [&](const NIBR::MT::TASK& task)->void {
-        
-        std::vector<int64_t> sub = nnzVoxelSubs[task.no];
-        
-        for (size_t n = 0; n < coords.size(); n++) {
-            out->data[out->sub2ind(sub[0],sub[1],sub[2],n)] = 0;
-            for (int64_t t = 0; t < inp->imgDims[3]; t++)
-                out->data[out->sub2ind(sub[0],sub[1],sub[2],n)] += scale * Ylm[n][t]*inp->data[inp->sub2ind(sub[0],sub[1],sub[2],t)];
-        }
-        
-    };
-    NIBR::MT::MTRUN(nnzVoxelSubs.size(),"Applying spherical harmonics synthesis",shSynthesis);
+    // Apply spherical harmonics synthesis, directions x coefficients
+    Eigen::MatrixXf M = scale * toEigen(Ylm);
+
+    disp(MSG_DETAIL,"Applying spherical harmonics synthesis");
+    applyMatrixAlongVolumes(M, inp->data, getVolumeOffsets(inp,nnzVoxels), inp->s2i[3], out->data, getVolumeOffsets(out,nnzVoxels), out->s2i[3]);
 
 }
 
@@ -206,60 +241,29 @@ void NIBR::reorientSH(NIBR::Image<float>* img, OrderOfDirections ood)
     int coeffCount = img->imgDims[3];
     int valueCount = coords.size();
 
-    std::mutex modifier;
-
     // We will find and only process those voxels which have non-zero values
-    std::vector<std::vector<int64_t>> nnzVoxelSubs;
-    auto findNonZeroVoxels = [&](const NIBR::MT::TASK& task)->void {
-        
-        int64_t i   = task.no;
-        
-        for (int64_t j=0; j<img->imgDims[1]; j++)
-            for (int64_t k=0; k<img->imgDims[2]; k++)
-                for (int64_t t=0; t<img->imgDims[3]; t++) {
-
-                    if (img->data[img->sub2ind(i,j,k,t)]!=0){
-                        std::vector<int64_t> tmp{i,j,k};
-                        std::lock_guard lock(modifier);
-                        nnzVoxelSubs.push_back(tmp);
-                        break;
-                    }
-                    
-                }
-        
-    };
-    NIBR::MT::MTRUN(img->imgDims[0],"Finding non-zero voxels",findNonZeroVoxels);
+    std::vector<int64_t> nnzVoxels = getNonZero3DVoxelIndices(img);
 
     float scale = (4.0 * PI) / float(coords.size());
 
-    // Apply spherical harmonics synthesis and then expansion
-    auto reorient = [&](const NIBR::MT::TASK& task)->void {
-        
-        std::vector<int64_t> sub = nnzVoxelSubs[task.no];
+    // Synthesis with sh is not linear because negative amplitudes are set to 0. So synthesis with the unclamped basis of sh,
+    // clamping and then expansion are applied one after another.
+    Eigen::MatrixXf synthesis(valueCount, coeffCount);
 
-        float* coeffs  = new float[coeffCount];
-        float* values  = new float[valueCount];
+    NIBR::MT::MTRUN(valueCount, [&](const NIBR::MT::TASK& task)->void {
+        std::vector<float> B(coeffCount);
+        float dir[3] = {coords[task.no][0],coords[task.no][1],coords[task.no][2]};
+        sh.basis(B.data(),&dir[0]);
+        for (int n=0; n<coeffCount; n++)
+            synthesis(task.no,n) = B[n];
+    });
 
-        for (int n=0; n<coeffCount; n++) {
-            coeffs[n] = img->data[img->sub2ind(sub[0],sub[1],sub[2],int64_t(n))];
-        }
+    Eigen::MatrixXf expansion = scale * toEigen(Ylm).transpose();
 
-        for (int t=0; t<valueCount; t++) {
-            float dir[3] = {coords[t][0],coords[t][1],coords[t][2]};
-            values[t]    = sh.toSF(coeffs,&dir[0]);
-        }
-        
-        for (int n=0; n<coeffCount; n++) {
-            img->data[img->sub2ind(sub[0],sub[1],sub[2],int64_t(n))] = 0;
-            for (int t=0; t<valueCount; t++)
-                img->data[img->sub2ind(sub[0],sub[1],sub[2],int64_t(n))] += scale * Ylm[t][n] * values[t];
-        }
+    std::vector<int64_t> offsets = getVolumeOffsets(img,nnzVoxels);
 
-        delete[] coeffs;
-        delete[] values;
-
-    };
-    NIBR::MT::MTRUN(nnzVoxelSubs.size(),"Reorienting spherical harmonics",reorient);
+    disp(MSG_DETAIL,"Reorienting spherical harmonics");
+    applyClampedMatrixAlongVolumes(synthesis, &expansion, img->data, offsets, img->s2i[3], img->data, offsets, img->s2i[3]);
 
 }
 
@@ -293,63 +297,17 @@ void NIBR::rotateSH(NIBR::Image<float>* img, float R[][4])
     SH_basis(inp_Ylm, inp_coords, shOrder, ignoreOddCoeffs);
     SH_basis(out_Ylm, out_coords, shOrder, ignoreOddCoeffs);
 
-    int coeffCount = img->imgDims[3];
-    int valueCount = out_coords.size();
-
-    std::mutex modifier;
-
     // We will find and only process those voxels which have non-zero values
-    std::vector<std::vector<int64_t>> nnzVoxelSubs;
-    auto findNonZeroVoxels = [&](const NIBR::MT::TASK& task)->void {
-        
-        int64_t i   = task.no;
-        
-        for (int64_t j=0; j<img->imgDims[1]; j++)
-            for (int64_t k=0; k<img->imgDims[2]; k++)
-                for (int64_t t=0; t<img->imgDims[3]; t++) {
-
-                    if (img->data[img->sub2ind(i,j,k,t)]!=0){
-                        std::vector<int64_t> tmp{i,j,k};
-                        std::lock_guard lock(modifier);
-                        nnzVoxelSubs.push_back(tmp);
-                        break;
-                    }
-                    
-                }
-        
-    };
-    NIBR::MT::MTRUN(img->imgDims[0],"Finding non-zero voxels",findNonZeroVoxels);
+    std::vector<int64_t> nnzVoxels = getNonZero3DVoxelIndices(img);
 
     float scale = (4.0 * PI) / float(inp_coords.size());
 
-    // Apply spherical harmonics synthesis and then expansion
-    auto reorient = [&](const NIBR::MT::TASK& task)->void {
-        
-        std::vector<int64_t> sub = nnzVoxelSubs[task.no];
-
-        float* coeffs  = new float[coeffCount];
-        float* values  = new float[valueCount];
+    // Synthesis with inp_Ylm and then expansion with out_Ylm are combined into a single coefficients x coefficients matrix
+    Eigen::MatrixXf M = scale * (toEigen(out_Ylm).transpose() * toEigen(inp_Ylm));
 
-        for (int n=0; n<coeffCount; n++) {
-            coeffs[n] = img->data[img->sub2ind(sub[0],sub[1],sub[2],int64_t(n))];
-        }
+    std::vector<int64_t> offsets = getVolumeOffsets(img,nnzVoxels);
 
-        for (int t=0; t<valueCount; t++) {
-            values[t] = 0;
-            for (int n=0; n<coeffCount; n++)
-                values[t] += scale * inp_Ylm[t][n]*coeffs[n];
-        }
-        
-        for (int n=0; n<coeffCount; n++) {
-            img->data[img->sub2ind(sub[0],sub[1],sub[2],int64_t(n))] = 0;
-            for (int t=0; t<valueCount; t++)
-                img->data[img->sub2ind(sub[0],sub[1],sub[2],int64_t(n))] += out_Ylm[t][n] * values[t];
-        }
+    disp(MSG_DETAIL,"Rotating spherical harmonics");
+    applyMatrixAlongVolumes(M, img->data, offsets, img->s2i[3], img->data, offsets, img->s2i[3]);
 
-        delete[] coeffs;
-        delete[] values;
-
-    };
-    NIBR::MT::MTRUN(nnzVoxelSubs.size(),"Rotating spherical harmonics",reorient);
-
-}
\ No newline at end of file
+}
@@ -3,12 +3,14 @@
 #include "base/nibr.h"
 #include "image/image.h"
 #include "image/image_math.h"
+#include "image/image_filter.h"
 #include "math/sphericalFunctions.h"
 #include "math/sphericalHarmonics.h"
 #include "math/reorient.h"
 #include "math/conn3D.h"
 #include <cstdint>
 #include <tuple>
+#include <Eigen/Core>
 
 typedef unsigned int uint;
 
@@ -18,6 +20,15 @@ namespace NIBR
     void sf2sh(NIBR::Image<float>* out, NIBR::Image<float>* inp, std::vector<Point3D>& coords, int shOrder, bool ignoreOddCoeffs);
     void sh2sf(NIBR::Image<float>* out, NIBR::Image<float>* inp, std::vector<Point3D>& coords);
 
+    // For each voxel n, applies M on the values along the 4th dimension, i.e.,
+    // out[outOffsets[n] + r*outStride] = sum_c M(r,c) * inp[inpOffsets[n] + c*inpStride]
+    // Voxels are processed in blocks, where each block is a single matrix-matrix product. inp and out can be the same array.
+    void applyMatrixAlongVolumes(const Eigen::MatrixXf& M, const float* inp, const std::vector<int64_t>& inpOffsets, int64_t inpStride, float* out, const std::vector<int64_t>& outOffsets, int64_t outStride);
+
+    // Same as above, but negative values after M1 are set to 0 and M2 is applied after that, i.e., out = M2 * max(M1 * inp, 0).
+    // If M2 is NULL, out = max(M1 * inp, 0).
+    void applyClampedMatrixAlongVolumes(const Eigen::MatrixXf& M1, const Eigen::MatrixXf* M2, const float* inp, const std::vector<int64_t>& inpOffsets, int64_t inpStride, float* out, const std::vector<int64_t>& outOffsets, int64_t outStride);
+
     void reorientSH(NIBR::Image<float>* img, OrderOfDirections ood);
     void rotateSH(NIBR::Image<float>* img, float R[][4]);
 
@@ -186,6 +197,35 @@ namespace NIBR
         // disp(MSG_DETAIL,"Number of non-zero voxels: %d", subs.size());
         return subs;
 
+    }
+
+    // Returns the 3D indices, i.e. i + j*imgDims[0] + k*imgDims[0]*imgDims[1], of the voxels that have a non-zero value in any volume.
+    // Slices are scanned in parallel, and the indices are returned in increasing order.
+    template<typename T>
+    std::vector<int64_t> getNonZero3DVoxelIndices(NIBR::Image<T>* img) {
+
+        std::vector<std::vector<int64_t>> perSlice(img->imgDims[2]);
+
+        NIBR::MT::MTRUN(img->imgDims[2], [&](const NIBR::MT::TASK& task)->void {
+            int64_t k = task.no;
+            for (int64_t j=0; j<img->imgDims[1]; j++) {
+                for (int64_t i=0; i<img->imgDims[0]; i++) {
+                    for (int64_t t=0; t<img->imgDims[3]; t++) {
+                        if (img->data[img->sub2ind(i,j,k,t)] != 0) {
+                            perSlice[k].push_back(i + j*img->imgDims[0] + k*img->imgDims[0]*img->imgDims[1]);
+                            break;
+                        }
+                    }
+                }
+            }
+        });
+
+        std::vector<int64_t> inds;
+        for (auto& slice : perSlice) {
+            inds.insert(inds.end(),slice.begin(),slice.end());
+        }
+        return inds;
+
     }
     // -------------------------------
 
@@ -193,8 +233,17 @@ namespace NIBR
 
     // -----RESAMPLE AN IMAGE---
     // This function is NOT tested. Use with care.
+    // Axis-aligned scaling and shifting, e.g., between grids that only differ in resolution, is done with separable weights.
     template<typename T1,typename T2, typename T_OUT>
     void imgResample(NIBR::Image<T_OUT>* imgOut,NIBR::Image<T1>* img, T2 M) {
+
+        double Md[3][4];
+        for (int i=0; i<3; i++)
+            for (int j=0; j<4; j++)
+                Md[i][j] = M[i][j];
+
+        if (imgResampleAxisAligned(imgOut,img,Md))
+            return;
         
         auto f = [&](const NIBR::MT::TASK& task)->void {
             
@@ -216,6 +265,11 @@ namespace NIBR
 
     template<typename T_INP, typename T_OUT>
     void imgResample(NIBR::Image<T_OUT>* imgOut,NIBR::Image<T_INP>* img) {
+
+        const double I[3][4] = {{1,0,0,0},{0,1,0,0},{0,0,1,0}};
+
+        if (imgResampleAxisAligned(imgOut,img,I))
+            return;
         
         auto f = [&](const NIBR::MT::TASK& task)->void {
             
@@ -3,6 +3,16 @@
 #include <cstdint>
 #include <ostream>
 #include <vector>
+#include <future>
+#include <memory>
+#include <functional>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #if defined(HAS_DCM2NIIX)
 #include "dcm2niix++.h"
@@ -39,83 +49,187 @@ bool NIBR::Image<T>::read() {
     return false;
 }
 
+#define IMAGE_CONVERT_BLOCK_SIZE 65536             // number of values converted by a single task
+#define IMAGE_READ_CHUNK_SIZE    (64*1024*1024)     // bytes read from file at once
+
+// Converts the n input values that start at the linear input index beg, where the input is in the standard
+// order, i.e. i is the fastest changing index. Values are byte swapped, scaled and written directly to their
+// final place in out. Blocks of values are processed in parallel. outIndexOrder == NULL means no reindexing.
 template <typename OUT_T,typename INP_T>
-void convert(OUT_T* out, void* inp, int64_t* imgDims, float dataScaler, float dataOffset, bool swapByte)
+void convertRange(OUT_T* out, void* inp, int64_t beg, int64_t n, int64_t* imgDims, int* outIndexOrder, float dataScaler, float dataOffset, bool swapByte)
 {
 
-    // disp(MSG_DEBUG,"OUT_T: %s", typeid(OUT_T).name());
-    // disp(MSG_DEBUG,"INP_T: %s", typeid(INP_T).name());
-    // disp(MSG_DEBUG,"dataScaler: %.6f", dataScaler);
-    // disp(MSG_DEBUG,"dataOffset: %.6f", dataOffset);
-    // disp(MSG_DEBUG,"swapByte:   %d",   int(swapByte));
+    int64_t outS2i[7];
 
-    int64_t numel = 1;
-    for (auto i=0; i<7; i++) numel *= imgDims[i];
+    for (int i=0; i<7; i++)
+        outS2i[i] = 1;
 
-    for (auto i=0; i<numel; i++) {
-        if (swapByte) swapByteOrder(*((INP_T*)inp+i));
-        out[i] = *((INP_T*)inp+i);
+    if (outIndexOrder!=NULL) {
+        for (int i=1; i<7; i++)
+            for (int j=0; j<i; j++) {
+                outS2i[outIndexOrder[i]] *= imgDims[outIndexOrder[j]];
+            }
     }
 
     bool scaleData = ( (dataScaler==0) || ((dataScaler==1) && (dataOffset==0)) ) ? false : true;
-    if (scaleData) {
-        for (auto i=0; i<numel; i++)
-            out[i] = dataScaler*out[i] + dataOffset;
-    }
+
+    int64_t blockCnt = (n + IMAGE_CONVERT_BLOCK_SIZE - 1) / IMAGE_CONVERT_BLOCK_SIZE;
+
+    NIBR::MT::MTRUN(blockCnt, [&](const NIBR::MT::TASK& task)->void {
+
+        int64_t blockBeg = task.no * IMAGE_CONVERT_BLOCK_SIZE;
+        int64_t blockEnd = std::min(blockBeg + IMAGE_CONVERT_BLOCK_SIZE, n);
+
+        // Subscripts of the first value in the block, which are then incremented with carry
+        int64_t sub[7];
+        int64_t ind = beg + blockBeg;
+        for (int d=0; d<7; d++) {
+            sub[d] = ind % imgDims[d];
+            ind   /= imgDims[d];
+        }
+
+        int64_t outInd = 0;
+        for (int d=0; d<7; d++)
+            outInd += sub[d]*outS2i[d];
+
+        for (int64_t m=blockBeg; m<blockEnd; m++) {
+
+            INP_T val = *((INP_T*)inp+m);
+            if (swapByte) swapByteOrder(val);
+
+            OUT_T tmp = val;
+            if (scaleData) tmp = dataScaler*tmp + dataOffset;
+
+            out[(outIndexOrder!=NULL) ? outInd : (beg + m)] = tmp;
+
+            if (outIndexOrder!=NULL) {
+                for (int d=0; d<7; d++) {
+                    sub[d]++;
+                    outInd += outS2i[d];
+                    if (sub[d] < imgDims[d]) break;
+                    outInd -= sub[d]*outS2i[d];
+                    sub[d]  = 0;
+                }
+            }
+
+        }
+
+    });
 
 }
 
 template <typename OUT_T,typename INP_T>
-void convert(OUT_T* out, void* inp, int64_t* imgDims, int* outIndexOrder, float dataScaler, float dataOffset, bool swapByte)
+void convert(OUT_T* out, void* inp, int64_t* imgDims, float dataScaler, float dataOffset, bool swapByte)
 {
+    int64_t numel = 1;
+    for (auto i=0; i<7; i++) numel *= imgDims[i];
 
-    // disp(MSG_DEBUG,"OUT_T: %s", typeid(OUT_T).name());
-    // disp(MSG_DEBUG,"INP_T: %s", typeid(INP_T).name());
-    // disp(MSG_DEBUG,"dataScaler: %.6f", dataScaler);
-    // disp(MSG_DEBUG,"dataOffset: %.6f", dataOffset);
-    // disp(MSG_DEBUG,"swapByte:   %d",   int(swapByte));
+    convertRange<OUT_T,INP_T>(out,inp,0,numel,imgDims,NULL,dataScaler,dataOffset,swapByte);
+}
 
-    int64_t outS2i[7];
+template <typename OUT_T,typename INP_T>
+void convert(OUT_T* out, void* inp, int64_t* imgDims, int* outIndexOrder, float dataScaler, float dataOffset, bool swapByte)
+{
     int64_t numel = 1;
+    for (auto i=0; i<7; i++) numel *= imgDims[i];
 
-    for (int i=0; i<7; i++) {
-        outS2i[i]      = 1;
-        numel         *= imgDims[i];
-    }
+    convertRange<OUT_T,INP_T>(out,inp,0,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);
+}
 
-    for (int i=1; i<7; i++)
-        for (int j=0; j<i; j++) {
-            outS2i[outIndexOrder[i]] *= imgDims[outIndexOrder[j]];
+// Reads numel values with readFunc in chunks and converts them into out, so the raw data is never held in memory all at once.
+// While a chunk is converted in parallel, the next one is read (and decompressed) in the background.
+template <typename OUT_T,typename INP_T>
+bool readAndConvert(OUT_T* out, std::function<size_t(void*, size_t, size_t)>& readFunc, int64_t numel, int64_t* imgDims, int* outIndexOrder, float dataScaler, float dataOffset, bool swapByte)
+{
+
+    int64_t chunkSize = std::max(int64_t(1), int64_t(IMAGE_READ_CHUNK_SIZE / sizeof(INP_T)));
+    chunkSize         = std::min(chunkSize, numel);
+
+    // INP_T can be bool, so std::vector<INP_T> is not used
+    std::unique_ptr<INP_T[]> buffer[2];
+    buffer[0].reset(new INP_T[chunkSize]);
+    buffer[1].reset(new INP_T[chunkSize]);
+
+    auto readChunk = [&](int b, int64_t beg)->bool {
+        size_t cnt = std::min(chunkSize, numel - beg);
+        return readFunc((void*)buffer[b].get(), sizeof(INP_T), cnt) == cnt;
+    };
+
+    if (!readChunk(0,0)) return false;
+
+    int cur = 0;
+
+    for (int64_t beg = 0; beg < numel; beg += chunkSize) {
+
+        int64_t next = beg + chunkSize;
+
+        std::future<bool> nextIsRead;
+        if (next < numel) {
+            nextIsRead = std::async(std::launch::async, readChunk, 1-cur, next);
         }
 
-    
-    int64_t ind = 0;
-    for (auto o=0; o<imgDims[6]; o++)
-        for (auto n=0; n<imgDims[5]; n++)
-            for (auto m=0; m<imgDims[4]; m++)
-                for (auto l=0; l<imgDims[3]; l++)
-                    for (auto k=0; k<imgDims[2]; k++)
-                        for (auto j=0; j<imgDims[1]; j++)
-                            for (auto i=0; i<imgDims[0]; i++) {
-                                if (swapByte) swapByteOrder(*((INP_T*)inp+ind));
-                                out[i*outS2i[0]  + 
-                                    j*outS2i[1]  + 
-                                    k*outS2i[2]  + 
-                                    l*outS2i[3]  + 
-                                    m*outS2i[4]  + 
-                                    n*outS2i[5]  + 
-                                    o*outS2i[6]] = 
-                                *((INP_T*)inp+ind++);
-                            }
+        convertRange<OUT_T,INP_T>(out, (void*)buffer[cur].get(), beg, std::min(chunkSize, numel - beg), imgDims, outIndexOrder, dataScaler, dataOffset, swapByte);
 
+        if (next < numel) {
+            if (!nextIsRead.get()) return false;
+        }
 
+        cur = 1-cur;
 
-    bool scaleData = ( (dataScaler==0) || ((dataScaler==1) && (dataOffset==0)) ) ? false : true;
-    if (scaleData) {
-        for (int64_t i=0; i<numel; i++)
-            out[i] = dataScaler*out[i] + dataOffset;
     }
 
+    return true;
+
+}
+
+template<typename T>
+bool NIBR::Image<T>::map_nii(nifti_image* nim, bool reIdx, bool swapByte) {
+
+#ifndef _WIN32
+
+    // Mapped data must be usable as is
+    if (reIdx || swapByte || (inputDataType != dataType) || (dataType == BOOL_DT))
+        return false;
+
+    if ( (dataScaler != 0) && ((dataScaler != 1) || (dataOffset != 0)) )
+        return false;
+
+    if (nifti_is_gzfile(nim->iname) || (nim->iname_offset < 0) || ((nim->iname_offset % alignof(T)) != 0))
+        return false;
+
+    int fd = open(nim->iname, O_RDONLY);
+    if (fd < 0) return false;
+
+    size_t dataBeg = nim->iname_offset;
+    size_t dataLen = numel*sizeof(T);
+
+    struct stat st;
+    if ( (fstat(fd,&st) != 0) || (size_t(st.st_size) < dataBeg + dataLen) ) {
+        close(fd);
+        return false;
+    }
+
+    // MAP_PRIVATE makes writes copy-on-write, so data can be modified without touching the file
+    void* region = mmap(NULL, dataBeg + dataLen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (region == MAP_FAILED)
+        return false;
+
+    mappedRegion  = region;
+    mappedLength  = dataBeg + dataLen;
+    mappedFile[0] = st.st_dev;
+    mappedFile[1] = st.st_ino;
+    addMappedImageFile(mappedFile[0],mappedFile[1]);
+
+    data = (T*)((char*)region + dataBeg);
+
+    return true;
+
+#else
+    return false;
+#endif
+
 }
 
 template<typename T>
@@ -123,47 +237,117 @@ bool NIBR::Image<T>::read_nii() {
 
     nifti_image* nim = nifti_image_read(filePath.c_str(),0);
 
-    if (nifti_image_load(nim)==-1) {
+    if (nim==NULL) {
         disp(MSG_FATAL,"Cannot read nifti image: %s",filePath.c_str());
         return false;
     }
 
-
-    data = new T[numel]();
-    // data = (T*) malloc(numel*sizeof(T));
-
     bool reIdx = false;
     for (int i=1; i<7; i++)
         if (indexOrder[i] != i)
             reIdx = true;
 
+    // ASCII files are loaded by niftilib as a whole and then converted
+    if (nim->nifti_type == NIFTI_FTYPE_ASCII) {
+
+        if (nifti_image_load(nim)==-1) {
+            nifti_image_free(nim);
+            disp(MSG_FATAL,"Cannot read nifti image: %s",filePath.c_str());
+            return false;
+        }
+
+        data = new T[numel]();
+
+        switch (inputDataType) {
+            case BOOL_DT:          reIdx ? convert<T,bool>       (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,bool>       (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case UINT8_DT:         reIdx ? convert<T,uint8_t>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,uint8_t>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case INT8_DT:          reIdx ? convert<T,int8_t>     (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,int8_t>     (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case UINT16_DT:        reIdx ? convert<T,uint16_t>   (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,uint16_t>   (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case INT16_DT:         reIdx ? convert<T,int16_t>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,int16_t>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case UINT32_DT:        reIdx ? convert<T,uint32_t>   (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,uint32_t>   (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case INT32_DT:         reIdx ? convert<T,int32_t>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,int32_t>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case UINT64_DT:        reIdx ? convert<T,uint64_t>   (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,uint64_t>   (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case INT64_DT:         reIdx ? convert<T,int64_t>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,int64_t>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case FLOAT32_DT:       reIdx ? convert<T,float>      (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,float>      (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case FLOAT64_DT:       reIdx ? convert<T,double>     (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,double>     (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            case FLOAT128_DT:      reIdx ? convert<T,long double>(data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,long double>(data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+            default:
+                nifti_image_free(nim);
+                disp(MSG_FATAL,"Can't read nifti file. Unknown datatype");
+                return false;
+        }
+
+        nifti_image_free(nim);
+        return true;
+    }
+
+    bool swapByte = (nim->byteorder != nifti_short_order());
+
+    if (map_nii(nim,reIdx,swapByte)) {
+        disp(MSG_DETAIL,"Memory mapped image data: %s",nim->iname);
+        nifti_image_free(nim);
+        return true;
+    }
+
+    // Otherwise the data is streamed from the image file, which is either nii, nii.gz or img.
+    // zlib reads uncompressed files transparently.
+    gzFile gzfp = gzopen(nim->iname, "rb");
+
+    if (!gzfp) {
+        disp(MSG_FATAL,"Cannot open nifti image data: %s",nim->iname);
+        nifti_image_free(nim);
+        return false;
+    }
+
+    gzbuffer(gzfp, 1024*1024);
+
+    if (gzseek(gzfp, nim->iname_offset, SEEK_SET) < 0) {
+        disp(MSG_FATAL,"Cannot read nifti image: %s",filePath.c_str());
+        gzclose(gzfp);
+        nifti_image_free(nim);
+        return false;
+    }
+
+    nifti_image_free(nim);
+
+    std::function<size_t(void*, size_t, size_t)> readFunc = [gzfp](void* ptr, size_t size, size_t nmemb) -> size_t {
+        auto byteCnt = gzread(gzfp, ptr, size * nmemb); return (byteCnt < 0) ? 0 : byteCnt/size;
+    };
+
+    data = new T[numel]();
+
+    int* outIndexOrder = reIdx ? indexOrder : NULL;
+    bool isRead        = false;
+
     switch (inputDataType) {
  
-        case BOOL_DT:          reIdx ? convert<T,bool>       (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,bool>       (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case UINT8_DT:         reIdx ? convert<T,uint8_t>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,uint8_t>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case INT8_DT:          reIdx ? convert<T,int8_t>     (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,int8_t>     (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case UINT16_DT:        reIdx ? convert<T,uint16_t>   (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,uint16_t>   (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case INT16_DT:         reIdx ? convert<T,int16_t>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,int16_t>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case UINT32_DT:        reIdx ? convert<T,uint32_t>   (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,uint32_t>   (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case INT32_DT:         reIdx ? convert<T,int32_t>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,int32_t>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case UINT64_DT:        reIdx ? convert<T,uint64_t>   (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,uint64_t>   (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case INT64_DT:         reIdx ? convert<T,int64_t>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,int64_t>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case FLOAT32_DT:       reIdx ? convert<T,float>      (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,float>      (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case FLOAT64_DT:       reIdx ? convert<T,double>     (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,double>     (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        case FLOAT128_DT:      reIdx ? convert<T,long double>(data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,long double>(data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
+        case BOOL_DT:          isRead = readAndConvert<T,bool>       (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case UINT8_DT:         isRead = readAndConvert<T,uint8_t>    (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case INT8_DT:          isRead = readAndConvert<T,int8_t>     (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case UINT16_DT:        isRead = readAndConvert<T,uint16_t>   (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case INT16_DT:         isRead = readAndConvert<T,int16_t>    (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case UINT32_DT:        isRead = readAndConvert<T,uint32_t>   (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case INT32_DT:         isRead = readAndConvert<T,int32_t>    (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case UINT64_DT:        isRead = readAndConvert<T,uint64_t>   (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case INT64_DT:         isRead = readAndConvert<T,int64_t>    (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case FLOAT32_DT:       isRead = readAndConvert<T,float>      (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case FLOAT64_DT:       isRead = readAndConvert<T,double>     (data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
+        case FLOAT128_DT:      isRead = readAndConvert<T,long double>(data,readFunc,numel,imgDims,outIndexOrder,dataScaler,dataOffset,swapByte);    break;
 
         // TODO: Implement converters for complex data types
-        // case COMPLEX64:     reIdx ? convert<T,std::complex<double>)>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,std::complex<double>>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        // case COMPLEX128:    reIdx ? convert<T,std::complex<long double>)>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,std::complex<long double>>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
-        // case COMPLEX256:    reIdx ? convert<T,std::complex<long long double>)>    (data,nim->data,imgDims,indexOrder,dataScaler,dataOffset,false) : convert<T,std::complex<long long double>>    (data,nim->data,imgDims,dataScaler,dataOffset,false);    break;
 
         default:
-            nifti_image_free(nim);
+            gzclose(gzfp);
             disp(MSG_FATAL,"Can't read nifti file. Unknown datatype");
-            break;
+            return false;
     }
 
-    nifti_image_free(nim);
+    gzclose(gzfp);
+
+    if (!isRead) {
+        disp(MSG_FATAL,"Cannot read nifti image: %s",filePath.c_str());
+        return false;
+    }
 
     return true;
 }
@@ -204,44 +388,29 @@ bool NIBR::Image<T>::read_mghz() {
         if (indexOrder[i] != i)
             reIdx = true;
 
-    // Read image data
-    void* inpBuffer = NULL;
-
+    // Read image data, which is streamed in chunks and converted directly into data
     auto run_reader = [&](auto t)->bool {
 
-        inpBuffer = (void*)(new decltype(t)[numel]);
-
-        if (inpBuffer==NULL) {
-            disp(MSG_ERROR, "Failed to allocate memory for raw image data");
-            if (gzfp!=NULL) gzclose(gzfp);
-            if (fp!=NULL)   fclose(fp);
-            return false;
-        }
-
-        if (readFunc(inpBuffer, sizeof(decltype(t)), numel) != size_t(numel)) {
-            disp(MSG_ERROR, "Failed to read the correct amount of image data");
-            delete[] reinterpret_cast<decltype(t)*>(inpBuffer);
-            if (gzfp!=NULL) gzclose(gzfp);
-            if (fp!=NULL)   fclose(fp);
-            return false;
-        }
-
         data = new T[numel]();
         // data = (T*) malloc(numel*sizeof(T));
 
         if (data==NULL) {
             disp(MSG_ERROR, "Failed to allocate memory for image");
-            delete[] reinterpret_cast<decltype(t)*>(inpBuffer);
             if (gzfp!=NULL) gzclose(gzfp);
             if (fp!=NULL)   fclose(fp);
             return false;
         }
 
-        reIdx ? convert<T,decltype(t)>    (data,inpBuffer,imgDims,indexOrder,dataScaler,dataOffset,true) : convert<T,decltype(t)>    (data,inpBuffer,imgDims,dataScaler,dataOffset,true);
+        bool isRead = readAndConvert<T,decltype(t)>(data,readFunc,numel,imgDims,reIdx ? indexOrder : NULL,dataScaler,dataOffset,true);
 
-        delete[] reinterpret_cast<decltype(t)*>(inpBuffer);
         if (gzfp!=NULL) gzclose(gzfp);
         if (fp!=NULL)   fclose(fp);
+
+        if (!isRead) {
+            disp(MSG_ERROR, "Failed to read the correct amount of image data");
+            return false;
+        }
+
         return true;
 
     };
@@ -1,31 +1,11 @@
 #include "image_transform.h"
 #include "fast-marching-method/fast_marching_method.hpp"
+#include <cmath>
 
 using namespace NIBR;
 
 namespace fmm = thinks::fast_marching_method;
 
-template <typename T>
-std::pair<std::vector<std::array<int32_t, 3>>,std::vector<float>> img2fmmArrays(NIBR::Image<T>* img) 
-{
-    std::vector<std::array<int32_t, 3>> subs;
-
-    int64_t i,j,k;
-
-    for (int n=0; n<img->numel; n++) {
-        if (img->data[n]==0) {
-            img->ind2sub(n,i,j,k);
-            subs.push_back({int32_t(i),int32_t(j),int32_t(k)});
-        }
-    }
-
-    std::vector<float> dists(subs.size(),0.0f);
-    return std::make_pair(subs,dists);
-}
-
-template std::pair<std::vector<std::array<int32_t, 3>>,std::vector<float>> img2fmmArrays<int> (NIBR::Image<int>*  img);  // explicit instantiation for int
-template std::pair<std::vector<std::array<int32_t, 3>>,std::vector<float>> img2fmmArrays<bool>(NIBR::Image<bool>* img);  // explicit instantiation for bool
-
 std::pair<std::vector<std::array<int32_t, 3>>,std::vector<float>> img2fmmArrays(NIBR::Image<float>* img) 
 {
     std::vector<std::array<int32_t, 3>> subs;
@@ -91,12 +71,206 @@ void wrapImgEDT(NIBR::Image<T>* inp)
     }
 }
 
-template void wrapImgEDT<int>  (NIBR::Image<int>*   inp,  NIBR::Image<float>* out);  // explicit instantiation for int
-template void wrapImgEDT<bool> (NIBR::Image<bool>*  inp,  NIBR::Image<float>* out);  // explicit instantiation for bool
 template void wrapImgEDT<float>(NIBR::Image<float>* inp,  NIBR::Image<float>* out);  // explicit instantiation for float
 template void wrapImgEDT<float>(NIBR::Image<float>* inp);
 
-void NIBR::imgEDT(NIBR::Image<bool>*  inp, NIBR::Image<float>* out) {wrapImgEDT(inp, out);}
-void NIBR::imgEDT(NIBR::Image<int>*   inp, NIBR::Image<float>* out) {wrapImgEDT(inp, out);}
+// Exact EDT of binary images
+namespace {
+
+    // 1D squared distance transform with samples at spacing s. f is INFINITY where there is no feature.
+    // The lower envelope of the parabolas s^2*(q-v)^2 + f[v] is built and sampled in linear time.
+    // arg is the location of the minimum, or -1 if there are no features. v and z are workspace of size n and n+1.
+    void edt1D(const float* f, int64_t n, double s, float* d, int64_t* arg, int64_t* v, double* z)
+    {
+        const double s2 = s*s;
+        int64_t      k  = -1;
+
+        for (int64_t q=0; q<n; q++) {
+
+            if (std::isinf(f[q])) continue;
+
+            if (k<0) {
+                k    = 0;
+                v[0] = q;
+                z[0] = -INFINITY;
+                z[1] =  INFINITY;
+                continue;
+            }
+
+            double x;
+            while (true) {
+                x = ((f[q] + s2*q*q) - (f[v[k]] + s2*v[k]*v[k])) / (2*s2*(q - v[k]));
+                if (x > z[k]) break;
+                k--;
+            }
+
+            k++;
+            v[k]   = q;
+            z[k]   = x;
+            z[k+1] = INFINITY;
+        }
+
+        if (k<0) {
+            for (int64_t q=0; q<n; q++) {
+                d[q]   = INFINITY;
+                arg[q] = -1;
+            }
+            return;
+        }
+
+        k = 0;
+        for (int64_t q=0; q<n; q++) {
+            while (z[k+1] < q) k++;
+            d[q]   = s2*(q-v[k])*(q-v[k]) + f[v[k]];
+            arg[q] = v[k];
+        }
+    }
+
+    // feature has voxCnt values in the standard 3D order. Computes the squared distance to the nearest feature voxel
+    // and, if nearest is not NULL, its index. Rows along x are done with two sweeps, then the y and z passes are done
+    // in parallel over slabs of lines.
+    void squaredEDT(const std::vector<uint8_t>& feature, const int64_t* dims, const float* pixDims, std::vector<float>& sqDist, std::vector<int64_t>* nearest)
+    {
+
+        const int64_t nx = dims[0], ny = dims[1], nz = dims[2];
+
+        sqDist.assign(nx*ny*nz, INFINITY);
+        if (nearest) nearest->assign(nx*ny*nz, -1);
+
+        NIBR::MT::MTRUN(ny*nz, [&](const NIBR::MT::TASK& task)->void {
+
+            const int64_t base = task.no*nx;
+            const double  sx   = pixDims[0];
+
+            int64_t last = -1;
+            for (int64_t i=0; i<nx; i++) {
+                if (feature[base+i]) last = i;
+                if (last >= 0) {
+                    sqDist[base+i] = sx*sx*(i-last)*(i-last);
+                    if (nearest) (*nearest)[base+i] = base+last;
+                }
+            }
+
+            last = -1;
+            for (int64_t i=nx-1; i>=0; i--) {
+                if (feature[base+i]) last = i;
+                if (last >= 0) {
+                    float d = sx*sx*(last-i)*(last-i);
+                    if (d < sqDist[base+i]) {
+                        sqDist[base+i] = d;
+                        if (nearest) (*nearest)[base+i] = base+last;
+                    }
+                }
+            }
+
+        });
+
+        // Lines of length n with the given stride. Slab m has the nx lines that start at m*slabStride + i.
+        auto pass = [&](int64_t n, int64_t stride, double s, int64_t slabCnt, int64_t slabStride) {
+
+            NIBR::MT::MTRUN(slabCnt, [&](const NIBR::MT::TASK& task)->void {
+
+                std::vector<float>   f(n), d(n);
+                std::vector<int64_t> arg(n), v(n), near(n);
+                std::vector<double>  z(n+1);
+
+                for (int64_t i=0; i<nx; i++) {
+
+                    const int64_t base = task.no*slabStride + i;
+
+                    for (int64_t q=0; q<n; q++) {
+                        f[q] = sqDist[base + q*stride];
+                        if (nearest) near[q] = (*nearest)[base + q*stride];
+                    }
+
+                    edt1D(f.data(), n, s, d.data(), arg.data(), v.data(), z.data());
+
+                    for (int64_t q=0; q<n; q++) {
+                        sqDist[base + q*stride] = d[q];
+                        if (nearest) (*nearest)[base + q*stride] = (arg[q] < 0) ? -1 : near[arg[q]];
+                    }
+
+                }
+
+            });
+
+        };
+
+        pass(ny, nx,    pixDims[1], nz, nx*ny);
+        pass(nz, nx*ny, pixDims[2], ny, nx);
+
+    }
+
+    // Feature voxels are the nonzero voxels, or the zero voxels if invert is true
+    template <typename T>
+    std::vector<uint8_t> getFeatures(NIBR::Image<T>* img, bool invert)
+    {
+        std::vector<uint8_t> feature(img->voxCnt);
+
+        NIBR::MT::MTRUN(img->imgDims[2], [&](const NIBR::MT::TASK& task)->void {
+            const int64_t k = task.no;
+            for (int64_t j=0; j<img->imgDims[1]; j++)
+                for (int64_t i=0; i<img->imgDims[0]; i++)
+                    feature[i + img->imgDims[0]*(j + img->imgDims[1]*k)] = ((img->data[img->sub2ind(i,j,k)] != 0) != invert);
+        });
+
+        return feature;
+    }
+
+    template <typename T>
+    void exactEDT(NIBR::Image<T>* inp, NIBR::Image<float>* out, NIBR::Image<int64_t>* nearest, bool toBackground)
+    {
+        std::vector<float>   sqDist;
+        std::vector<int64_t> near;
+
+        squaredEDT(getFeatures(inp,toBackground), inp->imgDims, inp->pixDims, sqDist, (nearest==NULL) ? NULL : &near);
+
+        out->createFromTemplate(*inp,true);
+        if (nearest) nearest->createFromTemplate(*inp,true);
+
+        NIBR::MT::MTRUN(inp->imgDims[2], [&](const NIBR::MT::TASK& task)->void {
+            const int64_t k = task.no;
+            for (int64_t j=0; j<inp->imgDims[1]; j++)
+                for (int64_t i=0; i<inp->imgDims[0]; i++) {
+                    int64_t n = i + inp->imgDims[0]*(j + inp->imgDims[1]*k);
+                    out->data[out->sub2ind(i,j,k)] = std::sqrt(sqDist[n]);
+                    if (nearest) nearest->data[nearest->sub2ind(i,j,k)] = near[n];
+                }
+        });
+    }
+
+    template <typename T>
+    void signedEDT(NIBR::Image<T>* inp, NIBR::Image<float>* out)
+    {
+        std::vector<uint8_t> fg = getFeatures(inp,false);
+        std::vector<uint8_t> bg(fg.size());
+        for (size_t n=0; n<fg.size(); n++) bg[n] = !fg[n];
+
+        std::vector<float> dIn, dOut;
+        squaredEDT(bg, inp->imgDims, inp->pixDims, dIn,  NULL);
+        squaredEDT(fg, inp->imgDims, inp->pixDims, dOut, NULL);
+
+        out->createFromTemplate(*inp,true);
+
+        NIBR::MT::MTRUN(inp->imgDims[2], [&](const NIBR::MT::TASK& task)->void {
+            const int64_t k = task.no;
+            for (int64_t j=0; j<inp->imgDims[1]; j++)
+                for (int64_t i=0; i<inp->imgDims[0]; i++) {
+                    int64_t n = i + inp->imgDims[0]*(j + inp->imgDims[1]*k);
+                    out->data[out->sub2ind(i,j,k)] = fg[n] ? std::sqrt(dIn[n]) : -std::sqrt(dOut[n]);
+                }
+        });
+    }
+
+}
+
+void NIBR::imgEDT(NIBR::Image<bool>*  inp, NIBR::Image<float>* out) {exactEDT(inp, out, NULL, true);}
+void NIBR::imgEDT(NIBR::Image<int>*   inp, NIBR::Image<float>* out) {exactEDT(inp, out, NULL, true);}
 void NIBR::imgEDT(NIBR::Image<float>* inp, NIBR::Image<float>* out) {wrapImgEDT(inp, out);}
 void NIBR::imgEDT(NIBR::Image<float>* inp) {wrapImgEDT(inp);}
+
+void NIBR::imgDistanceToForeground(NIBR::Image<bool>* inp, NIBR::Image<float>* out, NIBR::Image<int64_t>* nearest) {exactEDT(inp, out, nearest, false);}
+void NIBR::imgDistanceToForeground(NIBR::Image<int>*  inp, NIBR::Image<float>* out, NIBR::Image<int64_t>* nearest) {exactEDT(inp, out, nearest, false);}
+
+void NIBR::imgSignedEDT(NIBR::Image<bool>* inp, NIBR::Image<float>* out) {signedEDT(inp, out);}
+void NIBR::imgSignedEDT(NIBR::Image<int>*  inp, NIBR::Image<float>* out) {signedEDT(inp, out);}
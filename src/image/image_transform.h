@@ -5,8 +5,21 @@
 
 namespace NIBR
 {
+    // For binary inputs, the output is the exact distance of each nonzero voxel to the nearest zero voxel. Zero voxels are 0.
+    // For float inputs, nonzero voxels are seeds with the given initial distances and the distances are computed with fast marching.
     void imgEDT(NIBR::Image<bool>*  inp, NIBR::Image<float>* out);
     void imgEDT(NIBR::Image<int>*   inp, NIBR::Image<float>* out);
     void imgEDT(NIBR::Image<float>* inp, NIBR::Image<float>* out);
     void imgEDT(NIBR::Image<float>* inp);  // Overwrites input
+
+    // Exact distance, in the spatial unit of the image, from each voxel to the nearest nonzero (foreground) voxel, computed in linear
+    // time with the separable algorithm of Felzenszwalb and Huttenlocher. Foreground voxels are 0.
+    // If nearest is not NULL, it is filled with the 3D index of the nearest foreground voxel, or -1 if there is no foreground.
+    void imgDistanceToForeground(NIBR::Image<bool>* inp, NIBR::Image<float>* out, NIBR::Image<int64_t>* nearest = NULL);
+    void imgDistanceToForeground(NIBR::Image<int>*  inp, NIBR::Image<float>* out, NIBR::Image<int64_t>* nearest = NULL);
+
+    // Positive inside the foreground, where it is the distance to the nearest zero voxel, and negative outside,
+    // where it is minus the distance to the nearest foreground voxel.
+    void imgSignedEDT(NIBR::Image<bool>* inp, NIBR::Image<float>* out);
+    void imgSignedEDT(NIBR::Image<int>*  inp, NIBR::Image<float>* out);
 }
\ No newline at end of file
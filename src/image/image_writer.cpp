@@ -1,5 +1,10 @@
 #include "image.h"
+#include "base/gzipWriter.h"
 #include "zlib.h"
+#include <type_traits>
+
+#define IMAGE_WRITE_BLOCK_SIZE  65536               // number of values prepared by a single task
+#define IMAGE_WRITE_CHUNK_SIZE  (64*1024*1024)      // bytes passed to writeFunc at once
 
 using namespace NIBR;
 
@@ -8,6 +13,13 @@ bool NIBR::Image<T>::write(std::string filePath_) {
 
     std::string ext = getFileExtension(filePath_);
 
+    // If the target file is memory mapped, it is unlinked first so that the mapped data stays intact
+    // and the new file gets a fresh inode. Otherwise truncating the file would invalidate the mapping.
+    if (isMappedImageFile(filePath_)) {
+        disp(MSG_DETAIL,"Replacing memory mapped image file: %s",filePath_.c_str());
+        std::remove(filePath_.c_str());
+    }
+
     if ((ext=="nii") || (ext=="nii.gz"))
         return write_nii(filePath_);
 
@@ -144,9 +156,122 @@ void* resetIndexingAndCopyData(T* inp, int64_t* imgDims, int* indexOrder) {
 
 }
 
+// Writes the image data in the standard order, i.e. i is the fastest changing index, after converting it to OUT_T and swapping bytes
+// if needed. Output is prepared in chunks, where blocks of values are filled in parallel, so the data is never copied as a whole.
+template<typename OUT_T, typename T>
+void writeData(T* data, int64_t* imgDims, int* indexOrder, bool swapByte, std::function<void(const void*, size_t, size_t)>& writeFunc) {
+
+    int64_t s2i[7];
+    int64_t numel = 1;
+
+    for (int i=0; i<7; i++) {
+        s2i[i] = 1;
+        numel *= imgDims[i];
+    }
+
+    bool reIdx = false;
+    for (int i=1; i<7; i++) {
+        if (indexOrder[i]!=i) reIdx = true;
+        for (int j=0; j<i; j++)
+            s2i[indexOrder[i]] *= imgDims[indexOrder[j]];
+    }
+
+    if (!reIdx && !swapByte && std::is_same<OUT_T,T>::value) {
+        for (int64_t beg = 0; beg < numel; beg += IMAGE_WRITE_CHUNK_SIZE/sizeof(T))
+            writeFunc(data + beg, sizeof(T), std::min(int64_t(IMAGE_WRITE_CHUNK_SIZE/sizeof(T)), numel - beg));
+        return;
+    }
+
+    const int64_t chunkSize = std::min(std::max(int64_t(1), int64_t(IMAGE_WRITE_CHUNK_SIZE/sizeof(OUT_T))), numel);
+    std::unique_ptr<OUT_T[]> chunk(new OUT_T[chunkSize]);
+
+    for (int64_t beg = 0; beg < numel; beg += chunkSize) {
+
+        const int64_t n        = std::min(chunkSize, numel - beg);
+        const int64_t blockCnt = (n + IMAGE_WRITE_BLOCK_SIZE - 1) / IMAGE_WRITE_BLOCK_SIZE;
+
+        NIBR::MT::MTRUN(blockCnt, [&](const NIBR::MT::TASK& task)->void {
+
+            int64_t blockBeg = task.no * IMAGE_WRITE_BLOCK_SIZE;
+            int64_t blockEnd = std::min(blockBeg + IMAGE_WRITE_BLOCK_SIZE, n);
+
+            // Subscripts of the first value in the block, which are then incremented with carry
+            int64_t sub[7];
+            int64_t ind = beg + blockBeg;
+            for (int d=0; d<7; d++) {
+                sub[d] = ind % imgDims[d];
+                ind   /= imgDims[d];
+            }
+
+            int64_t inpInd = 0;
+            for (int d=0; d<7; d++)
+                inpInd += sub[d]*s2i[d];
+
+            for (int64_t m=blockBeg; m<blockEnd; m++) {
+
+                OUT_T val = data[reIdx ? inpInd : (beg + m)];
+                if (swapByte) swapByteOrder(val);
+                chunk[m] = val;
+
+                if (reIdx) {
+                    for (int d=0; d<7; d++) {
+                        sub[d]++;
+                        inpInd += s2i[d];
+                        if (sub[d] < imgDims[d]) break;
+                        inpInd -= sub[d]*s2i[d];
+                        sub[d]  = 0;
+                    }
+                }
+            }
+
+        });
+
+        writeFunc(chunk.get(), sizeof(OUT_T), n);
+
+    }
+
+}
+
 template<typename T>
 bool NIBR::Image<T>::write_nii(std::string filePath_) {
 
+    // Compressed files are written with the parallel gzip writer, where the data is streamed in chunks
+    if (getFileExtension(filePath_) == "nii.gz") {
+
+        nifti_1_header* header = getNiftiHeader();
+        if (header == NULL) return false;
+
+        nifti_image* nim = nifti_convert_n1hdr2nim(*header,filePath_.c_str());
+        free(header);
+
+        // Same header, extender and data offset as nifti_image_write
+        nifti_1_header hdr;
+        nifti_set_iname_offset(nim, 1);
+        nifti_convert_nim2n1hdr(nim, &hdr);
+        int64_t offset = nim->iname_offset;
+        nifti_image_free(nim);
+
+        GzipWriter gz;
+        if (!gz.open(filePath_)) return false;
+
+        std::function<void(const void*, size_t, size_t)> writeFunc = [&gz](const void* ptr, size_t size, size_t nmemb) {gz.write(ptr, size * nmemb);};
+
+        const char extender[4] = {0, 0, 0, 0};
+        writeFunc(&hdr, sizeof(hdr), 1);
+        writeFunc(extender, 1, 4);
+        for (int64_t i = int64_t(sizeof(hdr)) + 4; i < offset; i++)
+            writeFunc(extender, 1, 1);
+
+        writeData<T,T>(data, imgDims, indexOrder, false, writeFunc);
+
+        if (!gz.close()) {
+            disp(MSG_ERROR, "Failed to write: %s", filePath_.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
     nifti_1_header* header = getNiftiHeader();
     nifti_image* nim       = nifti_convert_n1hdr2nim(*header,filePath_.c_str());
 
@@ -180,19 +305,8 @@ bool NIBR::Image<T>::write_nii(std::string filePath_) {
 template<typename T>
 bool NIBR::Image<T>::write_mghz(std::string filePath_) {
 
-    // First handle the data buffer
-    void*  buffer    = data;
-    float* fltBuffer = NULL;
-
-    // Reset indexing if needed
-    bool resetIndexing = false;
-    for (int i=0; i<7; i++)
-        if (indexOrder[i]!=i)
-            resetIndexing = true;
-        
-    if (resetIndexing) buffer = resetIndexingAndCopyData(data,imgDims,indexOrder);
-
-    // Apply datatype conversion if needed
+    // Data is reindexed, converted and byte swapped in chunks while it is written
+    bool toFloat   = false;
     int  type      = 0;
     switch (dataType) {
 
@@ -204,8 +318,7 @@ bool NIBR::Image<T>::write_mghz(std::string filePath_) {
         default: {
             type = 3; 
             disp(MSG_WARN, "mgh/mgz format don't support this datatype. Output will be in float32.");
-            fltBuffer = (float*)malloc(numel*sizeof(float));
-            for (int i = 0; i < numel; i++) fltBuffer[i] = ((T*)(buffer))[i];
+            toFloat = true;
             break;
         }
     }
@@ -219,15 +332,14 @@ bool NIBR::Image<T>::write_mghz(std::string filePath_) {
     std::function<void(const void*, size_t, size_t)> writeFunc;
 
     FILE* fp    = NULL;
-    gzFile gzfp = NULL;
+    GzipWriter gz;
     
     if (isMGZ) {
-        gzfp = gzopen(filePath_.c_str(), "wb");
-        if (!gzfp) {
+        if (!gz.open(filePath_)) {
             disp(MSG_ERROR, "Cannot open .mgz file for writing: %s", filePath_.c_str());
             return false;
         }
-        writeFunc = [gzfp](const void* ptr, size_t size, size_t nmemb) {gzwrite(gzfp, ptr, size * nmemb);};
+        writeFunc = [&gz](const void* ptr, size_t size, size_t nmemb) {gz.write(ptr, size * nmemb);};
     } else {
         fp = fopen(filePath_.c_str(), "wb");
         if (!fp) {
@@ -295,24 +407,20 @@ bool NIBR::Image<T>::write_mghz(std::string filePath_) {
     writeFunc(filler, sizeof(short), 97);    
 
     // Write the data
-    if (fltBuffer!=NULL) {
-        for (int i = 0; i < numel; i++) {
-            writeAndSwap(fltBuffer[i]);
-        }
-
-        // writeFunc(fltBuffer, sizeof(float), numel); 
-        free(fltBuffer);
+    if (toFloat) {
+        writeData<float,T>(data, imgDims, indexOrder, true, writeFunc);
     } else {
-        for (int i = 0; i < numel; i++) {
-            writeAndSwap(((T*)(buffer))[i]);
-        }
-        // writeFunc(buffer, sizeof(T), numel);
+        writeData<T,T>(data, imgDims, indexOrder, true, writeFunc);
     }
-
-    if (resetIndexing) delete[] reinterpret_cast<T*>(buffer);
     
-    if (isMGZ) gzclose(gzfp);
-    else fclose(fp);
+    if (isMGZ) {
+        if (!gz.close()) {
+            disp(MSG_ERROR, "Failed to write: %s", filePath_.c_str());
+            return false;
+        }
+    } else {
+        fclose(fp);
+    }
 
     return true;
 
@@ -155,7 +155,7 @@ void NIBR::SF_Image::smooth(float angle) {
     };
     NIBR::MT::MTRUN(nnzVoxelSubs.size(),"Applying spherical smoothing",applySmoothing);
 
-    delete[] data;
+    deallocData();
     data = sdata;
 
 }
@@ -1,140 +1,222 @@
 #include "FDM.h"
 
-#include <Eigen/Sparse>
-#include <Eigen/SparseLU>
-#include <Eigen/Sparse>
-#include <Eigen/IterativeLinearSolvers>
-
 using namespace NIBR;
 
-
+#define FDM_TOLERANCE       1e-8        // relative residual
+#define FDM_MAX_ITERATIONS  20000
+#define FDM_BLOCK_SIZE      16384       // number of equations processed by a single task
+#define FDM_REGULARIZATION  1e-6        // added to the diagonal
+
+// The system is not assembled. Each interior voxel is an equation with the 7-point stencil
+//      diag * x_c - sum (x_n of interior neighbors) = sum (Dirichlet BC of neighbors)
+// where diag is the number of interior and Dirichlet neighbors. It is solved with Jacobi preconditioned conjugate gradient,
+// where the search direction is kept on the grid so that the stencil is applied with fixed offsets.
+// The number of iterations grows linearly with the longest path through the interior, e.g., about 470 iterations
+// for a spherical shell on a 400^3 grid, so Jacobi is enough to stay well below FDM_MAX_ITERATIONS.
 bool NIBR::FDMsolveLaplacianWithDirichletBC(Image<double>& problem, Image<double>& solution) {
 
-    typedef Eigen::SparseMatrix<double> SpMat;
-    typedef Eigen::Triplet<double>      Triplet;
-
-    std::vector<Triplet>   tripletList;
-    std::vector<double>    b;                // Right-hand side vector
-    std::map<int64_t, int> indexMap;         // Map from grid index to equation index
-
     const int64_t nx = problem.imgDims[0];
     const int64_t ny = problem.imgDims[1];
     const int64_t nz = problem.imgDims[2];
 
     const int64_t numel = problem.numel;
 
-    // Neighbor offsets for 6-connected grid
-    auto neighborOffsets = get3DNeighbors(CONN6);
+    // Offsets of the 6-connected neighbors
+    int64_t offset[6];
+    for (int n = 0; n < 6; n++)
+        offset[n] = N6[n][0]*problem.s2i[0] + N6[n][1]*problem.s2i[1] + N6[n][2]*problem.s2i[2];
 
-    // Build index mapping and identify boundary points
-    int eqIndex = 0;
-    for (int64_t n = 0; n < numel; ++n) {
-        if (problem.data[n] == FDM_INTERIOR) {
-            indexMap[n] = eqIndex++;
-        }   
-    }
+    // Equations are listed in raster order. For each, links has one bit per interior neighbor.
+    std::vector<std::vector<int64_t>> sliceVoxels(nz);
+    std::vector<std::vector<uint8_t>> sliceLinks(nz);
+    std::vector<std::vector<double>>  sliceDiag(nz);
+    std::vector<std::vector<double>>  sliceB(nz);
+
+    NIBR::MT::MTRUN(nz, [&](const NIBR::MT::TASK& task)->void {
 
-    b.resize(eqIndex, 0.0);
+        const int64_t k = task.no;
 
-    // Assemble the matrix A and vector b
-    for (int64_t k = 0; k < nz; ++k) {
         for (int64_t j = 0; j < ny; ++j) {
             for (int64_t i = 0; i < nx; ++i) {
 
                 int64_t idx = problem.sub2ind(i, j, k);
 
-                double val  = problem.data[idx];
+                if (problem.data[idx] != FDM_INTERIOR) continue;
 
-                if (val == FDM_INTERIOR) {
+                uint8_t link          = 0;
+                double  neighborCount = 0;
+                double  b             = 0;
 
-                    int    row           = indexMap[idx];
-                    double neighborCount = 0;
+                for (int n = 0; n < 6; n++) {
 
-                    for (const auto& offset : neighborOffsets) {
+                    int64_t ni = i + N6[n][0];
+                    int64_t nj = j + N6[n][1];
+                    int64_t nk = k + N6[n][2];
 
-                        int ni = i + offset[0];
-                        int nj = j + offset[1];
-                        int nk = k + offset[2];
+                    // Neighbors outside the grid are treated as FDM_EXTERIOR
+                    if (ni < 0 || ni >= nx || nj < 0 || nj >= ny || nk < 0 || nk >= nz) continue;
 
-                        if (ni >= 0 && ni < nx && nj >= 0 && nj < ny && nk >= 0 && nk < nz) {
+                    double neighborVal = problem.data[idx + offset[n]];
 
-                            int64_t nidx        = problem.sub2ind(ni, nj, nk);
-                            double  neighborVal = problem.data[nidx];
-
-                            if (neighborVal == FDM_INTERIOR) {
-                                int col = indexMap[nidx];
-                                tripletList.emplace_back(Triplet(row, col, -1.0));
-                                neighborCount++;
-                            } else if (neighborVal != FDM_EXTERIOR) {
-                                // Dirichlet boundary condition
-                                // neighborVal is the known value at the boundary
-                                b[row] += neighborVal;
-                                neighborCount++;
-                            }
-                            // FDM_EXTERIOR points are ignored
-                        }
-                        // Neighbors outside the grid are treated as FDM_EXTERIOR
+                    if (neighborVal == FDM_INTERIOR) {
+                        link |= uint8_t(1) << n;
+                        neighborCount++;
+                    } else if (neighborVal != FDM_EXTERIOR) {
+                        // Dirichlet boundary condition
+                        b += neighborVal;
+                        neighborCount++;
                     }
 
-                    // Set the diagonal entry
-                    tripletList.emplace_back(Triplet(row, row, neighborCount));
                 }
-                // Else, skip FDM_EXTERIOR and Dirichlet BC points
+
+                sliceVoxels[k].push_back(idx);
+                sliceLinks[k].push_back(link);
+                sliceDiag[k].push_back(neighborCount + FDM_REGULARIZATION);
+                sliceB[k].push_back(b);
+
             }
         }
+
+    });
+
+    std::vector<int64_t> voxel;
+    std::vector<uint8_t> links;
+    std::vector<double>  diag;
+    std::vector<double>  b;
+
+    for (int64_t k = 0; k < nz; k++) {
+        voxel.insert(voxel.end(), sliceVoxels[k].begin(), sliceVoxels[k].end());
+        links.insert(links.end(), sliceLinks[k].begin(),  sliceLinks[k].end());
+        diag.insert (diag.end(),  sliceDiag[k].begin(),   sliceDiag[k].end());
+        b.insert    (b.end(),     sliceB[k].begin(),      sliceB[k].end());
+        std::vector<int64_t>().swap(sliceVoxels[k]);
+        std::vector<uint8_t>().swap(sliceLinks[k]);
+        std::vector<double>().swap(sliceDiag[k]);
+        std::vector<double>().swap(sliceB[k]);
     }
 
-    // Build sparse matrix A
-    SpMat A(eqIndex, eqIndex);
-    A.setFromTriplets(tripletList.begin(), tripletList.end());
-    A.makeCompressed();
+    const int64_t eqCnt    = voxel.size();
+    const int64_t blockCnt = (eqCnt + FDM_BLOCK_SIZE - 1) / FDM_BLOCK_SIZE;
+
+    // Runs f(beg,end) on blocks of equations in parallel and returns the sum of the outputs. Partial sums are added in a fixed order.
+    std::vector<double> partial(blockCnt);
+    auto blockSum = [&](auto f)->double {
+        NIBR::MT::MTRUN(blockCnt, [&](const NIBR::MT::TASK& task)->void {
+            int64_t beg = task.no * FDM_BLOCK_SIZE;
+            int64_t end = std::min(beg + FDM_BLOCK_SIZE, eqCnt);
+            partial[task.no] = f(beg,end);
+        });
+        double sum = 0;
+        for (auto v : partial) sum += v;
+        return sum;
+    };
+
+    std::vector<double> x(eqCnt, 0.0);
+    std::vector<double> r(b);
+    std::vector<double> Ap(eqCnt);
+    std::vector<double> p(numel, 0.0);        // on the grid, zero except the interior
+
+    disp(MSG_INFO,"Solving Laplace's equation");
 
-    // Iterative solver with preconditioning
-    Eigen::ConjugateGradient<SpMat, Eigen::Lower|Eigen::Upper, Eigen::IncompleteCholesky<double>> solver;
+    double bNorm = std::sqrt(blockSum([&](int64_t beg, int64_t end)->double {
+        double s = 0;
+        for (int64_t e = beg; e < end; e++) s += b[e]*b[e];
+        return s;
+    }));
+
+    double rz = blockSum([&](int64_t beg, int64_t end)->double {
+        double s = 0;
+        for (int64_t e = beg; e < end; e++) {
+            double z     = r[e]/diag[e];
+            p[voxel[e]]  = z;
+            s           += r[e]*z;
+        }
+        return s;
+    });
 
-    // Adjust solver parameters
-    solver.setTolerance(1e-8);
-    solver.setMaxIterations(1000);
+    int    iter  = 0;
+    double error = 0;
 
-    // Add regularization term
-    SpMat I(eqIndex, eqIndex);
-    I.setIdentity();
-    A += 1e-6 * I;
+    if (bNorm > 0) {
 
-    disp(MSG_INFO,"Solving Laplace's equation");
+        for (iter = 1; iter <= FDM_MAX_ITERATIONS; iter++) {
 
-    solver.compute(A);
-    if (solver.info() != Eigen::Success) {
-        disp(MSG_ERROR,"Solver initialization failed");
-        return false;
-    }
+            double pAp = blockSum([&](int64_t beg, int64_t end)->double {
+                double s = 0;
+                for (int64_t e = beg; e < end; e++) {
+                    const double* pc  = p.data() + voxel[e];
+                    double        val = diag[e]*pc[0];
+                    for (int n = 0; n < 6; n++)
+                        if (links[e] & (uint8_t(1) << n)) val -= pc[offset[n]];
+                    Ap[e] = val;
+                    s    += pc[0]*val;
+                }
+                return s;
+            });
+
+            const double alpha = rz / pAp;
+
+            double rr = blockSum([&](int64_t beg, int64_t end)->double {
+                double s = 0;
+                for (int64_t e = beg; e < end; e++) {
+                    x[e] += alpha*p[voxel[e]];
+                    r[e] -= alpha*Ap[e];
+                    s    += r[e]*r[e];
+                }
+                return s;
+            });
+
+            error = std::sqrt(rr) / bNorm;
+            if (error < FDM_TOLERANCE) break;
+
+            double rzNew = blockSum([&](int64_t beg, int64_t end)->double {
+                double s = 0;
+                for (int64_t e = beg; e < end; e++)
+                    s += r[e]*r[e]/diag[e];
+                return s;
+            });
+
+            const double beta = rzNew / rz;
+            rz = rzNew;
+
+            blockSum([&](int64_t beg, int64_t end)->double {
+                for (int64_t e = beg; e < end; e++)
+                    p[voxel[e]] = r[e]/diag[e] + beta*p[voxel[e]];
+                return 0;
+            });
+
+        }
+
+        if (iter > FDM_MAX_ITERATIONS) {
+            disp(MSG_ERROR,"Solving linear system failed");
+            return false;
+        }
 
-    Eigen::VectorXd solution_vec = solver.solve(Eigen::Map<Eigen::VectorXd>(b.data(), b.size()));
-    if (solver.info() != Eigen::Success) {
-        disp(MSG_ERROR,"Solving linear system failed");
-        return false;
     }
 
-    disp(MSG_INFO, "Solver converged in %d iterations", solver.iterations());
-    disp(MSG_INFO, "Estimated error: %f", solver.error());
+    disp(MSG_INFO, "Solver converged in %d iterations", iter);
+    disp(MSG_INFO, "Estimated error: %f", error);
+
+    std::vector<double>().swap(p);
 
     // Map the solution back to the solution image
     solution.createFromTemplate(problem, true);
 
-    for (int64_t n = 0; n < numel; ++n) {
-        double val = problem.data[n];
-
-        if (val == FDM_INTERIOR) {
-            int eq_idx       = indexMap[n];
-            solution.data[n] = solution_vec[eq_idx];
-        } else if (val != FDM_EXTERIOR) {
-            // Dirichlet boundary condition
-            solution.data[n] = val;
+    NIBR::MT::MTRUN(numel, [&](const NIBR::MT::TASK& task)->void {
+        double val = problem.data[task.no];
+        if (val == FDM_EXTERIOR) {
+            solution.data[task.no] = NAN;
         } else {
-            // FDM_EXTERIOR point
-            solution.data[n] = NAN;
+            // Dirichlet boundary condition, interior voxels are overwritten below
+            solution.data[task.no] = val;
         }
-    }
+    });
+
+    blockSum([&](int64_t beg, int64_t end)->double {
+        for (int64_t e = beg; e < end; e++)
+            solution.data[voxel[e]] = x[e];
+        return 0;
+    });
 
     return true;
 }
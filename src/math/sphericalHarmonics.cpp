@@ -127,10 +127,31 @@ void SH::precompute() {
 // (Read above for details, and see the two sh2sf functions in image_operators, where one of them uses the above basis function and the other uses the precomputed values as below.)
 float SH::toSF(float *sh, float *dir) {
     
-    float* unit_dir = new float[3];
-    unit_dir[0]     = dir[0];
-    unit_dir[1]     = dir[1];
-    unit_dir[2]     = dir[2];
+    float *phiComp, *thetaComp;
+    lookup(dir, phiComp, thetaComp);
+    
+    float amp = 0;
+    for (int i=0; i<coeffCount; i++)
+        amp += sh[i]*phiComp[i]*thetaComp[i];
+
+    if (amp>0) 	return amp;
+    else 		return 0;
+
+}
+
+void SH::basis(float *B, float *dir) {
+
+    float *phiComp, *thetaComp;
+    lookup(dir, phiComp, thetaComp);
+
+    for (int i=0; i<coeffCount; i++)
+        B[i] = phiComp[i]*thetaComp[i];
+
+}
+
+void SH::lookup(float *dir, float*& phiComp, float*& thetaComp) {
+
+    float unit_dir[3] = {dir[0], dir[1], dir[2]};
 
     auto getPhiIndex = [&]()->std::size_t {
         return  coeffCount*((std::size_t)((unit_dir[0]+1)*scalingFactor_phi)*numberOfSamples_phi + (std::size_t)((unit_dir[1]+1)*scalingFactor_phi));
@@ -143,15 +164,7 @@ float SH::toSF(float *sh, float *dir) {
     orderDirections(unit_dir);
     verifyUnitRange(unit_dir);
 	
-    float *phiComp 		= precomputedPhiComponent   +   getPhiIndex();
-    float *thetaComp  	= precomputedThetaComponent + getThetaIndex();
-    delete[] unit_dir;
-    
-    float amp = 0;
-    for (int i=0; i<coeffCount; i++)
-        amp += sh[i]*phiComp[i]*thetaComp[i];
-
-    if (amp>0) 	return amp;
-    else 		return 0;
+    phiComp   = precomputedPhiComponent   + getPhiIndex();
+    thetaComp = precomputedThetaComponent + getThetaIndex();
 
 }
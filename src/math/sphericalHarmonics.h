@@ -17,12 +17,14 @@ public:
     SH& operator=(const SH&) = delete;
 
     int   getCoeffCount() {return coeffCount;}
-    float toSF(float *sh, float *dir);
+    float toSF(float *sh, float *dir);          // Amplitude at dir, negative values are returned as 0
+    void  basis(float *B, float *dir);          // B has coeffCount basis values at dir, so that toSF is max(0, sum sh*B)
 
 private:
 
     void  clean();
     void  precompute();
+    void  lookup(float *dir, float*& phiComp, float*& thetaComp);
 
     int  order;
     int  coeffCount;
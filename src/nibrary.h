@@ -25,6 +25,7 @@
 
 #include "dMRI/tractography/connectivity/tractogramConn_imageIndexer.h"
 #include "dMRI/tractography/connectivity/tractogramConn_surfaceIndexer.h"
+#include "dMRI/tractography/connectivity/tractogramConn_batchIndexer.h"
 
 #include "dMRI/tractography/io/tractogramField.h"
 #include "dMRI/tractography/io/tractogramReader.h"
@@ -65,6 +66,7 @@
 // image
 #include "image/image.h"
 #include "image/image_operators.h"
+#include "image/image_bitmask.h"
 #include "image/image_morphological.h"
 #include "image/image_marchingCubes.h"
 #include "image/sf_image.h"
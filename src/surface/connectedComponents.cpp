@@ -1,17 +1,37 @@
 #include "surface.h"
 #include "surface_operators.h"
 #include <stack>
+#include <algorithm>
 
 void NIBR::Surface::getConnectedComponents() 
 {
 
     disp(MSG_DEBUG,"getConnectedComponents()");
 
+    // Vertices were moved after the components were computed. Connectivity is the same, so only their vertices are updated.
+    if (compIsStale && (compVertices.size() == comp.size())) {
+        for (size_t c = 0; c < comp.size(); c++) {
+            if (comp[c].nv != int(compVertices[c].size())) continue;
+            for (int n = 0; n < comp[c].nv; n++)
+                memcpy(comp[c].vertices[n], vertices[compVertices[c][n]], 3*sizeof(float));
+            comp[c].refreshDerivedData();
+        }
+        compIsStale = false;
+    }
+
+    if (compIsStale) {
+        comp.clear();
+        compOpenOrClosed.clear();
+        compIsStale = false;
+    }
+
     if (!comp.empty()) { 
         disp(MSG_DEBUG,"...which were already computed");
         return;
     }
 
+    compVertices.clear();
+
     getNeighboringVertices();
     std::vector<bool> visited(nv, false); // mark all vertices as not visited
 
@@ -44,9 +64,12 @@ void NIBR::Surface::getConnectedComponents()
             for (auto n : currentComponentVertices)
                 vertexMask[n] = true;
 
-            // Convert currentComponentVertices to a Surface
+            // Convert currentComponentVertices to a Surface, where vertices keep their order
             auto component = applyMask(*this, vertexMask);
             comp.push_back(component);
+
+            std::sort(currentComponentVertices.begin(), currentComponentVertices.end());
+            compVertices.push_back(currentComponentVertices);
             // component.printInfo();
         }
     }
@@ -106,22 +129,20 @@ void NIBR::Surface::getClosedAndOpenComponents()
                 out.nf += surf.nf;
             }
 
-            out.vertices = new float*[out.nv];
-            out.faces    = new   int*[out.nf];
+            out.vertices = allocateRows3<float>(out.nv);
+            out.faces    = allocateRows3<int>(out.nf);
 
             int kv = 0;
             int kf = 0;
             for (const auto& surfInd : compInds) {
                 const auto& surf = comp[surfInd];
                 for (int i=0; i<surf.nf; i++) {
-                    out.faces[kf]    = new int[3];
                     out.faces[kf][0] = surf.faces[i][0] + kv;
                     out.faces[kf][1] = surf.faces[i][1] + kv;
                     out.faces[kf][2] = surf.faces[i][2] + kv;
                     kf++;
                 }
                 for (int i=0; i<surf.nv; i++) {
-                    out.vertices[kv] = new float[3];
                     memcpy(out.vertices[kv], surf.vertices[i], 3*sizeof(float));
                     kv++;
                 }
@@ -83,4 +83,46 @@ double NIBR::Surface::distToPoint(float *p) {
     int faceInd;
     float closestPoint[3];
     return distToPoint(p,faceInd,closestPoint);
-}
\ No newline at end of file
+}
+
+// Batched signed distance. Points that were not already resolved on the boundary by isPointInside
+// are sent to the AABB tree in a single call.
+void NIBR::Surface::distToPoint(const float* x, const float* y, const float* z, std::size_t N, std::vector<double>& dist, SurfacePointQueryBuffer& buf)
+{
+    std::vector<uint8_t> inside;
+    isPointInside(x,y,z,N,inside,dist,buf);
+
+    if (!enabledPointCheck) {
+        dist.assign(N,NAN);
+        return;
+    }
+
+    buf.remaining.clear();
+    for (std::size_t n = 0; n < N; n++) {
+        if ((dist[n] == DBL_MAX) || (dist[n] == DBL_MIN))
+            buf.remaining.push_back(n);
+    }
+
+    const int64_t m = buf.remaining.size();
+    if (m == 0) return;
+
+    if (buf.Q.rows() < m) buf.Q.resize(m,3);
+    for (int64_t k = 0; k < m; k++) {
+        buf.Q(k,0) = x[buf.remaining[k]];
+        buf.Q(k,1) = y[buf.remaining[k]];
+        buf.Q(k,2) = z[buf.remaining[k]];
+    }
+
+    AABB_tree.squared_distance(V,F,buf.Q.topRows(m),buf.sqrD,buf.I,buf.C);
+
+    for (int64_t k = 0; k < m; k++) {
+        const int64_t n = buf.remaining[k];
+        dist[n] = inside[n] ? std::sqrt(buf.sqrD(k)) : -std::sqrt(buf.sqrD(k));
+    }
+}
+
+void NIBR::Surface::distToPoint(const float* x, const float* y, const float* z, std::size_t N, std::vector<double>& dist)
+{
+    SurfacePointQueryBuffer buf;
+    distToPoint(x,y,z,N,dist,buf);
+}
@@ -3,6 +3,51 @@
 #include <cfloat>
 #include <tuple>
 
+#define FACES_DONE_CAPACITY 64
+
+namespace {
+
+    // Same as findSegmentTriangleIntersection, using the packed face data {vertex0, edge1, edge2, normal}.
+    // Returns the distance of the intersection from p, or NAN if there is no intersection.
+    inline double intersectPackedFace(const float* face, const double* p, const double* dir, double length)
+    {
+        const float* ref = face;
+        const float* v1  = face + 3;
+        const float* v2  = face + 6;
+
+        // Determinant
+        double tmp[3];
+        NIBR::cross(tmp,dir,v2);
+        double det = NIBR::dot(tmp,v1);
+
+        // Segment is parallel to the triangle
+        if ( (det == 0.0) || (std::isnan(det))) return NAN;
+
+        double T[3] = {p[0]-double(ref[0]),p[1]-double(ref[1]),p[2]-double(ref[2])};
+
+        // Check if the first barycentric coordinate is within limits
+        double u = NIBR::dot(tmp,T);
+        if (( (det < 0.0) && ((u > 0.0) || (u < det)) ) ||
+            ( (det > 0.0) && ((u < 0.0) || (u > det)) ) ) return NAN;
+
+        // Check if the second barycentric coordinate is within limits
+        NIBR::cross(tmp,T,v1);
+        double v = NIBR::dot(tmp,dir);
+        if (( (det < 0.0) && ((v > 0.0) || ((u+v) < det)) ) ||
+            ( (det > 0.0) && ((v < 0.0) || ((u+v) > det)) ) ) return NAN;
+
+        // Check if t is within range, i.e., segment crosses the triangle
+        double t = NIBR::dot(tmp, v2);
+
+        if (( (det < 0.0) && ((t > 0.0) || (t < length*det))) ||
+            ( (det > 0.0) && ((t < 0.0) || (t > length*det)))) return NAN;
+
+        t /= det;
+        return std::clamp(t,0.0,length);
+    }
+
+}
+
 // Checks if a segment intersects the surface or not. 
 // <isSegBegInside,isSegEndInside,distFromSegBegToMesh,intersectingFaceIndex,intersectionIsInsideToOutside,boundaryTransitionDist>
 // distFromBegToMesh      ≠ NAN if the segment is intersecting the mesh. Then intersectingFaceIndex and intersectionIsInsideToOutside are valid.
@@ -12,6 +57,11 @@
 std::tuple<bool,bool,double,int,bool,double> NIBR::Surface::intersectSegment(const LineSegment* seg) 
 {  
 
+    if (!enabledPointCheck) {
+        disp(MSG_FATAL, "enablePointCheck is not initialized");
+        return std::make_tuple(false,false,NAN,INT_MIN,false,NAN);
+    }
+
     // Compute ijk of segment.beg and segment.end
     double p0[3];
     maskAndBoundary.to_ijk(seg->beg,p0);
@@ -33,9 +83,19 @@ std::tuple<bool,bool,double,int,bool,double> NIBR::Surface::intersectSegment(con
     double  boundaryTransitionDist  = NAN;
 
     bool    computedBegAndEnd       = false;
-    std::set<int> facesDone;
     double  minDist = DBL_MAX;
 
+    // Faces that were already checked in previous voxels. Rechecking a face gives the same result,
+    // so faces that do not fit in the buffer are simply checked again.
+    int     facesDone[FACES_DONE_CAPACITY];
+    int     facesDoneCnt            = 0;
+
+    // Segment beg and direction for the intersection tests
+    double  segBeg[3] = {seg->beg[0],seg->beg[1],seg->beg[2]};
+    double  segDir[3] = {double(seg->end[0])-double(seg->beg[0]),double(seg->end[1])-double(seg->beg[1]),double(seg->end[2])-double(seg->beg[2])};
+    double  segLen    = norm(segDir);
+    vec3scale(segDir,1.0/segLen);
+
     // Check segment intersection. Operates on voxel A.
     // Returns <doesIntersect,towardsOutside,faceInd,dist>
     auto checkFaceDistSign=[&](int i, int j, int k)->std::tuple<double,int,bool> {
@@ -45,34 +105,35 @@ std::tuple<bool,bool,double,int,bool,double> NIBR::Surface::intersectSegment(con
 
         bool doesIntersect  = false;
 
-        // disp(MSG_DEBUG,"Checking faces");
-        for (auto faceInd : grid[i][j][k]) {
+        int64_t ind = maskAndBoundary.sub2ind(i,j,k);
+
+        for (int n = gridFaceOffsets[ind]; n < gridFaceOffsets[ind+1]; n++) {
 
-            if (facesDone.find(faceInd) != facesDone.end()) 
+            int faceInd = gridFaceIndices[n];
+
+            if (std::find(facesDone,facesDone+facesDoneCnt,faceInd) != facesDone+facesDoneCnt) 
                 continue;
             
-            facesDone.insert(faceInd);
+            if (facesDoneCnt < FACES_DONE_CAPACITY)
+                facesDone[facesDoneCnt++] = faceInd;
 
-            // disp(MSG_DEBUG,"faceInd: %d", faceInd);
+            const float* face = &packedFaceData[size_t(faceInd)*12];
             
-            findSegmentTriangleIntersection(this, faceInd, seg->beg, seg->end, NULL, &dist);
-
-            // disp(MSG_DEBUG,"faceInd: %d, dist: %f", faceInd, dist);
+            double faceDist = intersectPackedFace(face, segBeg, segDir, segLen);
 
-            if ( (!isnan(dist)) && (dist<minDist) ) {
+            if ( (!isnan(faceDist)) && (faceDist<minDist) ) {
                 
-                minDist       = dist;
+                minDist       = faceDist;
                 intFaceInd    = faceInd;
                 doesIntersect = true;
                 
-                if (dot(seg->dir,this->normalsOfFaces[faceInd])>0)
+                if (dot(seg->dir,face+9)>0)
                     towardsOutside = true;
                 else
                     towardsOutside = false;
             }
 
         }
-        // disp(MSG_DEBUG,"Face check done");
 
         dist = (minDist==DBL_MAX) ? NAN : minDist;
 
@@ -263,3 +324,14 @@ std::tuple<bool,bool,double,int,bool,double> NIBR::Surface::intersectSegment(con
     return std::make_tuple(begIsInside,endIsInside,dist,intFaceInd,towardsOutside,boundaryTransitionDist);
 
 }
+
+void NIBR::Surface::intersectSegment(const LineSegment* segs, std::size_t N, std::vector<std::tuple<bool,bool,double,int,bool,double>>& out)
+{
+    out.resize(N);
+
+    if (!enabledPointCheck && pointCheckIsStale) enablePointCheck(pointCheckGridRes);
+
+    NIBR::MT::MTRUN(N, [&](const NIBR::MT::TASK& task)->void {
+        out[task.no] = intersectSegment(&segs[task.no]);
+    });
+}
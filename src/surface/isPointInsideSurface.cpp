@@ -17,13 +17,27 @@ void NIBR::Surface::enablePointCheck(float gridRes) {
     calcNormalsOfFaces();
 
     pointCheckGridRes = gridRes;
-    mapSurface2Image(this,&maskAndBoundary,pointCheckGridRes,NULL,&grid,MASK_WITH_BOUNDARY);
+    mapSurface2Image(this,&maskAndBoundary,pointCheckGridRes,NULL,&gridFaceOffsets,&gridFaceIndices,MASK_WITH_BOUNDARY);
     maskAndBoundary.setInterpolationMethod(NEAREST);
 
+    // Pack face data used for segment intersection
+    if (triangleEdge1==NULL) calcTriangleVectors();
+    packedFaceData.resize(size_t(nf)*12);
+    for (int n = 0; n < nf; n++) {
+        float* d = &packedFaceData[size_t(n)*12];
+        for (int i = 0; i < 3; i++) {
+            d[i]   = vertices[faces[n][0]][i];
+            d[3+i] = triangleEdge1[n][i];
+            d[6+i] = triangleEdge2[n][i];
+            d[9+i] = normalsOfFaces[n][i];
+        }
+    }
+
     if (compClosedAndOpen[0].nv > 0) compClosedAndOpen[0].prepIglAABBTree();
     if (compClosedAndOpen[1].nv > 0) compClosedAndOpen[1].prepIglAABBTree();
 
     enabledPointCheck = true;
+    pointCheckIsStale = false;
     disp(MSG_DEBUG,"Done enablePointCheck()");
 
 }
@@ -155,3 +169,136 @@ short NIBR::Surface::whereIsPoint(float* p) {
     return (isOnBoundary()) ? BOUNDARY : OUTSIDE;
 
 }
+
+
+// Batched queries
+// The points are first classified using maskAndBoundary in parallel. Only the points that are close to the boundary
+// are collected and sent to libigl in a single call, which internally runs in parallel.
+
+namespace {
+
+    // Fills the first m rows of buf.Q with the points listed in inds. buf.Q only grows, so it is reused between calls.
+    void fillQueryPoints(NIBR::SurfacePointQueryBuffer& buf, const std::vector<int64_t>& inds, const float* x, const float* y, const float* z)
+    {
+        const int64_t m = inds.size();
+        if (buf.Q.rows() < m) buf.Q.resize(m,3);
+        for (int64_t k = 0; k < m; k++) {
+            buf.Q(k,0) = x[inds[k]];
+            buf.Q(k,1) = y[inds[k]];
+            buf.Q(k,2) = z[inds[k]];
+        }
+    }
+
+}
+
+void NIBR::Surface::isPointInside_basedOnWindingNumber(const float* x, const float* y, const float* z, std::size_t N, std::vector<uint8_t>& inside, SurfacePointQueryBuffer& buf)
+{
+    inside.assign(N,0);
+    if (N==0) return;
+
+    buf.candidates.resize(N);
+    for (std::size_t n = 0; n < N; n++) buf.candidates[n] = n;
+
+    fillQueryPoints(buf,buf.candidates,x,y,z);
+    igl::fast_winding_number(fwn_bvh,2,buf.Q.topRows(N),buf.W);
+
+    for (std::size_t n = 0; n < N; n++)
+        inside[n] = (buf.W(n) > 0.5);
+}
+
+void NIBR::Surface::isPointInside(const float* x, const float* y, const float* z, std::size_t N, std::vector<uint8_t>& inside, std::vector<double>& dist, SurfacePointQueryBuffer& buf)
+{
+    inside.assign(N,0);
+    dist.assign(N,DBL_MIN);
+
+    // Batched queries are not called from worker threads, so a grid released by refreshDerivedData() can be rebuilt here
+    if (!enabledPointCheck && pointCheckIsStale) enablePointCheck(pointCheckGridRes);
+
+    if (!enabledPointCheck) {
+        disp(MSG_FATAL, "enablePointCheck is not initialized");
+        return;
+    }
+
+    if (N==0) return;
+
+    // Classify the points using the mask
+    buf.vox.resize(N);
+    NIBR::MT::MTRUN(N, [&](const NIBR::MT::TASK& task)->void {
+        float p[3] = {x[task.no], y[task.no], z[task.no]};
+        float ijk[3];
+        maskAndBoundary.to_ijk(p,ijk);
+        buf.vox[task.no] = (maskAndBoundary)(int64_t(std::round(ijk[0])),int64_t(std::round(ijk[1])),int64_t(std::round(ijk[2])));
+    });
+
+    buf.candidates.clear();
+    for (std::size_t n = 0; n < N; n++) {
+        if (buf.vox[n] == OUTSIDE) continue;
+        if ((interpretAs2D == false) && (buf.vox[n] == INSIDE)) {
+            inside[n] = 1;
+            dist[n]   = DBL_MAX;
+            continue;
+        }
+        buf.candidates.push_back(n);
+    }
+
+    // Points close to the boundary are inside if they are within the surface thickness, as in isPointInside(p,dist,faceInd,closestPoint)
+    auto checkBoundary = [&](const std::vector<int64_t>& inds)->void {
+
+        if (inds.empty()) return;
+
+        fillQueryPoints(buf,inds,x,y,z);
+        AABB_tree.squared_distance(V,F,buf.Q.topRows(inds.size()),buf.sqrD,buf.I,buf.C);
+
+        NIBR::MT::MTRUN(inds.size(), [&](const NIBR::MT::TASK& task)->void {
+            const int64_t n       = inds[task.no];
+            const int     faceInd = buf.I(task.no);
+            float  p[3] = {x[n], y[n], z[n]};
+            double v[3];
+            vec3sub(v,vertices[faces[faceInd][0]],p);
+            double d = (dot(normalsOfFaces[faceInd],v) > 0.0) ? std::sqrt(buf.sqrD(task.no)) : -std::sqrt(buf.sqrD(task.no));
+
+            if (d < 0.0)                {inside[n] = 0; dist[n] = d;}
+            else if (d <= SURFTHICKNESS){inside[n] = 1; dist[n] = d;}
+            else                        {inside[n] = 0; dist[n] = -d;}
+        });
+
+    };
+
+    if (interpretAs2D) {
+        checkBoundary(buf.candidates);
+        return;
+    }
+
+    // If the surface has closed components
+    buf.remaining.clear();
+    if ((compClosedAndOpen[0].nv > 0) && !buf.candidates.empty()) {
+
+        fillQueryPoints(buf,buf.candidates,x,y,z);
+        igl::fast_winding_number(compClosedAndOpen[0].fwn_bvh,2,buf.Q.topRows(buf.candidates.size()),buf.W);
+
+        for (std::size_t k = 0; k < buf.candidates.size(); k++) {
+            if (buf.W(k) > 0.5) {
+                inside[buf.candidates[k]] = 1;
+                dist[buf.candidates[k]]   = DBL_MAX;
+            } else {
+                buf.remaining.push_back(buf.candidates[k]);
+            }
+        }
+
+    } else {
+        buf.remaining.swap(buf.candidates);
+    }
+
+    // If the surface has open components, the point is inside if it is within boundary
+    if (compClosedAndOpen[1].nv > 0) {
+        checkBoundary(buf.remaining);
+    }
+
+}
+
+void NIBR::Surface::isPointInside(const float* x, const float* y, const float* z, std::size_t N, std::vector<uint8_t>& inside)
+{
+    SurfacePointQueryBuffer buf;
+    std::vector<double>     dist;
+    isPointInside(x,y,z,N,inside,dist,buf);
+}
@@ -84,16 +84,26 @@ void NIBR::Surface::init() {
     area                = NAN;
     volume              = NAN;
 
+    neighboringVerticesOffsets = std::vector<int>();
+    neighboringVerticesIndices = std::vector<int>();
+    neighboringFacesOffsets    = std::vector<int>();
+    neighboringFacesIndices    = std::vector<int>();
+
     comp                = std::vector<Surface>();
+    compVertices        = std::vector<std::vector<int>>();
     compOpenOrClosed    = std::vector<OpenOrClosed>();
     compClosedAndOpen   = std::vector<Surface>();
     compArea            = std::vector<double>();
     compVolume          = std::vector<double>();
-    grid                = std::vector<std::vector<std::vector<std::vector<int>>>>();
+    gridFaceOffsets     = std::vector<int>();
+    gridFaceIndices     = std::vector<int>();
+    packedFaceData      = std::vector<float>();
     maskAndBoundary.clear();
     maskAndBoundary.setInterpolationMethod(NEAREST);
     enabledPointCheck   = false;
     pointCheckGridRes   = 0;
+    pointCheckIsStale   = false;
+    compIsStale         = false;
 
     edgesCategorized    = false;
     verticesCategorized = false;
@@ -127,6 +137,11 @@ NIBR::Surface::Surface(const Surface& obj) {
     copyFrom(obj);
 }
 
+NIBR::Surface::Surface(Surface&& obj) noexcept {
+    init();
+    moveFrom(obj);
+}
+
 NIBR::Surface::Surface(const Surface& obj, bool copyMeshOnly) {
     init();
 
@@ -137,20 +152,12 @@ NIBR::Surface::Surface(const Surface& obj, bool copyMeshOnly) {
 
         vertices = NULL;
         if (obj.vertices!=NULL) {
-            vertices = new float*[nv];
-            for (int n=0; n<nv; n++) {
-                vertices[n] = new float[3];
-                std::memcpy(vertices[n], obj.vertices[n], 3*sizeof(float));
-            }
+            vertices = copyRows3<float>(obj.vertices, nv);
         }
 
         faces = NULL;
         if (obj.faces!=NULL) {
-            faces = new int*[nf];
-            for (int n=0; n<nf; n++) {
-                faces[n] = new int[3];
-                std::memcpy(faces[n], obj.faces[n], 3*sizeof(int));
-            }
+            faces = copyRows3<int>(obj.faces, nf);
         }
 
     } else {
@@ -171,17 +178,15 @@ NIBR::Surface::Surface(std::vector<std::vector<float>>& vertexList, std::vector<
     manifoldOrNot       = MANIFOLDORNOT;
     interpretAs2D       = false;
 
-    vertices = new float*[nv];
+    vertices = allocateRows3<float>(nv);
     for (int n = 0; n < nv; n++) {
-        vertices[n]    = new float[3];
         vertices[n][0] = vertexList[n][0];
         vertices[n][1] = vertexList[n][1];
         vertices[n][2] = vertexList[n][2];
     }
 
-    faces    = new int*[nf];
+    faces    = allocateRows3<int>(nf);
     for (int n = 0; n < nf; n++) {
-        faces[n]    = new int[3];
         faces[n][0] = faceList[n][0];
         faces[n][1] = faceList[n][1];
         faces[n][2] = faceList[n][2];
@@ -197,6 +202,14 @@ NIBR::Surface& NIBR::Surface::operator=(const Surface &obj) {
     return *this;
 }
 
+NIBR::Surface& NIBR::Surface::operator=(Surface&& obj) noexcept {
+
+    if(this != &obj) { // protect against self-assignment
+        moveFrom(obj);
+    }
+    return *this;
+}
+
 void NIBR::Surface::copyMeshFrom(const Surface& obj)
 {
     if(this != &obj) { // protect against self-assignment
@@ -208,20 +221,12 @@ void NIBR::Surface::copyMeshFrom(const Surface& obj)
 
         vertices = NULL;
         if (obj.vertices!=NULL) {
-            vertices = new float*[nv];
-            for (int n=0; n<nv; n++) {
-                vertices[n] = new float[3];
-                std::memcpy(vertices[n], obj.vertices[n], 3*sizeof(float));
-            }
+            vertices = copyRows3<float>(obj.vertices, nv);
         }
 
         faces = NULL;
         if (obj.faces!=NULL) {
-            faces = new int*[nf];
-            for (int n=0; n<nf; n++) {
-                faces[n] = new int[3];
-                std::memcpy(faces[n], obj.faces[n], 3*sizeof(int));
-            }
+            faces = copyRows3<int>(obj.faces, nf);
         }
 
     } else {
@@ -248,38 +253,22 @@ void NIBR::Surface::copyFrom(const Surface& obj)
 
     vertices = NULL;
     if (obj.vertices!=NULL) {
-        vertices = new float*[nv];
-        for (int n=0; n<nv; n++) {
-            vertices[n] = new float[3];
-            std::memcpy(vertices[n], obj.vertices[n], 3*sizeof(float));
-        }
+        vertices = copyRows3<float>(obj.vertices, nv);
     }
 
     faces = NULL;
     if (obj.faces!=NULL) {
-        faces = new int*[nf];
-        for (int n=0; n<nf; n++) {
-            faces[n] = new int[3];
-            std::memcpy(faces[n], obj.faces[n], 3*sizeof(int));
-        }
+        faces = copyRows3<int>(obj.faces, nf);
     }
 
     centersOfFaces = NULL;
     if (obj.centersOfFaces!=NULL) {
-        centersOfFaces = new float*[nf];
-        for (int n=0; n<nf; n++) {
-            centersOfFaces[n] = new float[3];
-            std::memcpy(centersOfFaces[n], obj.centersOfFaces[n], 3*sizeof(float));
-        }
+        centersOfFaces = copyRows3<float>(obj.centersOfFaces, nf);
     }
 
     normalsOfFaces = NULL;
     if (obj.normalsOfFaces!=NULL) {
-        normalsOfFaces = new float*[nf];
-        for (int n=0; n<nf; n++) {
-            normalsOfFaces[n] = new float[3];
-            std::memcpy(normalsOfFaces[n], obj.normalsOfFaces[n], 3*sizeof(float));
-        }
+        normalsOfFaces = copyRows3<float>(obj.normalsOfFaces, nf);
     }
 
     areasOfFaces = NULL;
@@ -290,47 +279,27 @@ void NIBR::Surface::copyFrom(const Surface& obj)
 
     normalsOfVertices = NULL;
     if (obj.normalsOfVertices!=NULL) {
-        normalsOfVertices = new float*[nv];
-        for (int n=0; n<nv; n++) {
-            normalsOfVertices[n] = new float[3];
-            std::memcpy(normalsOfVertices[n], obj.normalsOfVertices[n], 3*sizeof(float));
-        }
+        normalsOfVertices = copyRows3<float>(obj.normalsOfVertices, nv);
     }
 
     triangleNormal = NULL;
     if (obj.triangleNormal!=NULL) {
-        triangleNormal = new float*[nf];
-        for (int n=0; n<nf; n++) {
-            triangleNormal[n] = new float[3];
-            std::memcpy(triangleNormal[n], obj.triangleNormal[n], 3*sizeof(float));
-        }
+        triangleNormal = copyRows3<float>(obj.triangleNormal, nf);
     }
 
     triangleEdge0 = NULL;
     if (obj.triangleEdge0!=NULL) {
-        triangleEdge0 = new float*[nf];
-        for (int n=0; n<nf; n++) {
-            triangleEdge0[n] = new float[3];
-            std::memcpy(triangleEdge0[n], obj.triangleEdge0[n], 3*sizeof(float));
-        }
+        triangleEdge0 = copyRows3<float>(obj.triangleEdge0, nf);
     }
 
     triangleEdge1 = NULL;
     if (obj.triangleEdge1!=NULL) {
-        triangleEdge1 = new float*[nf];
-        for (int n=0; n<nf; n++) {
-            triangleEdge1[n] = new float[3];
-            std::memcpy(triangleEdge1[n], obj.triangleEdge1[n], 3*sizeof(float));
-        }
+        triangleEdge1 = copyRows3<float>(obj.triangleEdge1, nf);
     }
 
     triangleEdge2 = NULL;
     if (obj.triangleEdge2!=NULL) {
-        triangleEdge2 = new float*[nf];
-        for (int n=0; n<nf; n++) {
-            triangleEdge2[n] = new float[3];
-            std::memcpy(triangleEdge2[n], obj.triangleEdge2[n], 3*sizeof(float));
-        }
+        triangleEdge2 = copyRows3<float>(obj.triangleEdge2, nf);
     }
 
     neighboringVertices = NULL;
@@ -349,6 +318,11 @@ void NIBR::Surface::copyFrom(const Surface& obj)
         }
     }
 
+    neighboringVerticesOffsets = obj.neighboringVerticesOffsets;
+    neighboringVerticesIndices = obj.neighboringVerticesIndices;
+    neighboringFacesOffsets    = obj.neighboringFacesOffsets;
+    neighboringFacesIndices    = obj.neighboringFacesIndices;
+
     gaussianCurvature = NULL;
     if (obj.gaussianCurvature!=NULL) {
         gaussianCurvature = new float[nv];
@@ -370,15 +344,20 @@ void NIBR::Surface::copyFrom(const Surface& obj)
     }
 
     comp                = obj.comp;
+    compVertices        = obj.compVertices;
     compOpenOrClosed    = obj.compOpenOrClosed;
     compClosedAndOpen   = obj.compClosedAndOpen;
     compArea            = obj.compArea;
     compVolume          = obj.compVolume;
-    grid                = obj.grid;
+    gridFaceOffsets     = obj.gridFaceOffsets;
+    gridFaceIndices     = obj.gridFaceIndices;
+    packedFaceData      = obj.packedFaceData;
     maskAndBoundary     = obj.maskAndBoundary;
     maskAndBoundary.setInterpolationMethod(NEAREST);
     enabledPointCheck   = obj.enabledPointCheck;
     pointCheckGridRes   = obj.pointCheckGridRes;
+    pointCheckIsStale   = obj.pointCheckIsStale;
+    compIsStale         = obj.compIsStale;
 
     edgesCategorized        = obj.edgesCategorized;
     verticesCategorized     = obj.verticesCategorized;
@@ -395,6 +374,93 @@ void NIBR::Surface::copyFrom(const Surface& obj)
 
 }
 
+// Pointers and containers are taken over without copying. obj is left as an empty surface.
+// igl trees are not moved, they are rebuilt when needed, as it is done after copyFrom.
+void NIBR::Surface::moveFrom(Surface& obj)
+{
+
+    clear();
+    fields.clear();
+
+    nv 			         = obj.nv;
+	nf 			         = obj.nf;
+    ne                   = obj.ne;
+    openOrClosed         = obj.openOrClosed;
+    manifoldOrNot        = obj.manifoldOrNot;
+    interpretAs2D        = obj.interpretAs2D;
+    area                 = obj.area;
+    volume               = obj.volume;
+    filePath 		     = std::move(obj.filePath);
+    extension            = std::move(obj.extension);
+
+    vertices             = obj.vertices;
+    faces                = obj.faces;
+    centersOfFaces       = obj.centersOfFaces;
+    normalsOfFaces       = obj.normalsOfFaces;
+    areasOfFaces         = obj.areasOfFaces;
+    normalsOfVertices    = obj.normalsOfVertices;
+    triangleNormal       = obj.triangleNormal;
+    triangleEdge0        = obj.triangleEdge0;
+    triangleEdge1        = obj.triangleEdge1;
+    triangleEdge2        = obj.triangleEdge2;
+    neighboringVertices  = obj.neighboringVertices;
+    neighboringFaces     = obj.neighboringFaces;
+    gaussianCurvature    = obj.gaussianCurvature;
+    meanCurvature        = obj.meanCurvature;
+
+    V                    = std::move(obj.V);
+    F                    = std::move(obj.F);
+
+    neighboringVerticesOffsets = std::move(obj.neighboringVerticesOffsets);
+    neighboringVerticesIndices = std::move(obj.neighboringVerticesIndices);
+    neighboringFacesOffsets    = std::move(obj.neighboringFacesOffsets);
+    neighboringFacesIndices    = std::move(obj.neighboringFacesIndices);
+
+    // Field data is owned through raw pointers, so the structs are simply handed over
+    fields               = std::move(obj.fields);
+
+    comp                 = std::move(obj.comp);
+    compVertices         = std::move(obj.compVertices);
+    compOpenOrClosed     = std::move(obj.compOpenOrClosed);
+    compClosedAndOpen    = std::move(obj.compClosedAndOpen);
+    compArea             = std::move(obj.compArea);
+    compVolume           = std::move(obj.compVolume);
+    gridFaceOffsets      = std::move(obj.gridFaceOffsets);
+    gridFaceIndices      = std::move(obj.gridFaceIndices);
+    packedFaceData       = std::move(obj.packedFaceData);
+    if (obj.enabledPointCheck) {
+        maskAndBoundary  = obj.maskAndBoundary;
+        maskAndBoundary.setInterpolationMethod(NEAREST);
+    }
+    enabledPointCheck    = obj.enabledPointCheck;
+    pointCheckGridRes    = obj.pointCheckGridRes;
+    pointCheckIsStale    = obj.pointCheckIsStale;
+    compIsStale          = obj.compIsStale;
+
+    edgesCategorized     = obj.edgesCategorized;
+    verticesCategorized  = obj.verticesCategorized;
+
+    singularVertices      = std::move(obj.singularVertices);
+    boundaryVertices      = std::move(obj.boundaryVertices);
+    overconnectedVertices = std::move(obj.overconnectedVertices);
+    boundaryEdges         = std::move(obj.boundaryEdges);
+    overconnectedEdges    = std::move(obj.overconnectedEdges);
+
+    boundaries            = std::move(obj.boundaries);
+    boundaryLengths       = std::move(obj.boundaryLengths);
+    boundaryAreas         = std::move(obj.boundaryAreas);
+
+    // Everything is owned by this surface now. init() only resets obj, it does not release anything.
+    obj.fields.clear();
+    obj.maskAndBoundary.clear();
+    obj.fwn_bvh.F.clear();
+    obj.V         = Eigen::MatrixXd();
+    obj.F         = Eigen::MatrixXi();
+    obj.AABB_tree = igl::AABB<Eigen::MatrixXd,3>();
+    obj.init();
+
+}
+
 NIBR::Surface::~Surface() { 
     clear();
 }
@@ -403,22 +469,8 @@ void NIBR::Surface::clear() {
 
     reset();
 
-    if (vertices!=NULL) {
-        for (int n=0; n<nv; n++) {
-            delete[] vertices[n];
-        }
-        delete[] vertices;
-    }
-    
-    if (faces!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] faces[n];
-        }
-        delete[] faces;
-    }
-
-    vertices = NULL;
-    faces    = NULL;
+    freeRows3(vertices);
+    freeRows3(faces);
 
     nv = 0;
     nf = 0;
@@ -432,27 +484,14 @@ void Surface::reset() {
     filePath.clear();
     extension.clear();
    
-    if (centersOfFaces!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] centersOfFaces[n];
-        }
-        delete[] centersOfFaces;
-    }
+    freeRows3(centersOfFaces);
     
     if (normalsOfFaces!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] normalsOfFaces[n];
-        }
-        delete[] normalsOfFaces;
+        freeRows3(normalsOfFaces);
         delete[] areasOfFaces;
     }
     
-    if (normalsOfVertices!=NULL) {
-        for (int n=0; n<nv; n++) {
-            delete[] normalsOfVertices[n];
-        }
-        delete[] normalsOfVertices;
-    }
+    freeRows3(normalsOfVertices);
     
     if (neighboringVertices!=NULL) {
         delete[] neighboringVertices;
@@ -462,33 +501,10 @@ void Surface::reset() {
         delete[] neighboringFaces;
     }
     
-    if (triangleNormal!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] triangleNormal[n];
-        }
-        delete[] triangleNormal;
-    }
-    
-    if (triangleEdge0!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] triangleEdge0[n];
-        }
-        delete[] triangleEdge0;
-    }
-    
-    if (triangleEdge1!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] triangleEdge1[n];
-        }
-        delete[] triangleEdge1;
-    }
-    
-    if (triangleEdge2!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] triangleEdge2[n];
-        }
-        delete[] triangleEdge2;
-    }
+    freeRows3(triangleNormal);
+    freeRows3(triangleEdge0);
+    freeRows3(triangleEdge1);
+    freeRows3(triangleEdge2);
 
     if (gaussianCurvature!=NULL) {
         delete[] gaussianCurvature;
@@ -510,6 +526,7 @@ void Surface::reset() {
     V = Eigen::MatrixXd();
     F = Eigen::MatrixXi();
     AABB_tree = igl::AABB<Eigen::MatrixXd,3>();
+    fwn_bvh.F.clear();
 
     centersOfFaces      = NULL;
     normalsOfFaces      = NULL;
@@ -526,16 +543,26 @@ void Surface::reset() {
     area                = NAN;
     volume              = NAN;
 
+    neighboringVerticesOffsets.clear();
+    neighboringVerticesIndices.clear();
+    neighboringFacesOffsets.clear();
+    neighboringFacesIndices.clear();
+
     comp.clear();
+    compVertices.clear();
     compOpenOrClosed.clear();
     compClosedAndOpen.clear();
     compArea.clear();
     compVolume.clear();
-    grid.clear();
+    gridFaceOffsets.clear();
+    gridFaceIndices.clear();
+    packedFaceData.clear();
     maskAndBoundary.clear();
     maskAndBoundary.setInterpolationMethod(NEAREST);
     enabledPointCheck = false;
     pointCheckGridRes = 0;
+    pointCheckIsStale = false;
+    compIsStale       = false;
 
     edgesCategorized    = false;
     verticesCategorized = false;
@@ -658,21 +685,9 @@ void NIBR::Surface::toEigen() {
         return;
     }
         
-    // Convert vertices to Eigen matrix
-    V.resize(nv, 3);
-    for (int i = 0; i < nv; i++) {
-        V(i, 0) = vertices[i][0];
-        V(i, 1) = vertices[i][1];
-        V(i, 2) = vertices[i][2];
-    }
-
-    // Convert faces to Eigen matrix
-    F.resize(nf, 3);
-    for (int i = 0; i < nf; i++) {
-        F(i, 0) = faces[i][0];
-        F(i, 1) = faces[i][1];
-        F(i, 2) = faces[i][2];
-    }
+    // Vertices and faces are contiguous, so these are single vectorized copies
+    V = vertexMap().cast<double>();
+    F = faceMap();
 
     // disp(MSG_DEBUG,"Done toEigen()");
 }
@@ -681,47 +696,26 @@ void NIBR::Surface::fromEigen() {
 
     // disp(MSG_DEBUG,"fromEigen()");
 
-    // Delete existing vertices
-    if (vertices != NULL) {
-        for (int n = 0; n < nv; n++) {
-            delete[] vertices[n];
-        }
-        delete[] vertices;
-        vertices = NULL;
-    }
+    allocateVertices(V.rows());
+    vertexMap() = V.cast<float>();
 
-    nv = V.rows();
+    allocateFaces(F.rows());
+    faceMap() = F;
 
-    vertices = new float*[nv];
-    for (int i = 0; i < nv; i++) {
-        vertices[i]    = new float[3];
-        vertices[i][0] = V(i, 0);
-        vertices[i][1] = V(i, 1);
-        vertices[i][2] = V(i, 2);
-    }
 
-    // Delete existing faces
-    if (faces != NULL) {
-        for (int n = 0; n < nf; n++) {
-            delete[] faces[n]; // Delete each face array
-        }
-        delete[] faces; // Delete the array of face pointers
-        faces = NULL;
-    }
-
-    nf = F.rows();
+    // disp(MSG_DEBUG,"Done fromEigen()");
+}
 
-    faces = new int*[nf];
-    
-    for (int i = 0; i < nf; i++) {
-        faces[i]    = new int[3];
-        faces[i][0] = F(i, 0);
-        faces[i][1] = F(i, 1);
-        faces[i][2] = F(i, 2);
-    }
-    
+void NIBR::Surface::allocateVertices(int _nv) {
+    freeRows3(vertices);
+    nv       = std::max(_nv,0);
+    vertices = allocateRows3<float>(nv);
+}
 
-    // disp(MSG_DEBUG,"Done fromEigen()");
+void NIBR::Surface::allocateFaces(int _nf) {
+    freeRows3(faces);
+    nf    = std::max(_nf,0);
+    faces = allocateRows3<int>(nf);
 }
 
 void NIBR::Surface::prepIglAABBTree() {
@@ -743,72 +737,65 @@ void NIBR::Surface::prepIglAABBTree() {
     // disp(MSG_DEBUG,"Done prepIglAABBTree()");
 }
 
+void NIBR::Surface::calcCenterOfFace(int n) {
+    for (int i=0; i<3; i++) {
+        centersOfFaces[n][i] = (vertices[faces[n][0]][i] + vertices[faces[n][1]][i] + vertices[faces[n][2]][i]) / 3.0;
+    }
+}
+
 void NIBR::Surface::calcCentersOfFaces() {
 
-    if (centersOfFaces!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] centersOfFaces[n];
-        }
-        delete[] centersOfFaces;
-    }
+    freeRows3(centersOfFaces);
     
-    centersOfFaces = new float*[nf];
-    for (int n=0; n<nf; n++) {
-        centersOfFaces[n] = new float[3];
-        for (int i=0; i<3; i++) {
-            centersOfFaces[n][i] = (vertices[faces[n][0]][i] + vertices[faces[n][1]][i] + vertices[faces[n][2]][i]) / 3.0;
-        }
-    }
+    centersOfFaces = allocateRows3<float>(nf);
+    NIBR::MT::MTRUN(nf, [&](const NIBR::MT::TASK& task)->void {calcCenterOfFace(task.no);});
     
 }
 
-void NIBR::Surface::calcNormalsOfFaces() {
-    
+void NIBR::Surface::calcNormalOfFace(int n) {
+
     float  v1[3];
     float  v2[3];
-    float* p1;
-    float* p2;
-    float* p3;
+
+    float* p1 = vertices[faces[n][0]];
+    float* p2 = vertices[faces[n][1]];
+    float* p3 = vertices[faces[n][2]];
+    
+    for (int i=0; i<3; i++) {
+        v1[i] = p2[i] - p1[i];
+        v2[i] = p3[i] - p1[i]; 
+    }
+    
+    normalsOfFaces[n][0] = v1[1]*v2[2] - v1[2]*v2[1];
+    normalsOfFaces[n][1] = v1[2]*v2[0] - v1[0]*v2[2];
+    normalsOfFaces[n][2] = v1[0]*v2[1] - v1[1]*v2[0];
+
+    double norm = std::sqrt(double(normalsOfFaces[n][0]*normalsOfFaces[n][0] + normalsOfFaces[n][1]*normalsOfFaces[n][1] + normalsOfFaces[n][2]*normalsOfFaces[n][2]));
+
+    areasOfFaces[n] = norm * 0.5;
+
+    normalsOfFaces[n][0] /= norm;
+    normalsOfFaces[n][1] /= norm;
+    normalsOfFaces[n][2] /= norm;
+
+}
+
+void NIBR::Surface::calcNormalsOfFaces() {
 
     if (normalsOfFaces!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] normalsOfFaces[n];
-        }
-        delete[] normalsOfFaces;
+        freeRows3(normalsOfFaces);
         delete[] areasOfFaces;
     }
     
-    
-    normalsOfFaces = new float*[nf];
+    normalsOfFaces = allocateRows3<float>(nf);
     areasOfFaces   = new float[nf];
-    area           = 0;
-    
-    for (int n=0; n<nf; n++) {
-        
-        p1 = vertices[faces[n][0]];
-        p2 = vertices[faces[n][1]];
-        p3 = vertices[faces[n][2]];
-        
-        for (int i=0; i<3; i++) {
-            v1[i] = p2[i] - p1[i];
-            v2[i] = p3[i] - p1[i]; 
-        }
-        
-        normalsOfFaces[n] = new float[3];
-        
-        normalsOfFaces[n][0] = v1[1]*v2[2] - v1[2]*v2[1];
-        normalsOfFaces[n][1] = v1[2]*v2[0] - v1[0]*v2[2];
-        normalsOfFaces[n][2] = v1[0]*v2[1] - v1[1]*v2[0];
 
-        double norm = std::sqrt(double(normalsOfFaces[n][0]*normalsOfFaces[n][0] + normalsOfFaces[n][1]*normalsOfFaces[n][1] + normalsOfFaces[n][2]*normalsOfFaces[n][2]));
+    NIBR::MT::MTRUN(nf, [&](const NIBR::MT::TASK& task)->void {calcNormalOfFace(task.no);});
 
-        areasOfFaces[n] = norm * 0.5;
+    // Summed in face order, so that the area does not depend on the number of threads
+    area = 0;
+    for (int n=0; n<nf; n++) {
         area += areasOfFaces[n];
-
-        normalsOfFaces[n][0] /= norm;
-        normalsOfFaces[n][1] /= norm;
-        normalsOfFaces[n][2] /= norm;
-        
     }
     
 }
@@ -830,63 +817,146 @@ void NIBR::Surface::getNeighboringVertices() {
 
     // disp(MSG_DEBUG,"getNeighboringVertices()");
     if (neighboringVertices!=NULL) return;
+
+    // The sets are filled in parallel from the sorted CSR lists
+    getNeighboringVerticesCSR();
     
     neighboringVertices = new std::set<int>[nv];
     
+    NIBR::MT::MTRUN(nv, [&](const NIBR::MT::TASK& task)->void {
+        neighboringVertices[task.no].insert(neighboringVerticesIndices.begin()+neighboringVerticesOffsets[task.no], neighboringVerticesIndices.begin()+neighboringVerticesOffsets[task.no+1]);
+    });
+    // disp(MSG_DEBUG,"Done getNeighboringVertices()");
+}
+
+void NIBR::Surface::getNeighboringVerticesCSR() {
+
+    if (!neighboringVerticesOffsets.empty()) return;
+
+    // Count the (possibly repeated) neighbors of each vertex
+    std::vector<int> cnt(nv+1,0);
     for (int n=0; n<nf; n++) {
-        neighboringVertices[faces[n][0]].insert(faces[n][1]);
-        neighboringVertices[faces[n][0]].insert(faces[n][2]);
-        neighboringVertices[faces[n][1]].insert(faces[n][0]);
-        neighboringVertices[faces[n][1]].insert(faces[n][2]);
-        neighboringVertices[faces[n][2]].insert(faces[n][0]);
-        neighboringVertices[faces[n][2]].insert(faces[n][1]);
+        cnt[faces[n][0]+1] += 2;
+        cnt[faces[n][1]+1] += 2;
+        cnt[faces[n][2]+1] += 2;
     }
-    // disp(MSG_DEBUG,"Done getNeighboringVertices()");
+    for (int n=0; n<nv; n++) {
+        cnt[n+1] += cnt[n];
+    }
+
+    std::vector<int> tmp(cnt[nv]);
+    std::vector<int> pos(cnt.begin(),cnt.end()-1);
+    for (int n=0; n<nf; n++) {
+        for (int i=0; i<3; i++) {
+            int v = faces[n][i];
+            tmp[pos[v]++] = faces[n][(i+1)%3];
+            tmp[pos[v]++] = faces[n][(i+2)%3];
+        }
+    }
+
+    // Sort and remove the repeated neighbors
+    std::vector<int> uniqueCnt(nv,0);
+    auto makeUnique = [&](const NIBR::MT::TASK& task)->void {
+        auto beg = tmp.begin() + cnt[task.no];
+        auto end = tmp.begin() + cnt[task.no+1];
+        std::sort(beg,end);
+        uniqueCnt[task.no] = std::distance(beg,std::unique(beg,end));
+    };
+    NIBR::MT::MTRUN(nv, makeUnique);
+
+    neighboringVerticesOffsets.resize(nv+1);
+    neighboringVerticesOffsets[0] = 0;
+    for (int n=0; n<nv; n++) {
+        neighboringVerticesOffsets[n+1] = neighboringVerticesOffsets[n] + uniqueCnt[n];
+    }
+
+    neighboringVerticesIndices.resize(neighboringVerticesOffsets[nv]);
+    for (int n=0; n<nv; n++) {
+        std::copy(tmp.begin()+cnt[n], tmp.begin()+cnt[n]+uniqueCnt[n], neighboringVerticesIndices.begin()+neighboringVerticesOffsets[n]);
+    }
+
 }
 
 void NIBR::Surface::getNeighboringFaces() {
 
     if (neighboringFaces!=NULL) return;
+
+    // The sets are filled in parallel from the sorted CSR lists
+    getNeighboringFacesCSR();
     
     neighboringFaces = new std::set<int>[nv];
     
+    NIBR::MT::MTRUN(nv, [&](const NIBR::MT::TASK& task)->void {
+        neighboringFaces[task.no].insert(neighboringFacesIndices.begin()+neighboringFacesOffsets[task.no], neighboringFacesIndices.begin()+neighboringFacesOffsets[task.no+1]);
+    });
+    
+}
+
+void NIBR::Surface::getNeighboringFacesCSR() {
+
+    if (!neighboringFacesOffsets.empty()) return;
+
+    // A vertex repeated within a degenerate face is counted once, as in getNeighboringFaces()
+    auto isRepeated = [&](int n, int i)->bool {
+        for (int j=0; j<i; j++)
+            if (faces[n][j]==faces[n][i]) return true;
+        return false;
+    };
+
+    neighboringFacesOffsets.assign(nv+1,0);
     for (int n=0; n<nf; n++) {
-        neighboringFaces[faces[n][0]].insert(n);
-        neighboringFaces[faces[n][1]].insert(n);
-        neighboringFaces[faces[n][2]].insert(n);
+        for (int i=0; i<3; i++) {
+            if (!isRepeated(n,i)) neighboringFacesOffsets[faces[n][i]+1]++;
+        }
     }
-    
+    for (int n=0; n<nv; n++) {
+        neighboringFacesOffsets[n+1] += neighboringFacesOffsets[n];
+    }
+
+    // Faces are visited in increasing order, so each list comes out sorted
+    neighboringFacesIndices.resize(neighboringFacesOffsets[nv]);
+    std::vector<int> pos(neighboringFacesOffsets.begin(),neighboringFacesOffsets.end()-1);
+    for (int n=0; n<nf; n++) {
+        for (int i=0; i<3; i++) {
+            if (!isRepeated(n,i)) neighboringFacesIndices[pos[faces[n][i]]++] = n;
+        }
+    }
+
 }
 
 void NIBR::Surface::calcNormalsOfVertices() {
     
     if (normalsOfVertices != NULL) return;
     if (normalsOfFaces    == NULL) calcNormalsOfFaces();
-    if (neighboringFaces  == NULL) getNeighboringFaces();
+    getNeighboringFacesCSR();
     
-    normalsOfVertices = new float*[nv];
+    normalsOfVertices = allocateRows3<float>(nv);
+    NIBR::MT::MTRUN(nv, [&](const NIBR::MT::TASK& task)->void {calcNormalOfVertex(task.no);});
     
-    for (int n=0; n<nv; n++) {
-        
-        normalsOfVertices[n]    = new float[3];
-        
-        for (std::set<int>::iterator it=neighboringFaces[n].begin(); it!=neighboringFaces[n].end(); ++it) {
-            normalsOfVertices[n][0] += normalsOfFaces[*it][0];
-            normalsOfVertices[n][1] += normalsOfFaces[*it][1];
-            normalsOfVertices[n][2] += normalsOfFaces[*it][2];
-        }
-        
-        float s = neighboringFaces[n].size();
-        if (s>0) {
-            normalsOfVertices[n][0] /= s;
-            normalsOfVertices[n][1] /= s;
-            normalsOfVertices[n][2] /= s;
-        }
-        
-        normalize(normalsOfVertices[n]);
+}
+
+void NIBR::Surface::calcNormalOfVertex(int n) {
+
+    normalsOfVertices[n][0] = 0;
+    normalsOfVertices[n][1] = 0;
+    normalsOfVertices[n][2] = 0;
         
+    for (int k=neighboringFacesOffsets[n]; k<neighboringFacesOffsets[n+1]; k++) {
+        const int f = neighboringFacesIndices[k];
+        normalsOfVertices[n][0] += normalsOfFaces[f][0];
+        normalsOfVertices[n][1] += normalsOfFaces[f][1];
+        normalsOfVertices[n][2] += normalsOfFaces[f][2];
+    }
+    
+    float s = neighboringFacesOffsets[n+1] - neighboringFacesOffsets[n];
+    if (s>0) {
+        normalsOfVertices[n][0] /= s;
+        normalsOfVertices[n][1] /= s;
+        normalsOfVertices[n][2] /= s;
     }
     
+    normalize(normalsOfVertices[n]);
+
 }
 
 void NIBR::Surface::applyAffineTransform(float** affT) {
@@ -905,6 +975,8 @@ void NIBR::Surface::applyAffineTransform(float** affT) {
         
         
     }
+
+    refreshDerivedData();
     
 }
 
@@ -966,53 +1038,87 @@ void NIBR::Surface::calcMeanCurvature() {
 
 
 
-void NIBR::Surface::calcTriangleVectors() {
+void NIBR::Surface::calcTriangleVectorsOfFace(int n) {
+
+    float* p0 = vertices[faces[n][0]];
+    float* p1 = vertices[faces[n][1]];
+    float* p2 = vertices[faces[n][2]];
     
-    float* p0;
-    float* p1;
-    float* p2;
-
-    if (triangleNormal!=NULL) {
-        for (int n=0; n<nf; n++) {
-            delete[] triangleNormal[n];
-            delete[] triangleEdge0[n];
-            delete[] triangleEdge1[n];
-            delete[] triangleEdge2[n];
-        }
-        delete[] triangleNormal;
-        delete[] triangleEdge0;
-        delete[] triangleEdge1;
-        delete[] triangleEdge2;
+    for (int i=0; i<3; i++) {
+        triangleEdge0[n][i] = p1[i] - p2[i];
+        triangleEdge1[n][i] = p1[i] - p0[i];
+        triangleEdge2[n][i] = p2[i] - p0[i];
     }
     
-    triangleNormal = new float*[nf];
-    triangleEdge0  = new float*[nf];
-    triangleEdge1  = new float*[nf];
-    triangleEdge2  = new float*[nf];
+    cross(triangleNormal[n],triangleEdge1[n],triangleEdge2[n]);
+
+}
+
+void NIBR::Surface::calcTriangleVectors() {
+
+    freeRows3(triangleNormal);
+    freeRows3(triangleEdge0);
+    freeRows3(triangleEdge1);
+    freeRows3(triangleEdge2);
     
-    for (int n=0; n<nf; n++) {
-        
-        triangleNormal[n] = new float[3];
-        triangleEdge0[n]  = new float[3];
-        triangleEdge1[n]  = new float[3];
-        triangleEdge2[n]  = new float[3];
-        
-        p0 = vertices[faces[n][0]];
-        p1 = vertices[faces[n][1]];
-        p2 = vertices[faces[n][2]];
-        
-        for (int i=0; i<3; i++) {
-            triangleEdge0[n][i] = p1[i] - p2[i];
-            triangleEdge1[n][i] = p1[i] - p0[i];
-            triangleEdge2[n][i] = p2[i] - p0[i];
-        }
-        
-        cross(triangleNormal[n],triangleEdge1[n],triangleEdge2[n]);
-    }
+    triangleNormal = allocateRows3<float>(nf);
+    triangleEdge0  = allocateRows3<float>(nf);
+    triangleEdge1  = allocateRows3<float>(nf);
+    triangleEdge2  = allocateRows3<float>(nf);
+    
+    NIBR::MT::MTRUN(nf, [&](const NIBR::MT::TASK& task)->void {calcTriangleVectorsOfFace(task.no);});
 
     // disp(MSG_DEBUG,"Triangle vectors computed");
 }
 
+void NIBR::Surface::releaseVertexDependentData() {
+
+    if (gaussianCurvature!=NULL) {delete[] gaussianCurvature; gaussianCurvature = NULL;}
+    if (meanCurvature!=NULL)     {delete[] meanCurvature;     meanCurvature     = NULL;}
+
+    volume = NAN;
+
+    V = Eigen::MatrixXd();
+    F = Eigen::MatrixXi();
+    AABB_tree = igl::AABB<Eigen::MatrixXd,3>();
+    fwn_bvh.F.clear(); // so that prepIglAABBTree() rebuilds the tree
+
+    // comp, compOpenOrClosed and boundaries only depend on the connectivity.
+    // Vertices of comp are updated by getConnectedComponents() when the components are requested again.
+    if (!comp.empty()) compIsStale = true;
+    compClosedAndOpen.clear();
+    compArea.clear();
+    compVolume.clear();
+
+    // The grid is rebuilt with the same resolution by the next enablePointCheck() or batched point query
+    if (enabledPointCheck) pointCheckIsStale = true;
+    gridFaceOffsets.clear();
+    gridFaceIndices.clear();
+    packedFaceData.clear();
+    maskAndBoundary.clear();
+    maskAndBoundary.setInterpolationMethod(NEAREST);
+    enabledPointCheck = false;
+
+    boundaryLengths.clear();
+    boundaryAreas.clear();
+
+}
+
+void NIBR::Surface::refreshDerivedData() {
+
+    if (centersOfFaces!=NULL) calcCentersOfFaces();
+    if (normalsOfFaces!=NULL) calcNormalsOfFaces();
+    if (triangleEdge0 !=NULL) calcTriangleVectors();
+
+    if (normalsOfVertices!=NULL) {
+        if (normalsOfFaces==NULL) calcNormalsOfFaces();
+        NIBR::MT::MTRUN(nv, [&](const NIBR::MT::TASK& task)->void {calcNormalOfVertex(task.no);});
+    }
+
+    releaseVertexDependentData();
+
+}
+
 struct edge_pair_hash {
     template <class T1, class T2>
     std::size_t operator () (const std::pair<T1,T2>& pair) const {
@@ -1159,8 +1265,10 @@ void Surface::computeBoundaries() {
 
     // disp(MSG_DEBUG, "computeBoundaries");
 
-    if (!boundaries.empty())
+    if (!boundaries.empty()) {
+        if (boundaryLengths.size() != boundaries.size()) calcBoundaryLengthsAndAreas(); // vertices were moved
         return;
+    }
     
     categorizeVertices();
 
@@ -1203,7 +1311,16 @@ void Surface::computeBoundaries() {
         }
     }
 
-    // Find boundary lengths and areas
+    calcBoundaryLengthsAndAreas();
+
+    // disp(MSG_DEBUG, "Done computeBoundaries");
+}
+
+void Surface::calcBoundaryLengthsAndAreas() {
+
+    boundaryLengths.clear();
+    boundaryAreas.clear();
+
     for (auto& boundary : boundaries) {
 
         // disp(MSG_DEBUG, "Processing boundary %d with size %d", b++, boundary.size());
@@ -1225,5 +1342,4 @@ void Surface::computeBoundaries() {
 
     }
 
-    // disp(MSG_DEBUG, "Done computeBoundaries");
 }
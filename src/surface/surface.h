@@ -122,6 +122,68 @@ namespace NIBR
         int **idata{NULL};
     };
 
+    // Mesh arrays (vertices, faces, normals, etc.) are stored in flat n x 3 buffers.
+    // The returned row pointers are only a view into that buffer, i.e. rows[i] == rows[0] + 3*i,
+    // so rows[i][j] indexing keeps working and rows[0] can be wrapped with Eigen::Map without a copy.
+    // Memory must be released with freeRows3, not by deleting the rows one by one.
+    template<typename T>
+    inline T** allocateRows3(int n)
+    {
+        if (n<=0) return NULL;
+        T** rows = new T*[n];
+        rows[0]  = new T[std::size_t(n)*3]();
+        for (int i=1; i<n; i++)
+            rows[i] = rows[0] + std::size_t(i)*3;
+        return rows;
+    }
+
+    template<typename T>
+    inline void freeRows3(T**& rows)
+    {
+        if (rows==NULL) return;
+        delete[] rows[0];
+        delete[] rows;
+        rows = NULL;
+    }
+
+    template<typename T>
+    inline T** copyRows3(T** src, int n)
+    {
+        if ((src==NULL) || (n<=0)) return NULL;
+        T** rows = allocateRows3<T>(n);
+        std::memcpy(rows[0], src[0], std::size_t(n)*3*sizeof(T));
+        return rows;
+    }
+
+    // Changes the number of rows while keeping the existing values. New rows are zero initialized.
+    template<typename T>
+    inline void resizeRows3(T**& rows, int oldN, int newN)
+    {
+        T** newRows = allocateRows3<T>(newN);
+        int keepN   = std::min(oldN,newN);
+        if (keepN>0)
+            std::memcpy(newRows[0], rows[0], std::size_t(keepN)*3*sizeof(T));
+        freeRows3(rows);
+        rows = newRows;
+    }
+
+    // Scratch buffers for the batched point queries of Surface. They can be reused between calls
+    // to avoid reallocations, but a buffer must not be shared by concurrent calls.
+    struct SurfacePointQueryBuffer
+    {
+        std::vector<int8_t>  vox;
+        std::vector<int64_t> candidates;
+        std::vector<int64_t> remaining;
+        Eigen::MatrixXd      Q;
+        Eigen::VectorXd      W;
+        Eigen::VectorXd      sqrD;
+        Eigen::VectorXi      I;
+        Eigen::MatrixXd      C;
+    };
+
+    typedef Eigen::Map<Eigen::Matrix<float,Eigen::Dynamic,3,Eigen::RowMajor>> VertexMap;
+    typedef Eigen::Map<Eigen::Matrix<int,  Eigen::Dynamic,3,Eigen::RowMajor>> FaceMap;
+
     class Surface
     {
 
@@ -129,6 +191,7 @@ namespace NIBR
         Surface();
         Surface(std::string _filePath);
         Surface(const Surface &obj);
+        Surface(Surface &&obj) noexcept;
         Surface(const Surface &obj,bool copyMeshOnly);
         Surface(std::vector<std::vector<float>>& vertexList, std::vector<std::vector<int>>& faceList);
         ~Surface();
@@ -170,13 +233,22 @@ namespace NIBR
         void calcArea();
         void calcVolume();
         void getNeighboringVertices();
+        void getNeighboringVerticesCSR();
         void getNeighboringFaces();
+        void getNeighboringFacesCSR();
         void getConnectedComponents();
         void getClosedAndOpenComponents();
         void calcNormalsOfVertices();
         void calcTriangleVectors();
         void calcGaussianCurvature();
         void calcMeanCurvature();
+
+        // Updates the data derived from vertex positions after vertices are moved. Centers, normals, areas and triangle vectors
+        // are recomputed in parallel if they were computed. The rest is only marked as stale and rebuilt when it is needed again:
+        // curvatures, AABB tree, volume and boundary lengths are released, vertices of the connected components are updated by
+        // getConnectedComponents(), and the point check grid is rebuilt by enablePointCheck() or the batched point queries.
+        // Single point queries run in parallel and can't rebuild it, so enablePointCheck() must be called before them.
+        void refreshDerivedData();
         bool isManifold();
         bool isClosed();
         std::vector<double> calcAreasOfConnectedComponents();
@@ -185,6 +257,14 @@ namespace NIBR
 
         void toEigen();
         void fromEigen();
+
+        // Views over the contiguous vertex and face buffers, no data is copied
+        VertexMap vertexMap() {return VertexMap((nv>0) ? vertices[0] : NULL, nv, 3);}
+        FaceMap   faceMap()   {return FaceMap  ((nf>0) ? faces[0]    : NULL, nf, 3);}
+
+        // Allocate contiguous vertex/face storage. Existing data is released.
+        void allocateVertices(int _nv);
+        void allocateFaces(int _nf);
         void prepIglAABBTree();
 
         double squaredDistToPoint(float *p);
@@ -203,6 +283,16 @@ namespace NIBR
         bool  isPointInside(float* p);
         bool  isPointInside(float* p, double& dist, int& faceInd, float* closestPoint);
         bool  isPointInside_basedOnWindingNumber(float* p); // This function might return true, also for open surfaces, if the winding_number > 0.5
+
+        // Batched versions of the point queries above for N points given in SoA form, i.e. (x[n],y[n],z[n]).
+        // Points are first classified with maskAndBoundary in parallel. Only the points close to the boundary
+        // are then sent, all together, to libigl's winding number and AABB routines. The results are the same as
+        // calling the single point functions for each point. dist follows the conventions of isPointInside(p,dist,...).
+        void  isPointInside(const float* x, const float* y, const float* z, std::size_t N, std::vector<uint8_t>& inside);
+        void  isPointInside(const float* x, const float* y, const float* z, std::size_t N, std::vector<uint8_t>& inside, std::vector<double>& dist, SurfacePointQueryBuffer& buf);
+        void  distToPoint  (const float* x, const float* y, const float* z, std::size_t N, std::vector<double>& dist);
+        void  distToPoint  (const float* x, const float* y, const float* z, std::size_t N, std::vector<double>& dist, SurfacePointQueryBuffer& buf);
+        void  isPointInside_basedOnWindingNumber(const float* x, const float* y, const float* z, std::size_t N, std::vector<uint8_t>& inside, SurfacePointQueryBuffer& buf);
         
         // Checks if a segment intersects the surface or not. 
         // <isSegBegInside,isSegEndInside,distFromSegBegToMesh,intersectingFaceIndex,intersectionIsInsideToOutside,boundaryTransitionDist>
@@ -210,6 +300,9 @@ namespace NIBR
         // boundaryTransitionDist ≠ NAN if the segment is transitioning through the boundary without intersection.
         std::tuple<bool,bool,double,int,bool,double> intersectSegment(const LineSegment* seg);
 
+        // Batched version of the above, segments are processed in parallel.
+        void intersectSegment(const LineSegment* segs, std::size_t N, std::vector<std::tuple<bool,bool,double,int,bool,double>>& out);
+
         // TODO: The following should be moved to surface_operators and they should generate new surfaces.
         // Because they modify vertices and/or faces of the surface
         void applyAffineTransform(float **affT);
@@ -251,6 +344,15 @@ namespace NIBR
 
         std::set<int> *neighboringVertices;
         std::set<int> *neighboringFaces;
+
+        // Compressed (CSR) vertex adjacency. Neighbors of vertex n are
+        // neighboringVerticesIndices[neighboringVerticesOffsets[n]] ... neighboringVerticesIndices[neighboringVerticesOffsets[n+1]-1]
+        std::vector<int> neighboringVerticesOffsets;
+        std::vector<int> neighboringVerticesIndices;
+
+        // Compressed (CSR) vertex-to-face adjacency, in the same layout as above. Face lists are sorted.
+        std::vector<int> neighboringFacesOffsets;
+        std::vector<int> neighboringFacesIndices;
         float area;
         float volume;
 
@@ -261,6 +363,7 @@ namespace NIBR
         SurfaceField makeFieldFromFile(std::string filePath, std::string name, std::string owner, std::string dataType, int dimension, std::string LUTfname, bool isASCII);
 
         Surface& operator=(const Surface &surf);
+        Surface& operator=(Surface &&surf) noexcept;  // Takes over all the data of surf, which is left empty
         void copyMeshFrom(const Surface& obj);
 
         // Connected components
@@ -294,12 +397,21 @@ namespace NIBR
         // The following are used in isPointInside
         bool  enabledPointCheck;
         float pointCheckGridRes;
-        std::vector<std::vector<std::vector<std::vector<int>>>> grid;
+        bool  pointCheckIsStale;    // the grid was released by refreshDerivedData() and is rebuilt with pointCheckGridRes
+
+        // Compressed (CSR) voxel-to-face grid of maskAndBoundary. Faces intersecting voxel ind are
+        // gridFaceIndices[gridFaceOffsets[ind]] ... gridFaceIndices[gridFaceOffsets[ind+1]-1]
+        std::vector<int> gridFaceOffsets;
+        std::vector<int> gridFaceIndices;
+
+        // Per face {vertex0, edge1, edge2, normal}, packed together so that intersectSegment reads a single record per face
+        std::vector<float> packedFaceData;
         NIBR::Image<int8_t> maskAndBoundary;
 
     private:
         std::string filePath;
         void copyFrom(const Surface& obj);
+        void moveFrom(Surface& obj);
 
         bool readVTKMeshHeader();
         bool readGIIMeshHeader();
@@ -313,6 +425,18 @@ namespace NIBR
         bool writeGII(std::string _filename);
 
         bool isClosedComp();       
+
+        // Per face/vertex computations
+        void calcCenterOfFace(int n);
+        void calcNormalOfFace(int n);
+        void calcTriangleVectorsOfFace(int n);
+        void calcNormalOfVertex(int n);
+        void releaseVertexDependentData();
+        void calcBoundaryLengthsAndAreas();
+
+        // Vertex indices of each connected component in this surface, in the vertex order of comp
+        std::vector<std::vector<int>> compVertices;
+        bool                          compIsStale;  // vertices were moved after comp was computed
         
     };
 
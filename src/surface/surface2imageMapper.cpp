@@ -1,12 +1,162 @@
 #include "surface2imageMapper.h"
 #include "surface_operators.h"
 #include "image/image_math.h"
+#include "findSegmentTriangleIntersection.h"
 #include <cstdint>
 #include <utility>
 #include <atomic>
 
+#define SURFACE_QUERY_CHUNK_SIZE 1048576
+#define PVF_RAYS                 8
+
 using namespace NIBR;
 
+namespace {
+
+    // Squared distance from point p to triangle (a,b,c), using the Voronoi region tests from
+    // C. Ericson, Real-Time Collision Detection, Sec. 5.1.5.
+    double pointTriangleSquaredDist(const float* p, const float* a, const float* b, const float* c)
+    {
+        double ab[3], ac[3], ap[3], q[3];
+        for (int i=0; i<3; i++) {
+            ab[i] = double(b[i]) - double(a[i]);
+            ac[i] = double(c[i]) - double(a[i]);
+            ap[i] = double(p[i]) - double(a[i]);
+        }
+
+        auto sqDistTo = [&](const double* r)->double {
+            double dx = double(p[0])-r[0], dy = double(p[1])-r[1], dz = double(p[2])-r[2];
+            return dx*dx + dy*dy + dz*dz;
+        };
+
+        double d1 = NIBR::dot(ab,ap);
+        double d2 = NIBR::dot(ac,ap);
+        if (d1 <= 0.0 && d2 <= 0.0) {for (int i=0; i<3; i++) q[i] = a[i]; return sqDistTo(q);}
+
+        double bp[3] = {double(p[0])-b[0], double(p[1])-b[1], double(p[2])-b[2]};
+        double d3 = NIBR::dot(ab,bp);
+        double d4 = NIBR::dot(ac,bp);
+        if (d3 >= 0.0 && d4 <= d3) {for (int i=0; i<3; i++) q[i] = b[i]; return sqDistTo(q);}
+
+        double vc = d1*d4 - d3*d2;
+        if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+            double v = d1 / (d1 - d3);
+            for (int i=0; i<3; i++) q[i] = a[i] + v*ab[i];
+            return sqDistTo(q);
+        }
+
+        double cp[3] = {double(p[0])-c[0], double(p[1])-c[1], double(p[2])-c[2]};
+        double d5 = NIBR::dot(ab,cp);
+        double d6 = NIBR::dot(ac,cp);
+        if (d6 >= 0.0 && d5 <= d6) {for (int i=0; i<3; i++) q[i] = c[i]; return sqDistTo(q);}
+
+        double vb = d5*d2 - d1*d6;
+        if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+            double w = d2 / (d2 - d6);
+            for (int i=0; i<3; i++) q[i] = a[i] + w*ac[i];
+            return sqDistTo(q);
+        }
+
+        double va = d3*d6 - d5*d4;
+        if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0) {
+            double w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+            for (int i=0; i<3; i++) q[i] = b[i] + w*(double(c[i]) - double(b[i]));
+            return sqDistTo(q);
+        }
+
+        double denom = 1.0 / (va + vb + vc);
+        double v     = vb * denom;
+        double w     = vc * denom;
+        for (int i=0; i<3; i++) q[i] = a[i] + ab[i]*v + ac[i]*w;
+        return sqDistTo(q);
+    }
+
+
+    // Fills the voxels with blocked[ind]==0, one row along i at a time. Blocked voxels split each row into runs.
+    // This is valid when the blocked voxels cover the surface, e.g., the voxels of faceGridderCSR, so that no run crosses the surface.
+    // Then each run is either completely inside or outside, and the winding number is queried only at the first voxel of each run.
+    // Rows are processed in parallel and the queries are batched. fillVoxel(ind,isInside) is called in parallel for different voxels.
+    template<typename T, typename F>
+    void forEachRun(NIBR::Image<T>* img, const std::vector<uint8_t>& blocked, NIBR::Surface* closed, F fillVoxel)
+    {
+        const int64_t dimX   = img->imgDims[0];
+        const int64_t rowCnt = img->imgDims[1]*img->imgDims[2];
+
+        // Runs of each row, as begin and end i
+        std::vector<std::vector<std::pair<int64_t,int64_t>>> rowRuns(rowCnt);
+
+        NIBR::MT::MTRUN(rowCnt, [&](const NIBR::MT::TASK& task)->void {
+            const int64_t j = task.no % img->imgDims[1];
+            const int64_t k = task.no / img->imgDims[1];
+            int64_t beg = -1;
+            for (int64_t i = 0; i <= dimX; i++) {
+                const bool isFree = (i < dimX) && (blocked[img->sub2ind(i,j,k)] == 0);
+                if (isFree  && (beg <  0)) beg = i;
+                if (!isFree && (beg >= 0)) {rowRuns[task.no].emplace_back(beg,i); beg = -1;}
+            }
+        });
+
+        std::vector<int64_t> runOffset(rowCnt+1,0);
+        for (int64_t r = 0; r < rowCnt; r++)
+            runOffset[r+1] = runOffset[r] + rowRuns[r].size();
+
+        const int64_t runCnt = runOffset.back();
+        std::vector<uint8_t> runInside(runCnt,0);
+
+        if (closed!=NULL) {
+
+            const int64_t chunkSize = SURFACE_QUERY_CHUNK_SIZE;
+
+            std::vector<float>      x, y, z;
+            std::vector<uint8_t>    inside;
+            SurfacePointQueryBuffer buf;
+
+            for (int64_t beg = 0; beg < runCnt; beg += chunkSize) {
+
+                const int64_t n   = std::min(chunkSize, runCnt - beg);
+                const int64_t end = beg + n;
+
+                x.resize(n); y.resize(n); z.resize(n);
+
+                // Rows are visited so that each task fills the runs of one row within the chunk
+                const int64_t rowBeg = std::upper_bound(runOffset.begin(),runOffset.end(),beg) - runOffset.begin() - 1;
+                const int64_t rowEnd = std::lower_bound(runOffset.begin(),runOffset.end(),end) - runOffset.begin();
+
+                NIBR::MT::MTRUN(rowEnd - rowBeg, [&](const NIBR::MT::TASK& task)->void {
+                    const int64_t r = rowBeg + task.no;
+                    const int64_t j = r % img->imgDims[1];
+                    const int64_t k = r / img->imgDims[1];
+                    for (int64_t q = std::max(runOffset[r],beg); q < std::min(runOffset[r+1],end); q++) {
+                        float p[3];
+                        img->to_xyz(img->sub2ind(rowRuns[r][q-runOffset[r]].first,j,k),p);
+                        x[q-beg] = p[0];
+                        y[q-beg] = p[1];
+                        z[q-beg] = p[2];
+                    }
+                });
+
+                closed->isPointInside_basedOnWindingNumber(x.data(),y.data(),z.data(),n,inside,buf);
+                std::copy(inside.begin(),inside.begin()+n,runInside.begin()+beg);
+
+            }
+
+        }
+
+        NIBR::MT::MTRUN(rowCnt, [&](const NIBR::MT::TASK& task)->void {
+            const int64_t j = task.no % img->imgDims[1];
+            const int64_t k = task.no / img->imgDims[1];
+            for (std::size_t q = 0; q < rowRuns[task.no].size(); q++) {
+                const bool isInside = runInside[runOffset[task.no]+q];
+                for (int64_t i = rowRuns[task.no][q].first; i < rowRuns[task.no][q].second; i++)
+                    fillVoxel(img->sub2ind(i,j,k),isInside);
+            }
+        });
+    }
+
+}
+
+// Only the voxels that intersect the surface are checked one by one, using a batched winding number query.
+// The remaining voxels are filled row by row, which requires a single query for each run of voxels between the boundary voxels.
 void NIBR::surfaceMask(NIBR::Image<bool>* img, NIBR::Surface* surf)
 {
     disp(MSG_DEBUG,"surfaceMask()");
@@ -15,399 +165,652 @@ void NIBR::surfaceMask(NIBR::Image<bool>* img, NIBR::Surface* surf)
 
     surf->getClosedAndOpenComponents();
     Surface& closed = surf->compClosedAndOpen[0];
+    if (closed.nv == 0) return;
     closed.prepIglAABBTree();
 
-    auto getMask = [&](const NIBR::MT::TASK& task)->void {
+    std::vector<int> offsets, indices;
+    faceGridderCSR(surf, img, offsets, indices);
 
-        int64_t ind = task.no;
+    std::vector<uint8_t> blocked(img->voxCnt,0);
+    std::vector<int64_t> boundaryVoxels;
+    for (int64_t ind = 0; ind < img->voxCnt; ind++) {
+        if (offsets[ind] != offsets[ind+1]) {
+            blocked[ind] = 1;
+            boundaryVoxels.push_back(ind);
+        }
+    }
+    std::vector<int>().swap(indices);
 
-        float p[3];
-        img->to_xyz(ind,p);
+    forEachRun(img, blocked, &closed, [&](int64_t ind, bool isInside)->void {
+        if (isInside) img->data[ind] = INSIDE;
+    });
 
-        if (closed.isPointInside_basedOnWindingNumber(p)) {
-            img->data[ind]=INSIDE;
-        }
+    // Winding numbers of the boundary voxels are computed in chunks with single batched calls
+    const int64_t chunkSize = SURFACE_QUERY_CHUNK_SIZE;
 
-    };
-    
-    NIBR::MT::MTRUN(img->numel, "Computing mask", getMask);
+    std::vector<float>      x, y, z;
+    std::vector<uint8_t>    inside;
+    SurfacePointQueryBuffer buf;
+
+    for (int64_t beg = 0; beg < int64_t(boundaryVoxels.size()); beg += chunkSize) {
+
+        const int64_t n = std::min(chunkSize, int64_t(boundaryVoxels.size()) - beg);
+
+        x.resize(n); y.resize(n); z.resize(n);
+
+        NIBR::MT::MTRUN(n, [&](const NIBR::MT::TASK& task)->void {
+            float p[3];
+            img->to_xyz(boundaryVoxels[beg+task.no],p);
+            x[task.no] = p[0];
+            y[task.no] = p[1];
+            z[task.no] = p[2];
+        });
+
+        closed.isPointInside_basedOnWindingNumber(x.data(),y.data(),z.data(),n,inside,buf);
+
+        for (int64_t i = 0; i < n; i++)
+            if (inside[i]) img->data[boundaryVoxels[beg+i]] = INSIDE;
+
+    }
 
 }
 
 
 
+// Boundary voxels must be already marked in img, as done by mapSurface2Image. Since they cover the surface,
+// the remaining voxels are filled row by row, which requires a single winding number query for each run between them.
 void NIBR::surfaceMaskWithBoundary(NIBR::Image<int8_t>* img, NIBR::Surface* surf)
 {
 
     surf->getClosedAndOpenComponents();
     Surface& closed = surf->compClosedAndOpen[0];
-    closed.prepIglAABBTree();
-
-    auto getMaskAndBoundary = [&](const NIBR::MT::TASK& task)->void {
+    const bool hasInside = (surf->interpretAs2D == false) && (closed.nv > 0);
+    if (hasInside) closed.prepIglAABBTree();
 
-        int64_t ind = task.no;
+    std::vector<uint8_t> blocked(img->voxCnt,0);
 
-        if (img->data[ind]!=0) {
-            img->data[ind]=BOUNDARY;
-            return;
+    NIBR::MT::MTRUN(img->voxCnt, [&](const NIBR::MT::TASK& task)->void {
+        if (img->data[task.no]!=0) {
+            img->data[task.no] = BOUNDARY;
+            blocked[task.no]   = 1;
         }
+    });
+
+    forEachRun(img, blocked, hasInside ? &closed : NULL, [&](int64_t ind, bool isInside)->void {
+        img->data[ind] = isInside ? INSIDE : OUTSIDE;
+    });
+
+}
+
+// Signed distance field, positive inside and negative outside the surface.
+//
+// Exact distances are first computed in a narrow band, i.e., for the voxels that faceGridderCSR assigns faces to.
+// Closest faces are then propagated outward, one layer of voxels at a time. Each voxel in a layer is evaluated
+// in parallel using the closest faces of its already processed 26-neighbors. Outside the band, distances are therefore
+// approximate, since the true closest face might not be among the propagated ones. Propagation stops beyond maxDist,
+// and voxels that are not reached are set to +/-maxDist. Signs are computed with the winding number
+// only for the reached voxels, and once for every run of the voxels that are not reached in each row.
+// As in Surface::isPointInside, for open components and surfaces interpreted as 2D, voxels within SURFTHICKNESS
+// behind their closest face are also inside.
+void NIBR::surfaceEDT(NIBR::Image<float>* img, NIBR::Surface* surf, float maxDist)
+{
+    disp(MSG_DEBUG,"surfaceEDT()");
+
+    if (maxDist <= 0) maxDist = FLT_MAX;
+
+    const int64_t voxCnt = img->voxCnt;
+    const int64_t dimX   = img->imgDims[0];
+    const int64_t dimY   = img->imgDims[1];
+    const int64_t dimZ   = img->imgDims[2];
+
+    std::vector<int>     nearestFace(voxCnt,-1);
+    std::vector<float>   dist(voxCnt,FLT_MAX);   // unsigned
+    std::vector<uint8_t> state(voxCnt,0);        // 0: not reached, 1: done, 2: in the current layer
+    std::vector<int64_t> front;
+    std::vector<bool>    faceInGrid(surf->nf,false);
+
+    // Narrow band
+    {
+        std::vector<int> offsets, indices;
+        faceGridderCSR(surf, img, offsets, indices);
+
+        for (int64_t ind = 0; ind < voxCnt; ind++)
+            if (offsets[ind] != offsets[ind+1])
+                front.push_back(ind);
+        for (int f : indices) faceInGrid[f] = true;
+
+        // Faces of the 3x3x3 neighborhood are checked so that the band distances are exact
+        NIBR::MT::MTRUN(front.size(), [&](const NIBR::MT::TASK& task)->void {
+
+            int64_t ind = front[task.no];
+            int64_t i,j,k;
+            img->ind2sub(ind,i,j,k);
 
-        if (surf->interpretAs2D == false) {
             float p[3];
             img->to_xyz(ind,p);
-            if (closed.isPointInside_basedOnWindingNumber(p)) {
-                img->data[ind]=INSIDE;
-            }
-        }
 
-    };
-    
-    NIBR::MT::MTRUN(img->numel, "Computing mask and boundary", getMaskAndBoundary);
-
-}
+            double minSqDist = DBL_MAX;
+            int    minFace   = -1;
+
+            for (int64_t a = std::max(i-1,int64_t(0)); a <= std::min(i+1,dimX-1); a++)
+                for (int64_t b = std::max(j-1,int64_t(0)); b <= std::min(j+1,dimY-1); b++)
+                    for (int64_t c = std::max(k-1,int64_t(0)); c <= std::min(k+1,dimZ-1); c++) {
+                        int64_t nInd = img->sub2ind(a,b,c);
+                        for (int m = offsets[nInd]; m < offsets[nInd+1]; m++) {
+                            int    f = indices[m];
+                            double d = pointTriangleSquaredDist(p,surf->vertices[surf->faces[f][0]],surf->vertices[surf->faces[f][1]],surf->vertices[surf->faces[f][2]]);
+                            if (d < minSqDist) {
+                                minSqDist = d;
+                                minFace   = f;
+                            }
+                        }
+                    }
 
+            nearestFace[ind] = minFace;
+            dist[ind]        = std::sqrt(minSqDist);
 
+        });
 
-void NIBR::surfaceEDT(NIBR::Image<float>* img, NIBR::Surface* surf)
-{
+        for (auto ind : front) state[ind] = 1;
+    }
 
-    surf->enablePointCheck(img->smallestPixDim);
+    // Faces that are outside the image do not appear in the band. In that case, voxels on the image border are
+    // additionally seeded with an exact AABB query, so that these faces are propagated into the image too.
+    if (std::find(faceInGrid.begin(),faceInGrid.end(),false) != faceInGrid.end()) {
+
+        std::vector<int64_t> border;
+        for (int64_t i = 0; i < dimX; i++)
+            for (int64_t j = 0; j < dimY; j++)
+                for (int64_t k = 0; k < dimZ; k++)
+                    if ((i==0) || (j==0) || (k==0) || (i==dimX-1) || (j==dimY-1) || (k==dimZ-1)) {
+                        int64_t ind = img->sub2ind(i,j,k);
+                        if (state[ind]==0) border.push_back(ind);
+                    }
 
-    auto getEDT = [&](const NIBR::MT::TASK& task)->void {
+        surf->prepIglAABBTree();
 
-        int64_t ind = task.no;
-        float p[3];
+        Eigen::MatrixXd Q(border.size(),3);
+        Eigen::VectorXd sqrD;
+        Eigen::VectorXi I;
+        Eigen::MatrixXd C;
 
-        img->to_xyz(ind,p);
+        NIBR::MT::MTRUN(border.size(), [&](const NIBR::MT::TASK& task)->void {
+            float p[3];
+            img->to_xyz(border[task.no],p);
+            Q(task.no,0) = p[0];
+            Q(task.no,1) = p[1];
+            Q(task.no,2) = p[2];
+        });
+
+        if (border.size() > 0) surf->AABB_tree.squared_distance(surf->V,surf->F,Q,sqrD,I,C);
+
+        for (std::size_t n = 0; n < border.size(); n++) {
+            float d = std::sqrt(sqrD(n));
+            if (d > maxDist) continue;
+            nearestFace[border[n]] = I(n);
+            dist[border[n]]        = d;
+            state[border[n]]       = 1;
+            front.push_back(border[n]);
+        }
 
-        img->data[ind] = surf->distToPoint(p);
+    }
 
-    };
-    
-    NIBR::MT::MTRUN(img->numel, "Computing EDT", getEDT);
-    
-}
+    // Propagate closest faces outward
+    std::vector<int64_t> next;
 
-void NIBR::surfacePVF(NIBR::Image<float>* img, NIBR::Surface* surf)
-{
-    float div    = 4;
-    float divVol = 1.0f/(div*div*div);
-    float step   = 1.0f/(div+1.0f);
+    while (!front.empty()) {
 
-    surf->enablePointCheck(img->smallestPixDim);
+        next.clear();
 
-    auto estimPartVol = [&](const NIBR::MT::TASK& task)->void {
-        
-        int64_t ind = task.no;
-        int64_t ijk[3];
-        float   xyz[3];
+        for (auto ind : front) {
 
-        img->ind2sub(ind,ijk);
+            if (dist[ind] > maxDist) continue;
 
-        // Voxel is not on the BOUNDARY
-        if (img->data[ind] == 0) {
+            int64_t i,j,k;
+            img->ind2sub(ind,i,j,k);
 
-            img->to_xyz(ijk,xyz);
+            const int64_t nbrs[6][3] = {{i-1,j,k},{i+1,j,k},{i,j-1,k},{i,j+1,k},{i,j,k-1},{i,j,k+1}};
 
-            if (surf->isPointInside(xyz)) { // voxel is inside
-                img->data[ind] = 1.0f;
+            for (int n = 0; n < 6; n++) {
+                if ((nbrs[n][0]<0) || (nbrs[n][1]<0) || (nbrs[n][2]<0) || (nbrs[n][0]>=dimX) || (nbrs[n][1]>=dimY) || (nbrs[n][2]>=dimZ)) continue;
+                int64_t nInd = img->sub2ind(nbrs[n][0],nbrs[n][1],nbrs[n][2]);
+                if (state[nInd]==0) {
+                    state[nInd] = 2;
+                    next.push_back(nInd);
+                }
             }
 
-            return;
-        
         }
 
-        // Voxel is on the BOUNDARY
-        int partVol = 0;
+        NIBR::MT::MTRUN(next.size(), [&](const NIBR::MT::TASK& task)->void {
+
+            int64_t ind = next[task.no];
+            int64_t i,j,k;
+            img->ind2sub(ind,i,j,k);
 
-        float cur_ijk[3];
+            float p[3];
+            img->to_xyz(ind,p);
 
-        for (float i=(float(ijk[0])-0.5+step); i<(float(ijk[0])+0.5-step+EPS4); i=i+step)
-            for (float j=(float(ijk[1])-0.5+step); j<(float(ijk[1])+0.5-step+EPS4); j=j+step)
-                for (float k=(float(ijk[2])-0.5+step); k<(float(ijk[2])+0.5-step+EPS4); k=k+step) {
+            int    tried[26];
+            int    triedCnt  = 0;
+            double minSqDist = DBL_MAX;
+            int    minFace   = -1;
 
-                    cur_ijk[0]=i;
-                    cur_ijk[1]=j;
-                    cur_ijk[2]=k;
-                    
-                    img->to_xyz(cur_ijk,xyz);
+            for (int64_t a = std::max(i-1,int64_t(0)); a <= std::min(i+1,dimX-1); a++)
+                for (int64_t b = std::max(j-1,int64_t(0)); b <= std::min(j+1,dimY-1); b++)
+                    for (int64_t c = std::max(k-1,int64_t(0)); c <= std::min(k+1,dimZ-1); c++) {
+
+                        int64_t nInd = img->sub2ind(a,b,c);
+                        if (state[nInd]!=1) continue;
+
+                        int f = nearestFace[nInd];
+                        if (std::find(tried,tried+triedCnt,f) != tried+triedCnt) continue;
+                        tried[triedCnt++] = f;
+
+                        double d = pointTriangleSquaredDist(p,surf->vertices[surf->faces[f][0]],surf->vertices[surf->faces[f][1]],surf->vertices[surf->faces[f][2]]);
+                        if (d < minSqDist) {
+                            minSqDist = d;
+                            minFace   = f;
+                        }
 
-                    if (surf->isPointInside(xyz)) { // voxel is inside
-                        partVol++;
                     }
 
-                }
+            nearestFace[ind] = minFace;
+            dist[ind]        = std::sqrt(minSqDist);
 
+        });
 
-        if (partVol>0) {
-            disp(MSG_DEBUG,"ijk=[%d,%d,%d], pv=%.2f",ijk[0],ijk[1],ijk[2],partVol);
-            img->data[ind] = float(partVol)*divVol;
-        } else {
-            img->data[ind] = 0;
-        }
+        for (auto ind : next) state[ind] = 1;
 
+        front.swap(next);
 
+    }
+
+    // Signs
+    surf->getClosedAndOpenComponents();
+    Surface& closed    = surf->compClosedAndOpen[0];
+    const bool hasInside = (surf->interpretAs2D == false) && (closed.nv > 0);
+    const bool hasShell  = (surf->interpretAs2D == true)  || (surf->compClosedAndOpen[1].nv > 0);
+    if (hasInside) closed.prepIglAABBTree();
+    if (hasShell && (surf->normalsOfFaces == NULL)) surf->calcNormalsOfFaces();
+
+    // Same as the border check in Surface::isPointInside
+    auto isInShell = [&](int64_t ind)->bool {
+        if (!hasShell || (dist[ind] > SURFTHICKNESS) || (nearestFace[ind] < 0)) return false;
+        float p[3];
+        img->to_xyz(ind,p);
+        const int    f = nearestFace[ind];
+        const float* a = surf->vertices[surf->faces[f][0]];
+        const float* n = surf->normalsOfFaces[f];
+        const double d = double(n[0])*(a[0]-p[0]) + double(n[1])*(a[1]-p[1]) + double(n[2])*(a[2]-p[2]);
+        return (d > 0.0) || (dist[ind] == 0.0f);
     };
 
-    NIBR::MT::MTRUN(img->numel, "Estimating partial volumes", estimPartVol);
+    std::vector<int64_t> reached;
+    for (int64_t ind = 0; ind < voxCnt; ind++)
+        if (state[ind]==1) reached.push_back(ind);
+
+    const int64_t chunkSize = SURFACE_QUERY_CHUNK_SIZE;
 
+    std::vector<float>      x, y, z;
+    std::vector<uint8_t>    inside;
+    SurfacePointQueryBuffer buf;
+
+    for (int64_t beg = 0; beg < int64_t(reached.size()); beg += chunkSize) {
+
+        const int64_t n = std::min(chunkSize, int64_t(reached.size()) - beg);
+
+        if (hasInside) {
+
+            x.resize(n); y.resize(n); z.resize(n);
+
+            NIBR::MT::MTRUN(n, [&](const NIBR::MT::TASK& task)->void {
+                float p[3];
+                img->to_xyz(reached[beg+task.no],p);
+                x[task.no] = p[0];
+                y[task.no] = p[1];
+                z[task.no] = p[2];
+            });
+
+            closed.isPointInside_basedOnWindingNumber(x.data(),y.data(),z.data(),n,inside,buf);
+
+        } else {
+            inside.assign(n,0);
+        }
+
+        for (int64_t i = 0; i < n; i++) {
+            float d = std::min(dist[reached[beg+i]],maxDist);
+            img->data[reached[beg+i]] = (inside[i] || isInShell(reached[beg+i])) ? d : -d;
+        }
+
+    }
+
+    // Voxels that are not reached are farther than maxDist to the surface.
+    // Since the reached voxels cover the surface, each run of them in a row is either completely inside or outside.
+    forEachRun(img, state, hasInside ? &closed : NULL, [&](int64_t ind, bool isInside)->void {
+        img->data[ind] = isInside ? maxDist : -maxDist;
+    });
+    
 }
 
-void NIBR::surfaceMAT(NIBR::Image<float>* img, NIBR::Surface* surf)
+// Partial volumes of the closed part of the surface.
+//
+// Voxels that are not on the boundary, i.e., voxels without faces in faceGridderCSR, are filled row by row,
+// using a single winding number query for each run between the boundary voxels. For boundary voxels, PVF_RAYS x PVF_RAYS rays are cast along
+// the i axis through the voxel. The winding number is queried only at the start of each ray, and the inside length
+// of the ray is found exactly by toggling at the intersections with the faces of the voxel.
+void NIBR::surfacePVF(NIBR::Image<float>* img, NIBR::Surface* surf)
 {
-    surf->enablePointCheck(img->smallestPixDim);
+    disp(MSG_DEBUG,"surfacePVF()");
+
+    NIBR::MT::MTRUN(img->voxCnt, [&](const NIBR::MT::TASK& task)->void {
+        img->data[task.no] = 0;
+    });
 
-    struct ComparePairs {
-    bool operator()(const std::pair<int64_t, float>& a, const std::pair<int64_t, float>& b) const {
-        return a.second > b.second;  // Compare based on the distance in descending order
+    if (surf->interpretAs2D) return;
+
+    surf->getClosedAndOpenComponents();
+    Surface& closed = surf->compClosedAndOpen[0];
+    if ((closed.nv == 0) || (closed.nf == 0)) return;
+    closed.prepIglAABBTree();
+
+    std::vector<int> offsets, indices;
+    faceGridderCSR(&closed, img, offsets, indices);
+
+    std::vector<uint8_t> blocked(img->voxCnt,0);
+    std::vector<int64_t> boundaryVoxels;
+
+    for (int64_t ind = 0; ind < img->voxCnt; ind++)
+        if (offsets[ind] != offsets[ind+1]) {
+            boundaryVoxels.push_back(ind);
+            blocked[ind] = 1;
         }
-    };
 
-    std::vector<std::set<std::pair<int64_t, float>, ComparePairs>> edt;
-    edt.resize(MT::MAXNUMBEROFTHREADS());
+    forEachRun(img, blocked, &closed, [&](int64_t ind, bool isInside)->void {
+        img->data[ind] = isInside ? 1.0f : 0.0f;
+    });
 
-    float halfVox   = img->pixDims[0]*std::sqrt(3)+EPS4;
+    const int    rayCnt = PVF_RAYS*PVF_RAYS;
+    const float  step   = 1.0f/float(PVF_RAYS);
 
-    auto getEDTpair = [&](const NIBR::MT::TASK& task)->void {
+    std::vector<float>      x, y, z;
+    std::vector<uint8_t>    inside;
+    SurfacePointQueryBuffer buf;
 
-        int64_t ind = task.no;
-        float p[3];
+    // Ray-face intersections, one buffer per thread
+    std::vector<std::vector<double>> hitsPerThread(NIBR::MT::MAXNUMBEROFTHREADS());
 
-        img->to_xyz(ind,p);
+    // Boundary voxels are processed in chunks, so that the starting points of the rays in each chunk are classified together
+    const int64_t voxChunkSize = std::max(int64_t(1), int64_t(SURFACE_QUERY_CHUNK_SIZE)/rayCnt);
 
-        if (surf->isPointInside(p)) {
+    for (int64_t beg = 0; beg < int64_t(boundaryVoxels.size()); beg += voxChunkSize) {
 
-            float radius = surf->distToPoint(p);
+        const int64_t n = std::min(voxChunkSize, int64_t(boundaryVoxels.size()) - beg);
 
-            if (radius > halfVox) {
-                edt[task.threadId].insert(std::make_pair(ind, radius));
-            } else {
-                // These are already the smallest values. Because in image space they will correspond to a single voxel, they can't overwrite any other voxel.
-                img->data[ind] = radius;
-            }
-            
-        }
+        x.resize(n*rayCnt); y.resize(n*rayCnt); z.resize(n*rayCnt);
 
-    };    
-    
-    NIBR::MT::MTRUN(img->numel, "Indexing EDT", getEDTpair);
-
-    // Merge threads
-    for (int t = 1; t < MT::MAXNUMBEROFTHREADS(); t++) {
-        std::set_union(
-            edt[0].begin(), edt[0].end(),
-            edt[t].begin(), edt[t].end(),
-            std::inserter(edt[0], edt[0].end()),
-            ComparePairs()
-        );
-        edt[t].clear();
-    }
+        NIBR::MT::MTRUN(n, [&](const NIBR::MT::TASK& task)->void {
 
-    // We will save 1/8 of the biggest sphere
-    std::vector<std::vector<std::vector<float>>> s;
+            int64_t ijk[3];
+            img->ind2sub(boundaryVoxels[beg+task.no],ijk);
 
-    // First process the biggest sphere
-    auto it = edt[0].begin();
-    if (!edt[0].empty()) {
+            float   cur_ijk[3];
+            float   xyz[3];
+            int64_t q = task.no*rayCnt;
 
-        float maxRadius = it->second;
-        int R           = std::ceil(maxRadius/img->pixDims[0]);    // We assume isotropic voxel size
+            cur_ijk[0] = float(ijk[0]) - 0.5f;
 
-        s.resize(R+1);
-        for (int i = 0; i <= R; i++) {
-            s[i].resize(R+1);
-            for (int j = 0; j <= R; j++) {
-                s[i][j].resize(R+1);
-                for (int k = 0; k <= R; k++) {
-                    float r = std::sqrt(float(i*i + j*j + k*k))*img->pixDims[0];
-                    s[i][j][k] = r;
+            for (int a=0; a<PVF_RAYS; a++)
+                for (int b=0; b<PVF_RAYS; b++) {
+                    cur_ijk[1] = float(ijk[1]) - 0.5f + step*(float(a)+0.5f);
+                    cur_ijk[2] = float(ijk[2]) - 0.5f + step*(float(b)+0.5f);
+                    img->to_xyz(cur_ijk,xyz);
+                    x[q] = xyz[0];
+                    y[q] = xyz[1];
+                    z[q] = xyz[2];
+                    q++;
                 }
-            }
-        }
-    }
 
-    std::vector<std::pair<int64_t, float>> vedt;
-    while(it!=edt[0].end()) {
-        vedt.push_back(*it);
-        it++;
-    }
-    edt[0].clear();
+        });
 
+        closed.isPointInside_basedOnWindingNumber(x.data(),y.data(),z.data(),n*rayCnt,inside,buf);
 
-    std::vector<std::pair<int64_t, float>> v;
+        NIBR::MT::MTRUN(n, [&](const NIBR::MT::TASK& task)->void {
 
-    auto getMaximalSpheres = [&](const NIBR::MT::TASK& task)->void {
+            const int64_t ind = boundaryVoxels[beg+task.no];
 
-        float radius = vedt[task.no].second;
-        int R        = std::ceil(radius/img->pixDims[0]);    // We assume isotropic voxel size
+            int64_t ijk[3];
+            img->ind2sub(ind,ijk);
 
-        int64_t ci,cj,ck; // i,j,k of sphere center
-        img->ind2sub(vedt[task.no].first,ci,cj,ck);
+            const int* faceBeg = indices.data() + offsets[ind];
+            const int* faceEnd = indices.data() + offsets[ind+1];
 
-        bool onMedialAxis = false;
+            // All rays are parallel and have the same length
+            float  b0[3]  = {float(ijk[0]) - 0.5f, float(ijk[1]), float(ijk[2])};
+            float  b1[3]  = {float(ijk[0]) + 0.5f, float(ijk[1]), float(ijk[2])};
+            float  p0[3], p1[3];
+            img->to_xyz(b0,p0);
+            img->to_xyz(b1,p1);
 
-        for (int i = ci-R; i <= ci+R; i++)
-            for (int j = cj-R; j <= cj+R; j++)
-                for (int k = ck-R; k <= ck+R; k++) 
-            {
-                if (img->isInside(i, j, k)) {
+            double dir[3] = {double(p1[0])-double(p0[0]), double(p1[1])-double(p0[1]), double(p1[2])-double(p0[2])};
+            double length = norm(dir);
+            vec3scale(dir,1.0/length);
 
-                    int64_t index = img->sub2ind(i,j,k);
-                    float r = s[std::abs(ci - i)][std::abs(cj - j)][std::abs(ck - k)];
+            std::vector<double>& hits = hitsPerThread[task.threadId];
+            double  partVol = 0;
+            int64_t q       = task.no*rayCnt;
 
-                    if (r<=radius) {
-                        if (r > img->data[index]) {
-                            img->data[index] = radius;
-                            if (!onMedialAxis)
-                                onMedialAxis = true;
-                        }
-                    }
+            for (int r = 0; r < rayCnt; r++, q++) {
+
+                double p[3] = {x[q], y[q], z[q]};
 
+                hits.clear();
+                for (const int* fp = faceBeg; fp != faceEnd; fp++) {
+                    const int f = *fp;
+                    double t;
+                    if (findSegmentTriangleIntersection(&closed, f, p, dir, length, NULL, &t) != 0.0)
+                        hits.push_back(t);
                 }
+                std::sort(hits.begin(),hits.end());
+
+                bool   isInside  = inside[q];
+                double prevT     = 0;
+                double insideLen = 0;
+
+                for (double t : hits) {
+                    if (isInside) insideLen += t - prevT;
+                    isInside = !isInside;
+                    prevT    = t;
+                }
+                if (isInside) insideLen += length - prevT;
+
+                partVol += insideLen;
+
             }
 
-        
-        if (onMedialAxis) {
-            v.push_back(vedt[task.no]);
-        }
+            img->data[boundaryVoxels[beg+task.no]] = float(partVol/(length*double(rayCnt)));
 
-    };
+        });
 
-    // Maybe this is possible to parallelize but I ran out of ideas.
-    // The problem is the subsequent computation of medial axis.
-    // This requires that img->data[index] always has the largest value.
-    // When parallelized, a small value can be written on medial axis
-    // which could actually be overwritten later on, but there is way
-    // to keep record of that. This means keeping record of which sphere
-    // center wrote which voxel!
-    NIBR::MT::MTRUN(vedt.size(), 1, "Computing medial axis", getMaximalSpheres);
-    
-    img->deallocData();
-    img->allocData();
+    }
 
-    auto writeMAT = [&](const NIBR::MT::TASK& task)->void {
-        img->data[v[task.no].first] = v[task.no].second;
-    };
-    NIBR::MT::MTRUN(v.size(), writeMAT);
 }
 
-void NIBR::surfaceMIS(NIBR::Image<float>* img, NIBR::Surface* surf)
-{
-    surf->enablePointCheck(img->smallestPixDim);
 
-    struct ComparePairs {
-    bool operator()(const std::pair<int64_t, float>& a, const std::pair<int64_t, float>& b) const {
-        return a.second > b.second;  // Compare based on the distance in descending order
-        }
-    };
 
-    std::vector<std::set<std::pair<int64_t, float>, ComparePairs>> edt;
-    edt.resize(MT::MAXNUMBEROFTHREADS());
+#define NO_SPHERE UINT32_MAX
 
-    float halfVox   = img->pixDims[0]*std::sqrt(3)+EPS4;
+namespace {
 
-    auto getEDTpair = [&](const NIBR::MT::TASK& task)->void {
+    // Inside voxels, whose distance to the surface is larger than the voxel diagonal, are returned as sphere centers,
+    // with radius equal to that distance. Spheres are sorted in descending order of radius and ties are broken with the voxel index.
+    // Distances of the remaining inside voxels are directly written in img. These are already the smallest values.
+    // Because in image space they correspond to a single voxel, they can't overwrite any other voxel.
+    std::vector<std::pair<int64_t, float>> getInscribedSpheres(NIBR::Image<float>* img, NIBR::Surface* surf)
+    {
+        surf->enablePointCheck(img->smallestPixDim);
 
-        int64_t ind = task.no;
-        float p[3];
+        float halfVox = img->pixDims[0]*std::sqrt(3)+EPS4;
 
-        img->to_xyz(ind,p);
+        std::vector<std::vector<std::pair<int64_t, float>>> spheres(NIBR::MT::MAXNUMBEROFTHREADS());
 
-        if (surf->isPointInside(p)) {
+        const int64_t chunkSize = SURFACE_QUERY_CHUNK_SIZE;
 
-            float radius = surf->distToPoint(p);
+        std::vector<float>      x, y, z;
+        std::vector<double>     dist;
+        SurfacePointQueryBuffer buf;
+
+        for (int64_t beg = 0; beg < img->numel; beg += chunkSize) {
+
+            const int64_t n = std::min(chunkSize, img->numel - beg);
+
+            x.resize(n); y.resize(n); z.resize(n);
+
+            NIBR::MT::MTRUN(n, [&](const NIBR::MT::TASK& task)->void {
+                float p[3];
+                img->to_xyz(beg+task.no,p);
+                x[task.no] = p[0];
+                y[task.no] = p[1];
+                z[task.no] = p[2];
+            });
+
+            // Distance is positive only inside
+            surf->distToPoint(x.data(),y.data(),z.data(),n,dist,buf);
+
+            NIBR::MT::MTRUN(n, [&](const NIBR::MT::TASK& task)->void {
+
+                float radius = dist[task.no];
+
+                if (radius <= 0) return;
+
+                if (radius > halfVox) {
+                    spheres[task.threadId].push_back(std::make_pair(beg+task.no, radius));
+                } else {
+                    img->data[beg+task.no] = radius;
+                }
+
+            });
 
-            if (radius > halfVox) {
-                edt[task.threadId].insert(std::make_pair(ind, radius));
-            } else {
-                // These are already the smallest values. Because in image space they will correspond to a single voxel, they can't overwrite any other voxel.
-                img->data[ind] = radius;
-            }
-            
         }
 
-    };    
-    
-    NIBR::MT::MTRUN(img->numel, "Indexing EDT", getEDTpair);
-
-    // Merge threads
-    for (int t = 1; t < MT::MAXNUMBEROFTHREADS(); t++) {
-        std::set_union(
-            edt[0].begin(), edt[0].end(),
-            edt[t].begin(), edt[t].end(),
-            std::inserter(edt[0], edt[0].end()),
-            ComparePairs()
-        );
-        edt[t].clear();
-    }
+        // Merge threads
+        for (int t = 1; t < NIBR::MT::MAXNUMBEROFTHREADS(); t++) {
+            spheres[0].insert(spheres[0].end(), spheres[t].begin(), spheres[t].end());
+            std::vector<std::pair<int64_t, float>>().swap(spheres[t]);
+        }
+
+        std::sort(spheres[0].begin(), spheres[0].end(), [](const std::pair<int64_t, float>& a, const std::pair<int64_t, float>& b)->bool {
+            return (a.second != b.second) ? (a.second > b.second) : (a.first < b.first);
+        });
 
-    // We will save 1/8 of the biggest sphere
-    std::vector<std::vector<std::vector<float>>> s;
+        return std::move(spheres[0]);
+    }
 
-    // First process the biggest sphere
-    auto it = edt[0].begin();
-    if (!edt[0].empty()) {
+    // If spheres were painted one by one in the given order, a voxel would be written only by the first sphere
+    // that covers it at a distance larger than the current value in img. Since radii are in descending order,
+    // all later spheres are blocked by the written value. So the writer of each voxel is the sphere
+    // with the smallest index among all the spheres that could write it. This is computed in parallel with
+    // an atomic min on the sphere index of each voxel, which gives the same result as painting serially.
+    // The returned array has the sphere index for each voxel, or NO_SPHERE.
+    std::atomic<uint32_t>* getSphereOwners(NIBR::Image<float>* img, const std::vector<std::pair<int64_t, float>>& spheres)
+    {
+        std::atomic<uint32_t>* owner = new std::atomic<uint32_t>[img->voxCnt];
+
+        NIBR::MT::MTRUN(img->voxCnt, [&](const NIBR::MT::TASK& task)->void {
+            owner[task.no].store(NO_SPHERE, std::memory_order_relaxed);
+        });
+
+        if (spheres.empty()) return owner;
+
+        if (spheres.size() >= std::size_t(NO_SPHERE)) {
+            disp(MSG_ERROR,"Too many inscribed spheres.");
+            return owner;
+        }
 
-        float maxRadius = it->second;
-        int R           = std::ceil(maxRadius/img->pixDims[0]);    // We assume isotropic voxel size
+        // We will save 1/8 of the biggest sphere
+        int maxR = std::ceil(spheres[0].second/img->pixDims[0]);    // We assume isotropic voxel size
 
-        s.resize(R+1);
-        for (int i = 0; i <= R; i++) {
-            s[i].resize(R+1);
-            for (int j = 0; j <= R; j++) {
-                s[i][j].resize(R+1);
-                for (int k = 0; k <= R; k++) {
-                    float r = std::sqrt(float(i*i + j*j + k*k))*img->pixDims[0];
-                    s[i][j][k] = r;
+        std::vector<std::vector<std::vector<float>>> s(maxR+1);
+        for (int i = 0; i <= maxR; i++) {
+            s[i].resize(maxR+1);
+            for (int j = 0; j <= maxR; j++) {
+                s[i][j].resize(maxR+1);
+                for (int k = 0; k <= maxR; k++) {
+                    s[i][j][k] = std::sqrt(float(i*i + j*j + k*k))*img->pixDims[0];
                 }
             }
         }
-    }
 
-    std::vector<std::pair<int64_t, float>> vedt;
-    while(it!=edt[0].end()) {
-        vedt.push_back(*it);
-        it++;
-    }
-    edt[0].clear();
+        auto findOwners = [&](const NIBR::MT::TASK& task)->void {
 
-    std::mutex* ijkAvailability = new std::mutex[img->voxCnt];
+            const uint32_t sphereNo = task.no;
+            const float    radius   = spheres[sphereNo].second;
+            const int      R        = std::ceil(radius/img->pixDims[0]);
 
-    auto getMaximalSpheres = [&](const NIBR::MT::TASK& task)->void {
+            int64_t ci,cj,ck; // i,j,k of sphere center
+            img->ind2sub(spheres[sphereNo].first,ci,cj,ck);
 
-        float radius = vedt[task.no].second;
-        int R        = std::ceil(radius/img->pixDims[0]);    // We assume isotropic voxel size
+            for (int i = ci-R; i <= ci+R; i++)
+                for (int j = cj-R; j <= cj+R; j++)
+                    for (int k = ck-R; k <= ck+R; k++) 
+                {
+                    if (!img->isInside(i, j, k)) continue;
 
-        int64_t ci,cj,ck; // i,j,k of sphere center
-        img->ind2sub(vedt[task.no].first,ci,cj,ck);
+                    float r = s[std::abs(ci - i)][std::abs(cj - j)][std::abs(ck - k)];
 
-        for (int i = ci-R; i <= ci+R; i++)
-            for (int j = cj-R; j <= cj+R; j++)
-                for (int k = ck-R; k <= ck+R; k++) 
-            {
-                if (img->isInside(i, j, k)) {
+                    if (r > radius) continue;
 
                     int64_t index = img->sub2ind(i,j,k);
-                    float r = s[std::abs(ci - i)][std::abs(cj - j)][std::abs(ck - k)];
 
-                    if (r<=radius) {
-                        {
-                            std::lock_guard<std::mutex> lock(ijkAvailability[index]);
+                    // img is not modified here, so this is the value before any sphere is painted
+                    if (r <= img->data[index]) continue;
 
-                            if (r > img->data[index]) {
-                                img->data[index] = radius;
-                            }
-                            
-                        }
-                    }
+                    uint32_t cur = owner[index].load(std::memory_order_relaxed);
+                    while ((sphereNo < cur) && !owner[index].compare_exchange_weak(cur, sphereNo, std::memory_order_relaxed)) {}
                 }
-            }        
 
+        };
+
+        NIBR::MT::MTRUN(spheres.size(), "Computing inscribed spheres", findOwners);
+
+        return owner;
+    }
+
+}
+
+void NIBR::surfaceMAT(NIBR::Image<float>* img, NIBR::Surface* surf)
+{
+    std::vector<std::pair<int64_t, float>> spheres = getInscribedSpheres(img, surf);
+    std::atomic<uint32_t>* owner                   = getSphereOwners(img, spheres);
+
+    // A sphere is on the medial axis if it writes at least one voxel
+    std::vector<uint8_t> onMedialAxis(spheres.size(),0);
+    for (int64_t n = 0; n < img->voxCnt; n++) {
+        uint32_t sphereNo = owner[n].load(std::memory_order_relaxed);
+        if (sphereNo != NO_SPHERE) onMedialAxis[sphereNo] = 1;
+    }
+
+    delete[] owner;
+
+    img->deallocData();
+    img->allocData();
+
+    auto writeMAT = [&](const NIBR::MT::TASK& task)->void {
+        if (onMedialAxis[task.no]) img->data[spheres[task.no].first] = spheres[task.no].second;
     };
+    NIBR::MT::MTRUN(spheres.size(), writeMAT);
+}
 
-    // For MIS this can be parallized.
-    NIBR::MT::MTRUN(vedt.size(), "Computing maximum inscribed spheres", getMaximalSpheres);
+void NIBR::surfaceMIS(NIBR::Image<float>* img, NIBR::Surface* surf)
+{
+    std::vector<std::pair<int64_t, float>> spheres = getInscribedSpheres(img, surf);
+    std::atomic<uint32_t>* owner                   = getSphereOwners(img, spheres);
 
-    delete[] ijkAvailability;
+    auto writeMIS = [&](const NIBR::MT::TASK& task)->void {
+        uint32_t sphereNo = owner[task.no].load(std::memory_order_relaxed);
+        if (sphereNo != NO_SPHERE) img->data[task.no] = spheres[sphereNo].second;
+    };
+    NIBR::MT::MTRUN(img->voxCnt, writeMIS);
 
-}
\ No newline at end of file
+    delete[] owner;
+}
@@ -9,6 +9,7 @@
 #include "surface/surface.h"
 #include "surface/surface_operators.h"
 #include "image/image_transform.h"
+#include "image/image_bitmask.h"
 #include "math/core.h"
 #include "math/sphere.h"
 
@@ -29,105 +30,232 @@ namespace NIBR
     template<typename T>
     bool mapSurface2Image(NIBR::Surface* surf, NIBR::Image<T>* img, float voxDim, NIBR::SurfaceField* sf, std::vector<std::vector<std::vector<std::vector<int>>>>* faceGrid, VOXELIZE_MODE mode);
 
+    // Same as above, with the face grid in compressed (CSR) form, see faceGridderCSR
+    template<typename T>
+    bool mapSurface2Image(NIBR::Surface* surf, NIBR::Image<T>* img, float voxDim, NIBR::SurfaceField* sf, std::vector<int>* faceGridOffsets, std::vector<int>* faceGridIndices, VOXELIZE_MODE mode);
+
     void surfaceMask(NIBR::Image<bool>* img, NIBR::Surface* surf);
     void surfaceMaskWithBoundary(NIBR::Image<int8_t>* img, NIBR::Surface* surf);
     void surfacePVF(NIBR::Image<float>* img, NIBR::Surface* surf);
-    void surfaceEDT(NIBR::Image<float>* img, NIBR::Surface* surf);
+    void surfaceEDT(NIBR::Image<float>* img, NIBR::Surface* surf, float maxDist = FLT_MAX); // voxels farther than maxDist are set to +/-maxDist
     void surfaceMAT(NIBR::Image<float>* img, NIBR::Surface* surf);
     void surfaceMIS(NIBR::Image<float>* img, NIBR::Surface* surf);
     
 
     template<typename T>
-    bool*** indexSurfaceBoundary(NIBR::Surface* surf, NIBR::Image<T>* img, std::vector<std::vector<std::vector<std::vector<int>>>>* faceGrid, bool markFaceInd);
+    NIBR::BitMask indexSurfaceBoundary(NIBR::Surface* surf, NIBR::Image<T>* img, std::vector<std::vector<std::vector<std::vector<int>>>>* faceGrid, bool markFaceInd);
 
-    // grid[i][j][k] has the faceIds that intersect with the voxel at [i][j][k] (in image space)
+    // Compressed (CSR) voxel-to-face grid. Faces that intersect the voxel at ind (in image space) are
+    // indices[offsets[ind]] ... indices[offsets[ind+1]-1], in increasing order.
+    //
+    // Faces are first binned to tiles of voxels using their bounding boxes. Tiles are then processed in parallel.
+    // Since each tile owns its voxels, the triangle-voxel tests and the output are written without locking.
     template<typename T>
-    void faceGridder(NIBR::Surface* surf, NIBR::Image<T>* img, std::vector<std::vector<std::vector<std::vector<int>>>>* grid, bool markFaceInd) {
-
-        disp(MSG_DEBUG,"faceGridder()");
+    void faceGridderCSR(NIBR::Surface* surf, NIBR::Image<T>* img, std::vector<int>& offsets, std::vector<int>& indices) {
 
-        float t[3][3];
-        int   hullMin[3];
-        int   hullMax[3];
-        int   voxelInds[3];
-        float min;
-        float max;
-
-        if (grid!=NULL) {
-            grid->resize(img->imgDims[0]);
-            for (int i = 0; i < img->imgDims[0]; i++) {
-                grid->at(i).resize(img->imgDims[1]);
-                for (int j = 0; j < img->imgDims[1]; j++) {
-                    grid->at(i)[j].resize(img->imgDims[2]);
-                }
-            }
-        }
+        disp(MSG_DEBUG,"faceGridderCSR()");
 
         if (surf->centersOfFaces==NULL) surf->calcCentersOfFaces();
         if (surf->normalsOfFaces==NULL) surf->calcNormalsOfFaces();
         if (surf->triangleEdge1 ==NULL) surf->calcTriangleVectors();
 
-        for (int n=0; n<surf->nf; n++) {
-        
-            img->to_ijk(surf->vertices[surf->faces[n][0]],t[0]);
-            img->to_ijk(surf->vertices[surf->faces[n][1]],t[1]);
-            img->to_ijk(surf->vertices[surf->faces[n][2]],t[2]);
-            
+        const int     tileSize   = 16;
+        const int64_t dims[3]    = {img->imgDims[0], img->imgDims[1], img->imgDims[2]};
+        const int64_t tileCnt[3] = {(dims[0]+tileSize-1)/tileSize, (dims[1]+tileSize-1)/tileSize, (dims[2]+tileSize-1)/tileSize};
+        const int64_t nTiles     = tileCnt[0]*tileCnt[1]*tileCnt[2];
+
+        offsets.assign(img->voxCnt+1,0);
+        indices.clear();
+
+        if ((surf->nf==0) || (nTiles==0)) return;
+
+        // Triangles in image space and their hulls, which are clamped to the image
+        std::vector<float> tri (size_t(surf->nf)*9);
+        std::vector<int>   hull(size_t(surf->nf)*6);
+        std::vector<std::vector<std::pair<int64_t,int>>> tileFacePairs(NIBR::MT::MAXNUMBEROFTHREADS());
+
+        NIBR::MT::MTRUN(surf->nf, [&](const NIBR::MT::TASK& task)->void {
+
+            const int n = task.no;
+            float*    t = &tri[size_t(n)*9];
+            int*      h = &hull[size_t(n)*6];
+
+            img->to_ijk(surf->vertices[surf->faces[n][0]],t+0);
+            img->to_ijk(surf->vertices[surf->faces[n][1]],t+3);
+            img->to_ijk(surf->vertices[surf->faces[n][2]],t+6);
+
             for (int k=0; k<3; k++) {
 
-                min =  INFINITY;
-                max = -INFINITY;
+                float min = std::min(std::min(t[k],t[3+k]),t[6+k]);
+                float max = std::max(std::max(t[k],t[3+k]),t[6+k]);
 
-                for (int i=0; i<3; i++) {
+                if (!std::isfinite(min) || !std::isfinite(max)) {h[0] = 0; h[3] = -1; return;}
 
-                    if (t[i][k]<min) {
-                        min         = t[i][k];
-                        hullMin[k]  = std::round(min) - 1;
-                    }
+                h[k]   = std::max(int64_t(std::round(min) - 1), int64_t(0));
+                h[3+k] = std::min(int64_t(std::round(max) + 1), dims[k]-1);
 
-                    if (t[i][k]>max) {
-                        max         = t[i][k];
-                        hullMax[k]  = std::round(max) + 1;
-                    }
+                if (h[k] > h[3+k]) return;
 
-                }
+            }
 
+            for (int a = h[0]/tileSize; a <= h[3]/tileSize; a++)
+                for (int b = h[1]/tileSize; b <= h[4]/tileSize; b++)
+                    for (int c = h[2]/tileSize; c <= h[5]/tileSize; c++)
+                        tileFacePairs[task.threadId].push_back(std::make_pair(a + tileCnt[0]*(b + tileCnt[1]*c), n));
+
+        });
+
+        // Bin faces to tiles
+        std::vector<int64_t> tileOffsets(nTiles+1,0);
+        for (const auto& pairs : tileFacePairs)
+            for (const auto& p : pairs)
+                tileOffsets[p.first+1]++;
+        for (int64_t n = 0; n < nTiles; n++)
+            tileOffsets[n+1] += tileOffsets[n];
+
+        std::vector<int> tileFaces(tileOffsets[nTiles]);
+        {
+            std::vector<int64_t> pos(tileOffsets.begin(),tileOffsets.end()-1);
+            for (auto& pairs : tileFacePairs) {
+                for (const auto& p : pairs)
+                    tileFaces[pos[p.first]++] = p.second;
+                std::vector<std::pair<int64_t,int>>().swap(pairs);
             }
+        }
 
-            for (int i=hullMin[0]; i<=hullMax[0]; i++)
-                for (int j=hullMin[1]; j<=hullMax[1]; j++)
-                    for (int k=hullMin[2]; k<=hullMax[2]; k++) {
-                        
-                        voxelInds[0] = i;
-                        voxelInds[1] = j;
-                        voxelInds[2] = k;
-                            
-                        if ( img->isInside(voxelInds) && triangleLargerVoxelIntersection(voxelInds, t[0], t[1], t[2]) ) {
-
-                            if (grid!=NULL) {
-                                (*grid)[voxelInds[0]][voxelInds[1]][voxelInds[2]].push_back(n);
-                            }
-                            
-                            int64_t ind = img->sub2ind(i,j,k);
-                            if (markFaceInd) {
-                                if (img->data[ind]<(n+1)) 
-                                    img->data[ind] = n + 1; // So that the value is not mixed with OUTSIDE
-                            } else {
-                                img->data[ind] = 1;
+        // Triangle-voxel tests. Faces are sorted in each tile, so the hits of each voxel come out in increasing face order.
+        std::vector<std::vector<std::pair<int64_t,int>>> tileHits(nTiles);
+
+        NIBR::MT::MTRUN(nTiles, [&](const NIBR::MT::TASK& task)->void {
+
+            const int64_t tileNo = task.no;
+            if (tileOffsets[tileNo] == tileOffsets[tileNo+1]) return;
+
+            const int64_t ti   = tileNo % tileCnt[0];
+            const int64_t tj   = (tileNo / tileCnt[0]) % tileCnt[1];
+            const int64_t tk   = tileNo / (tileCnt[0]*tileCnt[1]);
+            const int64_t tMin[3] = {ti*tileSize, tj*tileSize, tk*tileSize};
+            const int64_t tMax[3] = {std::min(tMin[0]+tileSize,dims[0])-1, std::min(tMin[1]+tileSize,dims[1])-1, std::min(tMin[2]+tileSize,dims[2])-1};
+
+            std::sort(tileFaces.begin()+tileOffsets[tileNo], tileFaces.begin()+tileOffsets[tileNo+1]);
+
+            auto& hits = tileHits[tileNo];
+            int   voxelInds[3];
+            float t[3][3];
+
+            for (int64_t m = tileOffsets[tileNo]; m < tileOffsets[tileNo+1]; m++) {
+
+                const int  n = tileFaces[m];
+                const int* h = &hull[size_t(n)*6];
+
+                std::copy(&tri[size_t(n)*9], &tri[size_t(n)*9]+9, &t[0][0]);
+
+                for (int i = std::max(int64_t(h[0]),tMin[0]); i <= std::min(int64_t(h[3]),tMax[0]); i++)
+                    for (int j = std::max(int64_t(h[1]),tMin[1]); j <= std::min(int64_t(h[4]),tMax[1]); j++)
+                        for (int k = std::max(int64_t(h[2]),tMin[2]); k <= std::min(int64_t(h[5]),tMax[2]); k++) {
+
+                            voxelInds[0] = i;
+                            voxelInds[1] = j;
+                            voxelInds[2] = k;
+
+                            if (triangleLargerVoxelIntersection(voxelInds, t[0], t[1], t[2])) {
+                                int64_t ind = img->sub2ind(i,j,k);
+                                hits.push_back(std::make_pair(ind,n));
+                                offsets[ind+1]++;
                             }
 
                         }
 
-                    }
+            }
+
+        });
+
+        for (int64_t n = 0; n < img->voxCnt; n++)
+            offsets[n+1] += offsets[n];
+
+        indices.resize(offsets[img->voxCnt]);
+
+        NIBR::MT::MTRUN(nTiles, [&](const NIBR::MT::TASK& task)->void {
+            auto& hits = tileHits[task.no];
+            for (const auto& hit : hits) {
+                // offsets[ind] is used as the write position of ind, which ends up at the beginning of ind+1
+                indices[offsets[hit.first]] = hit.second;
+                offsets[hit.first]++;
+            }
+        });
+
+        // Shift the offsets back
+        for (int64_t n = img->voxCnt; n > 0; n--)
+            offsets[n] = offsets[n-1];
+        offsets[0] = 0;
+
+        disp(MSG_DEBUG,"Done faceGridderCSR()");
+
+    }
+
+    // Marks the voxels that have faces in the CSR grid. The value is either 1, or the largest faceId+1 if markFaceInd is true,
+    // so that it is not mixed with OUTSIDE.
+    template<typename T>
+    void markFaceGrid(NIBR::Image<T>* img, const std::vector<int>& offsets, const std::vector<int>& indices, bool markFaceInd) {
+
+        NIBR::MT::MTRUN(img->voxCnt, [&](const NIBR::MT::TASK& task)->void {
+
+            const int64_t ind = task.no;
+            if (offsets[ind] == offsets[ind+1]) return;
+
+            if (markFaceInd) {
+                const int n = indices[offsets[ind+1]-1];
+                if (img->data[ind]<(n+1)) 
+                    img->data[ind] = n + 1;
+            } else {
+                img->data[ind] = 1;
+            }
+
+        });
+
+    }
+
+    // Expands the CSR grid into grid[i][j][k]
+    template<typename T>
+    void faceGridCSR2Vector(NIBR::Image<T>* img, const std::vector<int>& offsets, const std::vector<int>& indices, std::vector<std::vector<std::vector<std::vector<int>>>>* grid) {
+
+        grid->resize(img->imgDims[0]);
+        for (int i = 0; i < img->imgDims[0]; i++) {
+            grid->at(i).resize(img->imgDims[1]);
+            for (int j = 0; j < img->imgDims[1]; j++) {
+                grid->at(i)[j].resize(img->imgDims[2]);
+            }
         }
 
+        NIBR::MT::MTRUN(img->voxCnt, [&](const NIBR::MT::TASK& task)->void {
+            const int64_t ind = task.no;
+            if (offsets[ind] == offsets[ind+1]) return;
+            int64_t i,j,k;
+            img->ind2sub(ind,i,j,k);
+            (*grid)[i][j][k].assign(indices.begin()+offsets[ind], indices.begin()+offsets[ind+1]);
+        });
+
+    }
+
+    // grid[i][j][k] has the faceIds that intersect with the voxel at [i][j][k] (in image space)
+    template<typename T>
+    void faceGridder(NIBR::Surface* surf, NIBR::Image<T>* img, std::vector<std::vector<std::vector<std::vector<int>>>>* grid, bool markFaceInd) {
+
+        disp(MSG_DEBUG,"faceGridder()");
+
+        std::vector<int> offsets, indices;
+        faceGridderCSR(surf, img, offsets, indices);
+        markFaceGrid(img, offsets, indices, markFaceInd);
+
+        if (grid!=NULL) faceGridCSR2Vector(img, offsets, indices, grid);
+
         disp(MSG_DEBUG,"Done faceGridder()");
         
     }
 
     // out[i][j][k] has the faceIds that intersect with the voxel at [i][j][k] (in image space)
     template <typename T>
-    bool*** indexSurfaceBoundary(NIBR::Surface* surf, NIBR::Image<T>* img, std::vector<std::vector<std::vector<std::vector<int>>>>* faceGrid, bool markFaceInd) 
+    NIBR::BitMask indexSurfaceBoundary(NIBR::Surface* surf, NIBR::Image<T>* img, std::vector<std::vector<std::vector<std::vector<int>>>>* faceGrid, bool markFaceInd) 
     {
 
         if (img->numberOfDimensions==0)
@@ -140,21 +268,16 @@ namespace NIBR
         faceGridder(surf, img, &grid, markFaceInd);
         disp(MSG_DETAIL,"Face grid computed.");
 
-        // Create mask
-        bool*** mask = new bool**[img->imgDims[0]];
-        for (int i = 0; i < img->imgDims[0]; i++) {
-            mask[i] = new bool*[img->imgDims[1]];
-            for (int j = 0; j < img->imgDims[1]; j++) {
-                mask[i][j] = new bool[img->imgDims[2]];
-            }
-        }
+        // Create mask. Each task fills whole rows of the mask.
+        NIBR::BitMask mask(img->imgDims);
 
         auto createMask = [&](const NIBR::MT::TASK& task)->void {
-            int64_t i,j,k;
-            img->ind2sub(int64_t(task.no),i,j,k);
-            mask[i][j][k] = (!grid[i][j][k].empty()) ? true : false;
+            const int64_t k = task.no;
+            for (int64_t j = 0; j < img->imgDims[1]; j++)
+                for (int64_t i = 0; i < img->imgDims[0]; i++)
+                    if (!grid[i][j][k].empty()) mask.set(i,j,k,true);
         };
-        NIBR::MT::MTRUN(img->voxCnt, NIBR::MT::MAXNUMBEROFTHREADS(), createMask);
+        NIBR::MT::MTRUN(img->imgDims[2], NIBR::MT::MAXNUMBEROFTHREADS(), createMask);
 
         *faceGrid = std::move(grid);
 
@@ -218,21 +341,26 @@ namespace NIBR
         NIBR::Image<T>* img, 
         float voxDim,
         NIBR::SurfaceField* sf, 
-        std::vector<std::vector<std::vector<std::vector<int>>>>* faceGrid, 
+        std::vector<int>* faceGridOffsets, 
+        std::vector<int>* faceGridIndices, 
         VOXELIZE_MODE mode) 
     {
         if (!prepVoxelization(surf,img,voxDim,sf,mode)) 
             return false;
 
         if (surf->nv==0) {
-            if (faceGrid!=NULL) std::vector<std::vector<std::vector<std::vector<int>>>>().swap(*faceGrid);
+            if (faceGridOffsets!=NULL) faceGridOffsets->assign(std::max(img->voxCnt,int64_t(0))+1,0);
+            if (faceGridIndices!=NULL) faceGridIndices->clear();
             if (img->numberOfDimensions!=0) {img->deallocData();img->allocData();}
             return true;
         }
 
-        // if ((mode!=MASK) || (faceGrid!=NULL)) {
-        if ((mode==ONLY_BOUNDARY) || (mode==MASK_WITH_BOUNDARY) || (mode==PARTIAL_VOLUME) || (mode==FIELD_LABEL) || (faceGrid!=NULL)) {
-            faceGridder(surf, img, faceGrid, (mode==FIELD_LABEL));
+        if ((mode==ONLY_BOUNDARY) || (mode==MASK_WITH_BOUNDARY) || (mode==FIELD_LABEL) || (faceGridOffsets!=NULL) || (faceGridIndices!=NULL)) {
+            std::vector<int> offsets, indices;
+            faceGridderCSR(surf, img, offsets, indices);
+            markFaceGrid(img, offsets, indices, (mode==FIELD_LABEL));
+            if (faceGridOffsets!=NULL) faceGridOffsets->swap(offsets);
+            if (faceGridIndices!=NULL) faceGridIndices->swap(indices);
             disp(MSG_DETAIL,"Face grid is computed.");
         }
 
@@ -323,4 +451,29 @@ namespace NIBR
 
     }
 
+    template<typename T>
+    bool mapSurface2Image(
+        NIBR::Surface* surf, 
+        NIBR::Image<T>* img, 
+        float voxDim,
+        NIBR::SurfaceField* sf, 
+        std::vector<std::vector<std::vector<std::vector<int>>>>* faceGrid, 
+        VOXELIZE_MODE mode) 
+    {
+        if (faceGrid==NULL) 
+            return mapSurface2Image(surf,img,voxDim,sf,(std::vector<int>*)NULL,(std::vector<int>*)NULL,mode);
+
+        std::vector<int> offsets, indices;
+
+        if (!mapSurface2Image(surf,img,voxDim,sf,&offsets,&indices,mode))
+            return false;
+
+        if (surf->nv==0)
+            std::vector<std::vector<std::vector<std::vector<int>>>>().swap(*faceGrid);
+        else
+            faceGridCSR2Vector(img, offsets, indices, faceGrid);
+
+        return true;
+    }
+
 }
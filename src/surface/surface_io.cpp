@@ -220,14 +220,13 @@ bool NIBR::Surface::readVTKMesh()
     }
     NIBR::disp(MSG_DEBUG,"Number of vertices: %d", nv);
 
-    vertices = new float *[nv];
+    vertices = allocateRows3<float>(nv);
     if (std::string(type) == "ASCII\n")
     {
         skipWhitespace();
         disp(MSG_DEBUG,"Reading ASCII VTK mesh with %d vertices and %d faces.", nv, nf);
         for (int n = 0; n < nv; n++)
         {
-            vertices[n] = new float[3];
             std::fscanf(input, "%f %f %f\n", &vertices[n][0], &vertices[n][1], &vertices[n][2]);
             skipWhitespace();
             if ( n < 5 )
@@ -237,16 +236,11 @@ bool NIBR::Surface::readVTKMesh()
     else
     {
         disp(MSG_DEBUG,"Reading BINARY VTK mesh with %d vertices and %d faces.", nv, nf);
-        float tmpf;
-        for (int n = 0; n < nv; n++)
-        {
-            vertices[n] = new float[3];
-            for (int i = 0; i < 3; i++)
-            {
-                std::fread(&tmpf, sizeof(float), 1, input);
-                swapByteOrder(tmpf);
-                vertices[n][i] = tmpf;
-            }
+        // Vertices are contiguous, so they are read in one go
+        if (nv > 0) {
+            std::fread(vertices[0], sizeof(float), std::size_t(nv) * 3, input);
+            for (std::size_t i = 0; i < std::size_t(nv) * 3; i++)
+                swapByteOrder(vertices[0][i]);
         }
     }
 
@@ -264,14 +258,13 @@ bool NIBR::Surface::readVTKMesh()
 
     NIBR::disp(MSG_DEBUG,"Number of faces: %d", nf);
 
-    faces = new int *[nf];
+    faces = allocateRows3<int>(nf);
     if (std::string(type) == "ASCII\n")
     {
         skipWhitespace();
         disp(MSG_DEBUG,"Reading ASCII VTK mesh with %d vertices and %d faces.", nv, nf);
         for (int n = 0; n < nf; n++)
         {
-            faces[n] = new int[3];
             std::fscanf(input, "%*d %d %d %d\n", &faces[n][0], &faces[n][1], &faces[n][2]);
             skipWhitespace();
             if ( n < 5 )
@@ -284,7 +277,6 @@ bool NIBR::Surface::readVTKMesh()
         int tmpi;
         for (int n = 0; n < nf; n++)
         {
-            faces[n] = new int[3];
             std::fread(&tmpi, sizeof(int), 1, input); // Skip the 3
             for (int i = 0; i < 3; i++)
             {
@@ -310,23 +302,15 @@ bool NIBR::Surface::readGIIMesh()
     {
         if (gifti->darray[i]->intent == NIFTI_INTENT_POINTSET)
         {
-            vertices = new float *[nv];
-            for (int j = 0; j < nv; j++)
-            {
-                vertices[j] = new float[3];
-                for (int k = 0; k < 3; k++)
-                    vertices[j][k] = ((float *)gifti->darray[i]->data)[j * 3 + k];
-            }
+            vertices = allocateRows3<float>(nv);
+            if (nv > 0)
+                std::memcpy(vertices[0], gifti->darray[i]->data, std::size_t(nv) * 3 * sizeof(float));
         }
         if (gifti->darray[i]->intent == NIFTI_INTENT_TRIANGLE)
         {
-            faces = new int *[nf];
-            for (int j = 0; j < nf; j++)
-            {
-                faces[j] = new int[3];
-                for (int k = 0; k < 3; k++)
-                    faces[j][k] = ((int *)gifti->darray[i]->data)[j * 3 + k];
-            }
+            faces = allocateRows3<int>(nf);
+            if (nf > 0)
+                std::memcpy(faces[0], gifti->darray[i]->data, std::size_t(nf) * 3 * sizeof(int));
         }
     }
     
@@ -354,30 +338,18 @@ bool NIBR::Surface::readFreesurferMesh()
         fgets(dummy, strLength, input);           // Skip the metadata
     std::fseek(input, sizeof(int) * 2, SEEK_CUR); // Skip getting number of vertices and faces, these are already done before
 
-    vertices = new float *[nv];
-    float tmpf;
-    for (int n = 0; n < nv; n++)
-    {
-        vertices[n] = new float[3];
-        for (int i = 0; i < 3; i++)
-        {
-            std::fread(&tmpf, sizeof(float), 1, input);
-            swapByteOrder(tmpf);
-            vertices[n][i] = tmpf;
-        }
+    vertices = allocateRows3<float>(nv);
+    if (nv > 0) {
+        std::fread(vertices[0], sizeof(float), std::size_t(nv) * 3, input);
+        for (std::size_t i = 0; i < std::size_t(nv) * 3; i++)
+            swapByteOrder(vertices[0][i]);
     }
 
-    faces = new int *[nf];
-    int tmpi;
-    for (int n = 0; n < nf; n++)
-    {
-        faces[n] = new int[3];
-        for (int i = 0; i < 3; i++)
-        {
-            std::fread(&tmpi, sizeof(int), 1, input);
-            swapByteOrder(tmpi);
-            faces[n][i] = tmpi;
-        }
+    faces = allocateRows3<int>(nf);
+    if (nf > 0) {
+        std::fread(faces[0], sizeof(int), std::size_t(nf) * 3, input);
+        for (std::size_t i = 0; i < std::size_t(nf) * 3; i++)
+            swapByteOrder(faces[0][i]);
     }
 
     fclose(input);
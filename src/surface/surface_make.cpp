@@ -5,11 +5,7 @@ using namespace NIBR;
 Surface NIBR::surfMakeBox(const std::vector<float>& bbox) 
 {
 
-    float** vertices = new float*[8];
-
-    for (int i = 0; i < 8; ++i) {
-        vertices[i] = new float[3];
-    }
+    float** vertices = allocateRows3<float>(8);
 
     vertices[0][0] = bbox[0]; vertices[0][1] = bbox[2]; vertices[0][2] = bbox[4];
     vertices[1][0] = bbox[1]; vertices[1][1] = bbox[2]; vertices[1][2] = bbox[4];
@@ -31,9 +27,8 @@ Surface NIBR::surfMakeBox(const std::vector<float>& bbox)
     };
 
     // Allocate memory for faces
-    int** faces = new int*[12];
+    int** faces = allocateRows3<int>(12);
     for(int i = 0; i < 12; ++i) {
-        faces[i] = new int[3];
         for(int j = 0; j < 3; ++j) {
             faces[i][j] = faceIndices[i][j];
         }
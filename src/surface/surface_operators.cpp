@@ -135,45 +135,146 @@ Surface NIBR::surfRemoveAllBoundaryVertices(Surface& surf)
 }
 
 Surface NIBR::surfMerge(const Surface& s1, const Surface& s2) 
+{
+    return surfMerge(std::vector<const Surface*>{&s1,&s2});
+}
+
+// All surfaces are concatenated in a single pass. Vertex and face offsets are computed first,
+// then each surface is copied into its own slice of the output in parallel.
+Surface NIBR::surfMerge(const std::vector<const Surface*>& surfs) 
 {
 
     // disp(MSG_DEBUG,"surfMerge");
 
-    if (s1.nv == 0) return s2;
-    if (s2.nv == 0) return s1;
+    std::vector<const Surface*> inp;
+    for (auto s : surfs) {
+        if ((s != NULL) && (s->nv > 0)) inp.push_back(s);
+    }
 
-    // Allocate and copy vertices
-    Surface out;
+    if (inp.empty())     return Surface();
+    if (inp.size() == 1) return *inp[0];
 
-	out.nv       = s1.nv + s2.nv;
-    out.vertices = new float*[out.nv];
+    std::vector<int> vertOffset(inp.size()+1,0);
+    std::vector<int> faceOffset(inp.size()+1,0);
 
-    for (int i=0; i<s1.nv; i++) {
-        out.vertices[i] = new float[3];
-        memcpy(out.vertices[i], s1.vertices[i], 3*sizeof(float));
+    for (size_t n = 0; n < inp.size(); n++) {
+        vertOffset[n+1] = vertOffset[n] + inp[n]->nv;
+        faceOffset[n+1] = faceOffset[n] + inp[n]->nf;
     }
 
-    for (int i=0; i<s2.nv; i++) {
-        out.vertices[i+s1.nv] = new float[3];
-        memcpy(out.vertices[i+s1.nv], s2.vertices[i], 3*sizeof(float));
+    Surface out;
+    out.nv       = vertOffset.back();
+    out.nf       = faceOffset.back();
+    out.vertices = allocateRows3<float>(out.nv);
+    out.faces    = allocateRows3<int>(out.nf);
+
+    NIBR::MT::MTRUN(inp.size(), [&](const NIBR::MT::TASK& task)->void {
+
+        const Surface* s = inp[task.no];
+        const int      o = vertOffset[task.no];
+
+        std::memcpy(out.vertices[o], s->vertices[0], std::size_t(s->nv)*3*sizeof(float));
+
+        if (s->nf == 0) return;
+
+        int* f = out.faces[faceOffset[task.no]];
+        for (int i = 0; i < 3*s->nf; i++) {
+            f[i] = s->faces[0][i] + o;
+        }
+
+    });
+
+    // disp(MSG_DEBUG,"Done surfMerge");
+    return out;
+
+}
+
+// Vertices closer than tolerance are merged into the first of them, using a hash grid with cell size equal to tolerance,
+// so that only the 27 neighboring cells are checked for each vertex. Faces that collapse after merging are removed.
+// This is opt-in; surfMerge does not weld.
+Surface NIBR::surfWeldVertices(const Surface& surf, float tolerance) 
+{
+
+    if (tolerance < 0) {
+        disp(MSG_ERROR,"Welding tolerance must be non-negative");
+        return Surface(surf,true);
     }
-    
-    // Allocate and copy faces
-    out.nf     = s1.nf + s2.nf;
-    out.faces  = new int*[out.nf];
-    for (int i=0; i<out.nf; i++) out.faces[i] = new int[3];
 
-    for (int i=0; i<s1.nf; i++) {
-        memcpy(out.faces[i], s1.faces[i], 3*sizeof(int));
+    if (surf.nv == 0) {return Surface();}
+
+    const float cellSize = std::max(tolerance, float(EPS6));
+    const float tol2     = tolerance*tolerance;
+
+    auto getCell = [&](const float* p, int64_t* c)->void {
+        for (int i = 0; i < 3; i++)
+            c[i] = int64_t(std::floor(p[i]/cellSize));
+    };
+
+    // Keys wrap around for huge coordinates, which only causes more candidates to be checked
+    auto getKey = [](int64_t x, int64_t y, int64_t z)->uint64_t {
+        return (uint64_t(x) * 73856093ULL) ^ (uint64_t(y) * 19349663ULL) ^ (uint64_t(z) * 83492791ULL);
+    };
+
+    std::unordered_map<uint64_t, std::vector<int>> grid;
+    grid.reserve(surf.nv);
+
+    std::vector<int> newIndex(surf.nv,-1);
+    std::vector<int> keptVertices;
+    keptVertices.reserve(surf.nv);
+
+    for (int v = 0; v < surf.nv; v++) {
+
+        int64_t c[3];
+        getCell(surf.vertices[v],c);
+
+        for (int64_t x = c[0]-1; (x <= c[0]+1) && (newIndex[v] < 0); x++)
+            for (int64_t y = c[1]-1; (y <= c[1]+1) && (newIndex[v] < 0); y++)
+                for (int64_t z = c[2]-1; (z <= c[2]+1) && (newIndex[v] < 0); z++) {
+                    auto it = grid.find(getKey(x,y,z));
+                    if (it == grid.end()) continue;
+                    for (int k : it->second) {
+                        if (squared_dist(surf.vertices[v],surf.vertices[keptVertices[k]]) <= tol2) {
+                            newIndex[v] = k;
+                            break;
+                        }
+                    }
+                }
+
+        if (newIndex[v] < 0) {
+            newIndex[v] = keptVertices.size();
+            grid[getKey(c[0],c[1],c[2])].push_back(newIndex[v]);
+            keptVertices.push_back(v);
+        }
+
     }
 
-    for (int i=0; i<s2.nf; i++) {
-        out.faces[i+s1.nf][0] = s2.faces[i][0] + s1.nv;
-        out.faces[i+s1.nf][1] = s2.faces[i][1] + s1.nv;
-        out.faces[i+s1.nf][2] = s2.faces[i][2] + s1.nv;
+    if (int(keptVertices.size()) == surf.nv) return Surface(surf,true);
+
+    Surface out;
+    out.nv       = keptVertices.size();
+    out.vertices = allocateRows3<float>(out.nv);
+
+    NIBR::MT::MTRUN(out.nv, [&](const NIBR::MT::TASK& task)->void {
+        std::memcpy(out.vertices[task.no], surf.vertices[keptVertices[task.no]], 3*sizeof(float));
+    });
+
+    std::vector<int> keptFaces;
+    keptFaces.reserve(surf.nf);
+    for (int n = 0; n < surf.nf; n++) {
+        int a = newIndex[surf.faces[n][0]];
+        int b = newIndex[surf.faces[n][1]];
+        int c = newIndex[surf.faces[n][2]];
+        if ((a != b) && (a != c) && (b != c)) keptFaces.push_back(n);
     }
 
-    // disp(MSG_DEBUG,"Done surfMerge");
+    out.nf    = keptFaces.size();
+    out.faces = allocateRows3<int>(out.nf);
+
+    NIBR::MT::MTRUN(out.nf, [&](const NIBR::MT::TASK& task)->void {
+        for (int i = 0; i < 3; i++)
+            out.faces[task.no][i] = newIndex[surf.faces[keptFaces[task.no]][i]];
+    });
+
     return out;
 
 }
@@ -188,15 +289,52 @@ Surface NIBR::surfDiff(const Surface& s1, const Surface& s2)
 
     // disp(MSG_DEBUG,"surfDiff");
 
-    std::vector<bool> vertexMask(s1.nv);
-    for (int i = 0; i < s1.nv; i++) {
-        for (int j = 0; j < s2.nv; j++) {
-            vertexMask[i] = ((std::fabs(s1.vertices[i][0] - s2.vertices[j][0]) > EPS6 ) || (std::fabs(s1.vertices[i][1] - s2.vertices[j][1]) > EPS6 ) || (std::fabs(s1.vertices[i][2] - s2.vertices[j][2]) > EPS6 ));
-            if (vertexMask[i]==0)
-                break;
-        }
+    // Vertices of s2 are hashed on a grid with EPS6 cells, so that each vertex of s1 is only compared with the
+    // vertices of s2 in the neighboring cells.
+    auto getCell = [](const float* p, int64_t* c)->void {
+        for (int i = 0; i < 3; i++)
+            c[i] = int64_t(std::floor(p[i]/float(EPS6)));
+    };
+
+    auto getKey = [](int64_t x, int64_t y, int64_t z)->uint64_t {
+        return (uint64_t(x) * 73856093ULL) ^ (uint64_t(y) * 19349663ULL) ^ (uint64_t(z) * 83492791ULL);
+    };
+
+    std::unordered_map<uint64_t, std::vector<int>> grid;
+    grid.reserve(s2.nv);
+
+    for (int j = 0; j < s2.nv; j++) {
+        int64_t c[3];
+        getCell(s2.vertices[j],c);
+        grid[getKey(c[0],c[1],c[2])].push_back(j);
     }
 
+    std::vector<uint8_t> keep(s1.nv,1);
+
+    NIBR::MT::MTRUN(s1.nv, [&](const NIBR::MT::TASK& task)->void {
+
+        const int i = task.no;
+
+        int64_t c[3];
+        getCell(s1.vertices[i],c);
+
+        for (int64_t x = c[0]-1; x <= c[0]+1; x++)
+            for (int64_t y = c[1]-1; y <= c[1]+1; y++)
+                for (int64_t z = c[2]-1; z <= c[2]+1; z++) {
+                    auto it = grid.find(getKey(x,y,z));
+                    if (it == grid.end()) continue;
+                    for (int j : it->second) {
+                        if ((std::fabs(s1.vertices[i][0] - s2.vertices[j][0]) <= EPS6 ) && (std::fabs(s1.vertices[i][1] - s2.vertices[j][1]) <= EPS6 ) && (std::fabs(s1.vertices[i][2] - s2.vertices[j][2]) <= EPS6 )) {
+                            keep[i] = 0;
+                            return;
+                        }
+                    }
+                }
+
+    });
+
+    std::vector<bool> vertexMask(keep.begin(),keep.end());
+
     // disp(MSG_DEBUG,"Done surfDiff..calling applyMask");
 
     return applyMask(s1, vertexMask);
@@ -400,10 +538,84 @@ Surface NIBR::surfMoveVerticesAlongNormal(const Surface& surf, float shift) {
         out.vertices[n][2] += out.normalsOfVertices[n][2]*shift;
     }
 
+    out.refreshDerivedData();
+
     return out;
 
 }
 
+// Each iteration moves every vertex to the average of the other two vertices of its faces, i.e., neighbors are weighted by
+// the number of faces sharing the edge, as in geogram's simple_Laplacian_smooth. This is a sparse matrix-vector product
+// with the uniform Laplacian, which is done in parallel on the cached vertex-to-face CSR lists.
+Surface NIBR::surfSmooth(const Surface& surf,int smoothing_iterations) {
+
+    if (surf.nv == 0) {return Surface();}
+
+    Surface out = surfRepair(surf);
+
+    if ((out.nv == 0) || (smoothing_iterations < 1)) return surfRepair(out);
+
+    out.getNeighboringFacesCSR();
+
+    std::vector<double> cur(size_t(out.nv)*3);
+    std::vector<double> nxt(size_t(out.nv)*3);
+
+    for (int n = 0; n < out.nv; n++) {
+        cur[n*3+0] = out.vertices[n][0];
+        cur[n*3+1] = out.vertices[n][1];
+        cur[n*3+2] = out.vertices[n][2];
+    }
+
+    for (int iter = 0; iter < smoothing_iterations; iter++) {
+
+        NIBR::MT::MTRUN(out.nv, [&](const NIBR::MT::TASK& task)->void {
+
+            const int v   = task.no;
+            const int beg = out.neighboringFacesOffsets[v];
+            const int end = out.neighboringFacesOffsets[v+1];
+
+            if (beg == end) {
+                nxt[v*3+0] = cur[v*3+0];
+                nxt[v*3+1] = cur[v*3+1];
+                nxt[v*3+2] = cur[v*3+2];
+                return;
+            }
+
+            double p[3] = {0,0,0};
+
+            for (int k = beg; k < end; k++) {
+                const int* face = out.faces[out.neighboringFacesIndices[k]];
+                for (int i = 0; i < 3; i++) {
+                    if (face[i] == v) continue;
+                    p[0] += cur[face[i]*3+0];
+                    p[1] += cur[face[i]*3+1];
+                    p[2] += cur[face[i]*3+2];
+                }
+            }
+
+            const double scale = 1.0/double(2*(end-beg));
+            nxt[v*3+0] = p[0]*scale;
+            nxt[v*3+1] = p[1]*scale;
+            nxt[v*3+2] = p[2]*scale;
+
+        });
+
+        std::swap(cur,nxt);
+
+    }
+
+    for (int n = 0; n < out.nv; n++) {
+        out.vertices[n][0] = cur[n*3+0];
+        out.vertices[n][1] = cur[n*3+1];
+        out.vertices[n][2] = cur[n*3+2];
+    }
+
+    out.refreshDerivedData();
+
+    return surfRepair(out);
+
+}
+
 Surface NIBR::meanCurvatureFlow(const Surface& surf, float dt, int iterationCount) {
 
     if (surf.nv < 1) return surf;
@@ -412,22 +624,26 @@ Surface NIBR::meanCurvatureFlow(const Surface& surf, float dt, int iterationCoun
     Surface out(surf, true);
     out.toEigen();
 
+    // The sparsity pattern of the system matrix only depends on the connectivity.
+    // So the symbolic analysis is done once, and only the numerical factorization is repeated in the iterations.
+    Eigen::SimplicialLLT<Eigen::SparseMatrix<double>> solver;
+    Eigen::SparseMatrix<double> L, M, A;
+
     for (int i = 0; i < iterationCount; ++i) {
 
         // Compute the cotangent Laplacian
-        Eigen::SparseMatrix<double> L;
         igl::cotmatrix(out.V, out.F, L);
 
         // Compute the mass matrix
-        Eigen::SparseMatrix<double> M;
         igl::massmatrix(out.V, out.F, igl::MASSMATRIX_TYPE_VORONOI, M);
 
         // Assemble the system matrix
-        Eigen::SparseMatrix<double> A = M - dt * L;
+        A = M - dt * L;
+        A.makeCompressed();
 
         // Factorize the system matrix
-        Eigen::SimplicialLLT<Eigen::SparseMatrix<double>> solver;
-        solver.compute(A);
+        if (i == 0) solver.analyzePattern(A);
+        solver.factorize(A);
 
         if (solver.info() != Eigen::Success) {
             disp(MSG_FATAL,"Failed to factorize the system matrix.");
@@ -662,32 +878,20 @@ Surface NIBR::surfGlueBoundaries(const Surface& inp1, const Surface& inp2)
 
         // Allocate memory for new vertex list, and copy the previous vertices
         int     newNv       = surf.nv + missingVertCnt; // increased vertices
-        float** newVertices = new float*[newNv];
-        for (int n = 0; n < newNv; n++) {
-            newVertices[n] = (n < surf.nv) ? surf.vertices[n] : (new float[3]());
-        }
-        delete[] surf.vertices;
+        resizeRows3(surf.vertices, surf.nv, newNv);
         int newVertexIndex  = surf.nv;
         surf.nv             = newNv;
-        surf.vertices       = newVertices;
 
         // Allocate memory for new face list, and copy the previous faces
         int     newNf       = surf.nf + missingVertCnt; // increased faces, one faces per vertex is added
-        int**   newFaces    = new int*[newNf];
-        for (int n = 0; n < newNf; n++) {
-            if (n < surf.nf) {
-                newFaces[n] = surf.faces[n];
-            } else {
-                newFaces[n]     = new int[3];
-                newFaces[n][0]  = INT_MAX;
-                newFaces[n][1]  = INT_MAX;
-                newFaces[n][2]  = INT_MAX;
-            }
+        resizeRows3(surf.faces, surf.nf, newNf);
+        for (int n = surf.nf; n < newNf; n++) {
+            surf.faces[n][0]  = INT_MAX;
+            surf.faces[n][1]  = INT_MAX;
+            surf.faces[n][2]  = INT_MAX;
         }
-        delete[] surf.faces;
         int newFaceIndex    = surf.nf;
         surf.nf             = newNf;
-        surf.faces          = newFaces;
 
         
         for (int i = 0; i < missingVertCnt; ++i) {
@@ -872,13 +1076,8 @@ Surface NIBR::surfGlueBoundaries(const Surface& inp1, const Surface& inp2)
     // Allocate memory for new face list, and copy the previous faces
     int     lastFaceInd = out.nf;
     int     newNf       = out.nf + newFacesToAddToMerge; // increased faces, one faces per vertex is added
-    int**   newFaces    = new int*[newNf];
-    for (int n = 0; n < newNf; n++) {
-        newFaces[n] = (n < out.nf) ? out.faces[n] : (new int[3]);
-    }
-    delete[] out.faces;
+    resizeRows3(out.faces, out.nf, newNf);
     out.nf    = newNf;
-    out.faces = newFaces;
 
     
 
@@ -1138,10 +1337,8 @@ std::tuple<Surface,Surface> NIBR::splitWithPlane(const Surface& surf, const floa
     disp(MSG_DEBUG,"Processed all faces");
 
     // Next we add the new vertices and faces, and also remove the faces which were split
-    float** V = new float*[surf.nv + newVertices.size()];
+    float** V = allocateRows3<float>(surf.nv + newVertices.size());
     for (int i = 0; i < (surf.nv + int(newVertices.size())); i++) {
-        
-        V[i] = new float[3];
 
         if (i < surf.nv) {
             V[i][0] = surf.vertices[i][0];
@@ -1163,9 +1360,8 @@ std::tuple<Surface,Surface> NIBR::splitWithPlane(const Surface& surf, const floa
     // disp(MSG_DEBUG,"Created new vertex array");
 
     
-    int** F = new int*[newFaces.size()];
+    int** F = allocateRows3<int>(newFaces.size());
     for (size_t i = 0; i < (newFaces.size()) ; i++) {
-        F[i]    = new int[3];
         F[i][0] = newFaces[i][0];
         F[i][1] = newFaces[i][1];
         F[i][2] = newFaces[i][2];
@@ -1289,18 +1485,16 @@ Surface NIBR::surfacePlaneIntersection(const Surface& surf, const float planePoi
     }
 
     outSurf.nv = newVertices.size();
-    outSurf.vertices = new float*[outSurf.nv];
+    outSurf.vertices = allocateRows3<float>(outSurf.nv);
     for (int n = 0; n < outSurf.nv; n++) {
-        outSurf.vertices[n] = new float[3];
         outSurf.vertices[n][0] = newVertices[n][0];
         outSurf.vertices[n][1] = newVertices[n][1];
         outSurf.vertices[n][2] = newVertices[n][2];
     }
 
     outSurf.nf = newEdges.size();
-    outSurf.faces = new int*[outSurf.nf];
+    outSurf.faces = allocateRows3<int>(outSurf.nf);
     for (size_t i = 0; i < newEdges.size(); i++) {
-        outSurf.faces[i] = new int[3];
         outSurf.faces[i][0] = newEdges[i][0];
         outSurf.faces[i][1] = newEdges[i][1];
         outSurf.faces[i][2] = newEdges[i][0];
@@ -1488,12 +1682,11 @@ void NIBR::removeVertices(Surface* outSurf, Surface* surf, SurfaceField* mask) {
     if (nv>0) {
         
         outSurf->nv         = nv;
-        outSurf->vertices   = new float*[outSurf->nv];
+        outSurf->vertices   = allocateRows3<float>(outSurf->nv);
         outSurf->nf         = nf;
-        outSurf->faces      = new int*[outSurf->nf];
+        outSurf->faces      = allocateRows3<int>(outSurf->nf);
         
         for (int n=0; n<outSurf->nv; n++) {
-            outSurf->vertices[n]    = new float[3];
             outSurf->vertices[n][0] = surf->vertices[ids[n]][0];
             outSurf->vertices[n][1] = surf->vertices[ids[n]][1];
             outSurf->vertices[n][2] = surf->vertices[ids[n]][2];
@@ -1502,7 +1695,6 @@ void NIBR::removeVertices(Surface* outSurf, Surface* surf, SurfaceField* mask) {
         nf = 0;
         for (int n=0; n<surf->nf; n++) {
             if (includeFace[n]) {
-                outSurf->faces[nf]    = new int[3];
                 outSurf->faces[nf][0] = matchingVertex[surf->faces[n][0]];
                 outSurf->faces[nf][1] = matchingVertex[surf->faces[n][1]];
                 outSurf->faces[nf][2] = matchingVertex[surf->faces[n][2]];
@@ -1623,12 +1815,11 @@ Surface NIBR::applyMask(const Surface& surf, std::vector<bool>& mask) {
     if ( (nv>0) && (nf>0) ) {
         
         outSurf.nv         = nv;
-        outSurf.vertices   = new float*[outSurf.nv];
+        outSurf.vertices   = allocateRows3<float>(outSurf.nv);
         outSurf.nf         = nf;
-        outSurf.faces      = new int*[outSurf.nf];
+        outSurf.faces      = allocateRows3<int>(outSurf.nf);
         
         for (int n=0; n<outSurf.nv; n++) {
-            outSurf.vertices[n]    = new float[3];
             outSurf.vertices[n][0] = surf.vertices[ids[n]][0];
             outSurf.vertices[n][1] = surf.vertices[ids[n]][1];
             outSurf.vertices[n][2] = surf.vertices[ids[n]][2];
@@ -1637,7 +1828,6 @@ Surface NIBR::applyMask(const Surface& surf, std::vector<bool>& mask) {
         nf = 0;
         for (int n=0; n<surf.nf; n++) {
             if (includeFace[n]) {
-                outSurf.faces[nf]    = new int[3];
                 outSurf.faces[nf][0] = matchingVertex[surf.faces[n][0]];
                 outSurf.faces[nf][1] = matchingVertex[surf.faces[n][1]];
                 outSurf.faces[nf][2] = matchingVertex[surf.faces[n][2]];
@@ -1732,16 +1922,14 @@ bool NIBR::shiftVerticesBetweenSurfaces(Surface* out, Surface* s1, Surface* s2,
     out->nv = nv;
     out->nf = nf;
 
-    out->faces  = new int*[nf];
+    out->faces  = allocateRows3<int>(nf);
     for (int i=0; i<nf; i++) {
-        out->faces[i] = new int[3];
         memcpy(out->faces[i], s1->faces[i], 3*sizeof(int));
     }
 
     float v[3];
-    out->vertices = new float*[nv];
+    out->vertices = allocateRows3<float>(nv);
     for (int i=0; i<nv; i++) {
-        out->vertices[i] = new float[3];
         vec3sub(v,s2->vertices[i],s1->vertices[i]);
         vec3add(out->vertices[i],s1->vertices[i],v,shift);
     }
@@ -2022,6 +2210,62 @@ std::unordered_map<int,float> NIBR::getVertexNeigborhoodOfAPoint(Surface* surf,
 
 }
 
+void NIBR::getVertexNeigborhoodOfAPoint(Surface* surf, const float* p, int faceNo, float radius, VertexNeighborhoodBuffer& buffer, std::vector<std::pair<int,float>>& neighborhood)
+{
+    if (surf->neighboringVerticesOffsets.empty()) surf->getNeighboringVerticesCSR();
+
+    neighborhood.clear();
+
+    if (int(buffer.visitEpoch.size()) != surf->nv) {
+        buffer.visitEpoch.assign(surf->nv,0);
+        buffer.epoch = 0;
+    }
+
+    // Start a new epoch. On wrap around, the visit marks are reset.
+    if (++buffer.epoch == 0) {
+        std::fill(buffer.visitEpoch.begin(),buffer.visitEpoch.end(),0);
+        buffer.epoch = 1;
+    }
+
+    const uint32_t epoch   = buffer.epoch;
+    const int*     offsets = surf->neighboringVerticesOffsets.data();
+    const int*     indices = surf->neighboringVerticesIndices.data();
+
+    float rr = radius*radius;
+
+    // Initially, add vertices of the provided face to the queue and mark them as visited.
+    buffer.queue.clear();
+    for(int i = 0; i < 3; i++){
+        int vtxIndex = surf->faces[faceNo][i];
+        if (buffer.visitEpoch[vtxIndex] != epoch) {
+            buffer.visitEpoch[vtxIndex] = epoch;
+            buffer.queue.push_back(vtxIndex);
+        }
+    }
+
+    // The queue is a vector which is only appended, so the front of the queue is at qBeg.
+    for (std::size_t qBeg = 0; qBeg < buffer.queue.size(); qBeg++) {
+
+        int   currentVertex = buffer.queue[qBeg];
+        float d             = squared_dist(p, surf->vertices[currentVertex]);
+
+        if(d <= rr) {
+
+            neighborhood.emplace_back(currentVertex,std::sqrt(d));
+
+            for (int n = offsets[currentVertex]; n < offsets[currentVertex+1]; n++) {
+                int neighborIndex = indices[n];
+                if (buffer.visitEpoch[neighborIndex] != epoch) {
+                    buffer.visitEpoch[neighborIndex] = epoch;
+                    buffer.queue.push_back(neighborIndex);
+                }
+            }
+
+        }
+    }
+
+}
+
 Surface NIBR::surfDecimate(const Surface& surf, float binSize) 
 {
 
@@ -2100,7 +2344,7 @@ Surface NIBR::surfDecimate(const Surface& surf, float binSize)
     // 4. Create New Vertices (Centroids)
     Surface outSurf;
     outSurf.nv = orderedKeys.size();
-    outSurf.vertices = new float*[outSurf.nv];
+    outSurf.vertices = allocateRows3<float>(outSurf.nv);
 
     for (int i = 0; i < int(orderedKeys.size()); ++i) {
         int64_t key = orderedKeys[i];
@@ -2110,7 +2354,6 @@ Surface NIBR::surfDecimate(const Surface& surf, float binSize)
         cell.newIndex = i;
 
         // Calculate centroid
-        outSurf.vertices[i] = new float[3];
         outSurf.vertices[i][0] = static_cast<float>(cell.sumX / cell.count);
         outSurf.vertices[i][1] = static_cast<float>(cell.sumY / cell.count);
         outSurf.vertices[i][2] = static_cast<float>(cell.sumZ / cell.count);
@@ -2169,9 +2412,8 @@ Surface NIBR::surfDecimate(const Surface& surf, float binSize)
 
     // 6. Finalize Output
     outSurf.nf = tempFaces.size();
-    outSurf.faces = new int*[outSurf.nf];
+    outSurf.faces = allocateRows3<int>(outSurf.nf);
     for (size_t i = 0; i < tempFaces.size(); ++i) {
-        outSurf.faces[i] = new int[3];
         outSurf.faces[i][0] = tempFaces[i].v0;
         outSurf.faces[i][1] = tempFaces[i].v1;
         outSurf.faces[i][2] = tempFaces[i].v2;
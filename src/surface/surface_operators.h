@@ -12,7 +12,6 @@ namespace NIBR {
     Surface surfRemoveSmallFaces(const Surface& surf,double minArea);
     Surface surfRemoveSmallConnectedComponents(const Surface& surf,double minArea);
     Surface surfFillHoles(const Surface& surf,double maxArea);
-    Surface surfSmooth(const Surface& surf,int smoothing_iterations = 1);
     Surface surfRemesh(const Surface& surf,int newVertexCount, int smoothing_iterations = 1, float anisotropy = 0);
 
     std::vector<double> surfCalcAreasOfHoles(const Surface& surf);
@@ -28,6 +27,8 @@ namespace NIBR {
     Surface surfFixNormals(const Surface& surf);
 
     Surface surfMerge(const Surface& s1, const Surface& s2);
+    Surface surfMerge(const std::vector<const Surface*>& surfs);  // Merges all surfaces in one pass, keeping their order
+    Surface surfWeldVertices(const Surface& surf, float tolerance); // Merges vertices that are closer than tolerance
     Surface surfDiff(const Surface& s1, const Surface& s2);
     Surface surfGlueBoundaries(const Surface& s1, const Surface& s2); // Glues boundaries of two open surfaces so they become a closed watertight surface
 
@@ -38,6 +39,7 @@ namespace NIBR {
     Surface surfMakeItWatertight(Surface& surf);
     Surface surfMakeItSingleClosed(const Surface& surf);
 
+    Surface surfSmooth(const Surface& surf,int smoothing_iterations = 1);
     Surface surfMoveVerticesAlongNormal(const Surface& surf, float shift);
     Surface meanCurvatureFlow(const Surface& surf, float dt, int iterationCount);
 
@@ -78,6 +80,18 @@ namespace NIBR {
     // Returns the index of neighboring vertices and the distance between the vertex and the point (which lays inside face with faceNo)
     std::unordered_map<int,float> getVertexNeigborhoodOfAPoint(Surface* surf, float* p, int faceNo, float radius);
 
+    // Reusable buffers for the allocation free version of getVertexNeigborhoodOfAPoint. Use one per thread.
+    // Vertices are marked as visited with the current epoch, so the buffers don't need to be cleared between calls.
+    struct VertexNeighborhoodBuffer {
+        std::vector<uint32_t> visitEpoch;
+        uint32_t              epoch{0};
+        std::vector<int>      queue;
+    };
+
+    // Same as above but uses the CSR adjacency of the surface (surf->getNeighboringVerticesCSR() is called if needed). 
+    // neighborhood is cleared and filled with <vertexId, distance> pairs.
+    void getVertexNeigborhoodOfAPoint(Surface* surf, const float* p, int faceNo, float radius, VertexNeighborhoodBuffer& buffer, std::vector<std::pair<int,float>>& neighborhood);
+
 
 
 
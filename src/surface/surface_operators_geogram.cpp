@@ -106,10 +106,9 @@ Surface geo2surf(const GEO::Mesh& M) {
     
     // Add vertices
     surf.nv       = M.vertices.nb();
-    surf.vertices = new float*[surf.nv];
+    surf.vertices = allocateRows3<float>(surf.nv);
 
     for (int i = 0; i < surf.nv; ++i) {
-        surf.vertices[i]    = new float[3];
         surf.vertices[i][0] = M.vertices.point(i).x;
         surf.vertices[i][1] = M.vertices.point(i).y;
         surf.vertices[i][2] = M.vertices.point(i).z;
@@ -117,10 +116,9 @@ Surface geo2surf(const GEO::Mesh& M) {
 
     // Add faces
     surf.nf    = M.facets.nb();
-    surf.faces = new int*[surf.nf];
+    surf.faces = allocateRows3<int>(surf.nf);
 
     for(int i = 0; i < surf.nf; ++i) {
-        surf.faces[i]    = new int[3];
         surf.faces[i][0] = M.facets.vertex(i,0);
         surf.faces[i][1] = M.facets.vertex(i,1);
         surf.faces[i][2] = M.facets.vertex(i,2);
@@ -242,21 +240,6 @@ NIBR::Surface NIBR::surfFillHoles(const NIBR::Surface& surf, double maxArea) {
     
 }
 
-NIBR::Surface NIBR::surfSmooth(const NIBR::Surface& surf,int smoothing_iterations) {
-
-    if (surf.nv == 0) {return Surface();}
-    
-    disableTerminalOutput();
-    GEO::Mesh M;
-    surf2Geo(surfRepair(surf),M);
-
-    GEO::simple_Laplacian_smooth(M, smoothing_iterations, false);
-    enableTerminalOutput();
-
-    return surfRepair(geo2surf(M));
-    
-}
-
 NIBR::Surface NIBR::surfRemesh(const NIBR::Surface& surf,int newVertexCount, int smoothing_iterations, float anisotropy) {
 
     if (surf.nv == 0) {return Surface();}